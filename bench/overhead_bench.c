@@ -0,0 +1,475 @@
+
+#define _GNU_SOURCE
+#include <argp.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Benchmark of the resource monitor's interference with co-located workloads
+ *
+ * Every workload runs pinned to one CPU for a fixed duration, first without
+ * the monitor and then with the monitor running at every combination of
+ * interval and module set. The workload's slowdown is its loss of throughput
+ * compared to the run without the monitor. The monitor's CPU usage, peak RSS,
+ * and context switches are read from /proc while the workload runs, and its
+ * output rate from the size of its output directory. Configurations are
+ * interleaved across repetitions, and the median of every metric is reported
+ * as CSV, so that the overhead can be tracked across versions.
+ */
+#define MAX_LIST_ENTRIES 16
+#define MEMBW_BUFFER_SIZE (64 * 1024 * 1024)
+#define MONITOR_WARMUP_NS 500000000LL
+
+typedef struct {
+	const char *name;
+	// Number of operations done in duration_ns nanoseconds
+	uint64_t (*run)(int64_t duration_ns);
+} workload_t;
+
+typedef struct {
+	const char *name;
+	const char *args[16];
+} module_set_t;
+
+typedef enum {
+	OPS_PER_SEC = 0,
+	CPU_PERCENT,
+	RSS_KB,
+	CONTEXT_SWITCHES_PER_SEC,
+	BYTES_PER_HOUR,
+	NUM_METRICS
+} metric_t;
+
+typedef struct {
+	double metrics[NUM_METRICS];
+} run_result_t;
+
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/**
+ * Workloads
+ */
+static uint64_t run_cpu(int64_t duration_ns) {
+	// xorshift64* rounds, dependent on each other so they cannot be vectorized
+	uint64_t state = 0x9E3779B97F4A7C15ULL, ops = 0;
+	int64_t end_time = now_ns() + duration_ns;
+	do {
+		for (int i = 0; i < 65536; i++) {
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			state *= 0x2545F4914F6CDD1DULL;
+		}
+		ops += 65536;
+	} while (now_ns() < end_time);
+	__asm__ volatile("" : : "r"(state));
+	return ops;
+}
+
+static uint64_t run_membw(int64_t duration_ns) {
+	// Copies between the halves of a buffer much larger than the caches, counted in MiB
+	char *buffer = malloc(MEMBW_BUFFER_SIZE);
+	memset(buffer, 1, MEMBW_BUFFER_SIZE);
+	uint64_t ops = 0;
+	int64_t end_time = now_ns() + duration_ns;
+	do {
+		memcpy(buffer + (ops % 2 == 0 ? MEMBW_BUFFER_SIZE / 2 : 0),
+				buffer + (ops % 2 == 0 ? 0 : MEMBW_BUFFER_SIZE / 2), MEMBW_BUFFER_SIZE / 2);
+		__asm__ volatile("" : : "r"(buffer) : "memory");
+		ops++;
+	} while (now_ns() < end_time);
+	free(buffer);
+	return ops * (MEMBW_BUFFER_SIZE / 2 / (1024 * 1024));
+}
+
+static uint64_t run_syscall(int64_t duration_ns) {
+	// Cheap system calls, sensitive to the monitor's cache and TLB pollution
+	uint64_t ops = 0;
+	int64_t end_time = now_ns() + duration_ns;
+	do {
+		for (int i = 0; i < 1024; i++) {
+			syscall(SYS_getppid);
+		}
+		ops += 1024;
+	} while (now_ns() < end_time);
+	return ops;
+}
+
+static const workload_t workloads[] = {
+	{ "cpu", run_cpu },
+	{ "membw", run_membw },
+	{ "syscall", run_syscall }
+};
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static const module_set_t module_sets[] = {
+	// CPU utilization only
+	{ "cpu", { "--no-disk", "--no-interrupts", "--no-memory", "--no-network", "--no-numa", "--no-power",
+			"--no-schedstat", "--no-snmp", "--no-vmstat", NULL } },
+	{ "default", { NULL } },
+	// Every module that does not require root, plus rollups
+	{ "full", { "--network-source", "netlink", "--disk-latency", "--rollups", NULL } }
+};
+#define NUM_MODULE_SETS (sizeof(module_sets) / sizeof(module_sets[0]))
+
+
+/**
+ * Monitor process control
+ */
+static pid_t start_monitor(const char *monitor_path, const char *output_directory, unsigned int interval_ms,
+		const module_set_t *module_set, int monitor_cpu) {
+	char interval_arg[16];
+	snprintf(interval_arg, sizeof(interval_arg), "%u", interval_ms);
+	const char *argv[32] = { monitor_path, "-o", output_directory, "-i", interval_arg };
+	int argc = 5;
+	for (int i = 0; module_set->args[i] != NULL; i++) {
+		argv[argc++] = module_set->args[i];
+	}
+	argv[argc] = NULL;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (monitor_cpu >= 0) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(monitor_cpu, &cpus);
+			sched_setaffinity(0, sizeof(cpus), &cpus);
+		} else {
+			// Undo the workload's pinning inherited from the harness
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; cpu++) {
+				CPU_SET(cpu, &cpus);
+			}
+			sched_setaffinity(0, sizeof(cpus), &cpus);
+		}
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		execv(monitor_path, (char *const *)argv);
+		_exit(127);
+	}
+	return pid;
+}
+
+static bool read_cpu_ticks(pid_t pid, uint64_t *ticks) {
+	char path[64], line[1024];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = fgets(line, sizeof(line), file) != NULL;
+	fclose(file);
+	// Skip the command name, which may contain spaces, then utime and stime are fields 14 and 15
+	char *ptr = ok ? strrchr(line, ')') : NULL;
+	unsigned long long utime, stime;
+	if (ptr == NULL || sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+		return false;
+	}
+	*ticks = utime + stime;
+	return true;
+}
+
+static bool read_status(pid_t pid, uint64_t *context_switches, uint64_t *rss_kb) {
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	unsigned long long value;
+	*context_switches = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "VmHWM: %llu", &value) == 1) {
+			*rss_kb = value;
+		} else if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1 ||
+				sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1) {
+			*context_switches += value;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static uint64_t directory_bytes;
+
+static int add_file_size(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+	if (type == FTW_F) {
+		directory_bytes += (uint64_t)st->st_size;
+	}
+	return 0;
+}
+
+static int remove_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+	return remove(path);
+}
+
+
+/**
+ * Benchmark runs
+ */
+static bool run_once(const workload_t *workload, const char *monitor_path, unsigned int interval_ms,
+		const module_set_t *module_set, int monitor_cpu, int64_t duration_ns, run_result_t *result) {
+	memset(result, 0, sizeof(run_result_t));
+	if (module_set == NULL) {
+		int64_t workload_start = now_ns();
+		uint64_t ops = workload->run(duration_ns);
+		result->metrics[OPS_PER_SEC] = (double)ops * 1e9 / (double)(now_ns() - workload_start);
+		return true;
+	}
+
+	char output_directory[] = "/tmp/overhead-bench-XXXXXX";
+	if (mkdtemp(output_directory) == NULL) {
+		perror("mkdtemp");
+		return false;
+	}
+	int64_t monitor_start = now_ns();
+	pid_t pid = start_monitor(monitor_path, output_directory, interval_ms, module_set, monitor_cpu);
+	struct timespec warmup = { 0, MONITOR_WARMUP_NS };
+	nanosleep(&warmup, NULL);
+
+	uint64_t ticks_before, ticks_after, switches_before, switches_after, rss_kb = 0;
+	bool ok = read_cpu_ticks(pid, &ticks_before) && read_status(pid, &switches_before, &rss_kb);
+	int64_t workload_start = now_ns();
+	uint64_t ops = workload->run(duration_ns);
+	int64_t workload_time = now_ns() - workload_start;
+	ok = ok && read_cpu_ticks(pid, &ticks_after) && read_status(pid, &switches_after, &rss_kb);
+
+	kill(pid, SIGINT);
+	int status;
+	waitpid(pid, &status, 0);
+	int64_t monitor_time = now_ns() - monitor_start;
+	if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Monitor failed with %s (exit status %d)\n", module_set->name,
+				WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+		ok = false;
+	}
+
+	directory_bytes = 0;
+	nftw(output_directory, add_file_size, 16, FTW_PHYS);
+	nftw(output_directory, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+
+	result->metrics[OPS_PER_SEC] = (double)ops * 1e9 / (double)workload_time;
+	result->metrics[CPU_PERCENT] = (double)(ticks_after - ticks_before) / (double)sysconf(_SC_CLK_TCK) * 1e11 /
+			(double)workload_time;
+	result->metrics[RSS_KB] = (double)rss_kb;
+	result->metrics[CONTEXT_SWITCHES_PER_SEC] = (double)(switches_after - switches_before) * 1e9 /
+			(double)workload_time;
+	result->metrics[BYTES_PER_HOUR] = (double)directory_bytes * 3600e9 / (double)monitor_time;
+	return ok;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double median(double *values, unsigned int count) {
+	qsort(values, count, sizeof(double), compare_doubles);
+	return count % 2 == 1 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+
+/**
+ * Command-line options
+ */
+typedef struct {
+	const char *monitor_path;
+	const char *label;
+	unsigned int duration_s;
+	unsigned int repetitions;
+	int workload_cpu;
+	int monitor_cpu;
+	unsigned int intervals[MAX_LIST_ENTRIES];
+	unsigned int num_intervals;
+	bool workload_enabled[NUM_WORKLOADS];
+	bool module_set_enabled[NUM_MODULE_SETS];
+} bench_options_t;
+
+static struct argp_option argp_options[] = {
+	{ "monitor", 'm', "PATH", 0, "Resource monitor binary to benchmark [default: bin/resource-monitor]", 0 },
+	{ "label", 'l', "LABEL", 0, "Label of the results, e.g., the monitor's version [default: none]", 0 },
+	{ "duration", 'd', "SEC", 0, "Duration of every workload run, in seconds [default: 5]", 0 },
+	{ "repetitions", 'r', "N", 0, "Number of runs of every configuration, the median is reported [default: 3]", 0 },
+	{ "workload-cpu", 'c', "CPU", 0, "CPU to pin the workloads to [default: the last CPU]", 0 },
+	{ "monitor-cpu", 'C', "CPU", 0, "CPU to pin the monitor to, -1 to let it float [default: -1]", 0 },
+	{ "intervals", 'i', "LIST", 0, "Comma-separated monitor intervals, in milliseconds [default: 1,10,100]", 0 },
+	{ "workloads", 'w', "LIST", 0, "Comma-separated workloads, from 'cpu', 'membw', and 'syscall' [default: all]", 0 },
+	{ "modules", 's', "LIST", 0, "Comma-separated module sets, from 'cpu', 'default', and 'full' [default: all]", 0 },
+	{ 0 }
+};
+
+static bool parse_names(char *list, const char *names[], bool *enabled, size_t count) {
+	memset(enabled, 0, count * sizeof(bool));
+	for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+		size_t i;
+		for (i = 0; i < count && strcmp(name, names[i]) != 0; i++);
+		if (i == count) {
+			return false;
+		}
+		enabled[i] = true;
+	}
+	return true;
+}
+
+static error_t parse_option(int key, char *arg, struct argp_state *state) {
+	bench_options_t *opts = state->input;
+	const char *names[MAX_LIST_ENTRIES];
+	switch (key) {
+	case 'm':
+		opts->monitor_path = arg;
+		break;
+	case 'l':
+		opts->label = arg;
+		break;
+	case 'd':
+		opts->duration_s = (unsigned int)strtoul(arg, NULL, 10);
+		break;
+	case 'r':
+		opts->repetitions = (unsigned int)strtoul(arg, NULL, 10);
+		break;
+	case 'c':
+		opts->workload_cpu = atoi(arg);
+		break;
+	case 'C':
+		opts->monitor_cpu = atoi(arg);
+		break;
+	case 'i':
+		opts->num_intervals = 0;
+		for (char *interval = strtok(arg, ","); interval != NULL && opts->num_intervals < MAX_LIST_ENTRIES;
+				interval = strtok(NULL, ",")) {
+			opts->intervals[opts->num_intervals++] = (unsigned int)strtoul(interval, NULL, 10);
+		}
+		break;
+	case 'w':
+		for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+			names[i] = workloads[i].name;
+		}
+		if (!parse_names(arg, names, opts->workload_enabled, NUM_WORKLOADS)) {
+			argp_error(state, "Unknown workload in '%s'", arg);
+		}
+		break;
+	case 's':
+		for (size_t i = 0; i < NUM_MODULE_SETS; i++) {
+			names[i] = module_sets[i].name;
+		}
+		if (!parse_names(arg, names, opts->module_set_enabled, NUM_MODULE_SETS)) {
+			argp_error(state, "Unknown module set in '%s'", arg);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = { argp_options, parse_option, NULL,
+		"Measure the slowdown of pinned workloads caused by the resource monitor, and the monitor's own "
+		"resource usage. Results are written to stdout as CSV.", NULL, NULL, NULL };
+
+int main(int argc, char **argv) {
+	bench_options_t opts = {
+		.monitor_path = "bin/resource-monitor",
+		.label = "",
+		.duration_s = 5,
+		.repetitions = 3,
+		.workload_cpu = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1,
+		.monitor_cpu = -1,
+		.intervals = { 1, 10, 100 },
+		.num_intervals = 3
+	};
+	for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+		opts.workload_enabled[i] = true;
+	}
+	for (size_t i = 0; i < NUM_MODULE_SETS; i++) {
+		opts.module_set_enabled[i] = true;
+	}
+	argp_parse(&argp, argc, argv, 0, 0, &opts);
+	if (access(opts.monitor_path, X_OK) != 0 || opts.repetitions == 0 || opts.duration_s == 0) {
+		fprintf(stderr, "Cannot run %s with %u repetitions of %u s\n", opts.monitor_path, opts.repetitions,
+				opts.duration_s);
+		return EXIT_FAILURE;
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(opts.workload_cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+		perror("Failed to pin the workloads");
+		return EXIT_FAILURE;
+	}
+
+	// Configuration 0 of every workload runs without the monitor, the others are (module set, interval) pairs
+	size_t num_configs = 1 + NUM_MODULE_SETS * opts.num_intervals;
+	run_result_t *results = calloc(NUM_WORKLOADS * num_configs * opts.repetitions, sizeof(run_result_t));
+	int64_t duration_ns = (int64_t)opts.duration_s * 1000000000LL;
+	int status = EXIT_SUCCESS;
+	for (unsigned int rep = 0; rep < opts.repetitions; rep++) {
+		for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+			for (size_t c = 0; c < num_configs && opts.workload_enabled[w]; c++) {
+				const module_set_t *module_set = c == 0 ? NULL : &module_sets[(c - 1) / opts.num_intervals];
+				unsigned int interval_ms = c == 0 ? 0 : opts.intervals[(c - 1) % opts.num_intervals];
+				if (module_set != NULL && !opts.module_set_enabled[(c - 1) / opts.num_intervals]) {
+					continue;
+				}
+				fprintf(stderr, "Run %u/%u: %s with %s at %u ms\n", rep + 1, opts.repetitions, workloads[w].name,
+						module_set != NULL ? module_set->name : "no monitor", interval_ms);
+				run_result_t *result = &results[(w * num_configs + c) * opts.repetitions + rep];
+				if (!run_once(&workloads[w], opts.monitor_path, interval_ms, module_set, opts.monitor_cpu, duration_ns,
+						result)) {
+					status = EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	printf("label,workload,modules,interval_ms,repetitions,duration_s,ops_per_sec,slowdown_percent,"
+			"monitor_cpu_percent,monitor_rss_kb,monitor_context_switches_per_sec,monitor_bytes_per_hour\n");
+	double *samples = malloc(opts.repetitions * sizeof(double));
+	for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+		double baseline = 0;
+		for (size_t c = 0; c < num_configs && opts.workload_enabled[w]; c++) {
+			if (c > 0 && !opts.module_set_enabled[(c - 1) / opts.num_intervals]) {
+				continue;
+			}
+			run_result_t *runs = &results[(w * num_configs + c) * opts.repetitions];
+			double medians[NUM_METRICS];
+			for (int metric = 0; metric < NUM_METRICS; metric++) {
+				for (unsigned int rep = 0; rep < opts.repetitions; rep++) {
+					samples[rep] = runs[rep].metrics[metric];
+				}
+				medians[metric] = median(samples, opts.repetitions);
+			}
+			if (c == 0) {
+				baseline = medians[OPS_PER_SEC];
+			}
+			printf("%s,%s,%s,%u,%u,%u,%.1f,%.3f,%.3f,%.0f,%.1f,%.0f\n", opts.label, workloads[w].name,
+					c == 0 ? "none" : module_sets[(c - 1) / opts.num_intervals].name,
+					c == 0 ? 0 : opts.intervals[(c - 1) % opts.num_intervals], opts.repetitions, opts.duration_s,
+					medians[OPS_PER_SEC], (baseline / medians[OPS_PER_SEC] - 1) * 100, medians[CPU_PERCENT],
+					medians[RSS_KB], medians[CONTEXT_SWITCHES_PER_SEC], medians[BYTES_PER_HOUR]);
+		}
+	}
+
+	free(samples);
+	free(results);
+	return status;
+}
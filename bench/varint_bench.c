@@ -0,0 +1,114 @@
+
+#include "../src/monitor.h"
+#include "../src/varint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Benchmark of the batch varint encoders against the inline write_var_uint64_t
+ *
+ * Every encoder is run over the same input arrays, drawn from several value
+ * distributions, and its output is checked to be bit-identical to the output
+ * of the inline encoder.
+ */
+#define NUM_VALUES 4096
+#define NUM_ROUNDS 2000
+
+typedef void (*encoder_fn)(const uint64_t *, size_t, char **);
+
+static void write_var_uint64_inline(const uint64_t *values, size_t count, char **buffer) {
+	for (size_t i = 0; i < count; i++) {
+		write_var_uint64_t(values[i], buffer);
+	}
+}
+
+static uint64_t next_random(uint64_t *state) {
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void fill_values(uint64_t *values, const char *distribution, uint64_t seed) {
+	uint64_t state = seed;
+	for (size_t i = 0; i < NUM_VALUES; i++) {
+		uint64_t r = next_random(&state);
+		if (strcmp(distribution, "jiffies") == 0) {
+			// Per-CPU jiffy deltas at a 100 ms interval
+			values[i] = r % 11;
+		} else if (strcmp(distribution, "bytes") == 0) {
+			// Per-interface byte deltas
+			values[i] = r >> (40 + r % 24);
+		} else {
+			// Uniformly distributed encoded lengths of 1 to 10 bytes
+			unsigned int bits = 7 * (r % 10) + 7;
+			values[i] = bits >= 64 ? r : (r & ((1ULL << bits) - 1)) | (1ULL << (bits - 7));
+		}
+	}
+}
+
+static double run_encoder(encoder_fn encoder, const uint64_t *values, char *output, size_t *output_size) {
+	nanosec_t start_time = get_time();
+	for (unsigned int round = 0; round < NUM_ROUNDS; round++) {
+		char *ptr = output;
+		encoder(values, NUM_VALUES, &ptr);
+		*output_size = (size_t)(ptr - output);
+		__asm__ volatile("" : : "r"(output) : "memory");
+	}
+	nanosec_t end_time = get_time();
+	return (double)(end_time - start_time) / ((double)NUM_ROUNDS * NUM_VALUES);
+}
+
+int main(int argc, char **argv) {
+	const char *distributions[] = { "jiffies", "bytes", "lengths" };
+	struct {
+		const char *name;
+		encoder_fn encoder;
+		bool supported;
+	} encoders[] = {
+		{ "inline", write_var_uint64_inline, true },
+		{ "scalar", write_var_uint64_array_scalar, true },
+#ifdef VARINT_HAVE_BMI2
+		{ "bmi2", write_var_uint64_array_bmi2, __builtin_cpu_supports("bmi2") },
+#endif
+		{ "dispatch", write_var_uint64_array, true }
+	};
+	size_t num_encoders = sizeof(encoders) / sizeof(encoders[0]);
+
+	uint64_t *values = malloc(sizeof(uint64_t) * NUM_VALUES);
+	char *expected = malloc(NUM_VALUES * VAR_UINT64_MAX_SIZE);
+	char *output = malloc(NUM_VALUES * VAR_UINT64_MAX_SIZE);
+	int status = EXIT_SUCCESS;
+
+	printf("%-10s %-10s %12s %12s\n", "values", "encoder", "ns/value", "bytes/value");
+	for (size_t d = 0; d < sizeof(distributions) / sizeof(distributions[0]); d++) {
+		fill_values(values, distributions[d], 0x9E3779B97F4A7C15ULL + d);
+
+		char *ptr = expected;
+		write_var_uint64_inline(values, NUM_VALUES, &ptr);
+		size_t expected_size = (size_t)(ptr - expected);
+
+		for (size_t e = 0; e < num_encoders; e++) {
+			if (!encoders[e].supported) {
+				printf("%-10s %-10s %12s\n", distributions[d], encoders[e].name, "unsupported");
+				continue;
+			}
+			size_t output_size;
+			double ns_per_value = run_encoder(encoders[e].encoder, values, output, &output_size);
+			bool identical = output_size == expected_size && memcmp(output, expected, expected_size) == 0;
+			printf("%-10s %-10s %12.3f %12.3f%s\n", distributions[d], encoders[e].name, ns_per_value,
+					(double)output_size / NUM_VALUES, identical ? "" : "  OUTPUT MISMATCH");
+			if (!identical) {
+				status = EXIT_FAILURE;
+			}
+		}
+	}
+
+	free(values);
+	free(expected);
+	free(output);
+	return status;
+}
@@ -0,0 +1,113 @@
+
+#ifndef __RESMON_H__
+#define __RESMON_H__
+
+/**
+ * Embeddable resource monitor (libresmon)
+ *
+ * Runs the resource monitor's sampling modules inside an application, so that
+ * it can react to resource usage (e.g., shed load when the CPUs are saturated)
+ * without running a separate monitor and decoding its traces. Build the static
+ * library with `make lib` and link with bin/libresmon.a.
+ *
+ * Every module exposes the values of its last sample as a table of entities
+ * (CPUs, interfaces, disks) by fields. Counters are reported as their deltas
+ * over the last sampling interval, gauges (memory sizes, disk requests in
+ * flight) as is. Values are copied into caller-provided buffers, so sampling
+ * and reading never allocate memory, except when the set of entities grows.
+ *
+ * Usage:
+ *
+ *     resmon_config_t config = { .modules = RESMON_MODULE_BIT(RESMON_CPU) };
+ *     resmon_sampler_t *sampler = resmon_sampler_create(&config);
+ *     int64_t values[1024];
+ *     uint32_t num_entities, num_fields;
+ *     resmon_sample(sampler);
+ *     resmon_read(sampler, RESMON_CPU, values, 1024, &num_entities, &num_fields);
+ *     resmon_sampler_free(sampler);
+ *
+ * Samplers are independent of each other, so different threads may each use
+ * their own sampler. A single sampler must not be used by multiple threads at
+ * the same time.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+	// Per-CPU time in clock ticks: user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice
+	RESMON_CPU = 0,
+	// Memory and swap sizes in kB: mem_used, mem_free, mem_available, swap_free, mem_total, swap_total
+	RESMON_MEMORY,
+	// Selected /proc/vmstat counters
+	RESMON_VMSTAT,
+	// Per-interface byte and packet counters (and error counters if read over rtnetlink)
+	RESMON_NETWORK,
+	// Selected /proc/net/snmp and /proc/net/netstat counters
+	RESMON_SNMP,
+	// Per-disk request, sector, and time counters
+	RESMON_DISK,
+	RESMON_NUM_MODULES
+} resmon_module_t;
+
+#define RESMON_MODULE_BIT(module) (1U << (module))
+
+typedef struct {
+	// Bitmask of RESMON_MODULE_BIT(module) for the modules to sample
+	uint32_t modules;
+	// Read network statistics over rtnetlink instead of from /proc/net/dev
+	bool network_netlink;
+	// Counter selections as for --vmstat-counters and --snmp-counters, NULL for the defaults
+	const char *vmstat_counters;
+	const char *snmp_counters;
+	// Directory to also write the modules' traces to, or NULL to keep no traces
+	const char *output_directory;
+	// Number of CPUs, interfaces, or disks to preallocate each module's buffers for, or 0 to
+	// allocate them as entities show up
+	uint32_t max_entities;
+} resmon_config_t;
+
+typedef struct resmon_sampler resmon_sampler_t;
+
+/**
+ * Create a sampler for the configured modules, or return NULL on failure. The
+ * sampler takes an initial sample, so that the first call to resmon_sample
+ * reports the deltas since the sampler was created.
+ */
+resmon_sampler_t *resmon_sampler_create(const resmon_config_t *config);
+void resmon_sampler_free(resmon_sampler_t *sampler);
+
+/**
+ * Sample all modules, and return the time of the sample (CLOCK_REALTIME, in
+ * nanoseconds)
+ */
+int64_t resmon_sample(resmon_sampler_t *sampler);
+
+/**
+ * Copy the values of a module's last sample into values, in entity-major
+ * order (i.e., value (entity, field) is at index entity * num_fields + field).
+ * Returns the number of values, -1 (with the required shape set) if capacity
+ * is too small, or 0 if the module is not sampled or the sample holds no
+ * deltas, which happens once whenever the module's entities change (e.g., an
+ * interface is added).
+ */
+int64_t resmon_read(const resmon_sampler_t *sampler, resmon_module_t module, int64_t *values, size_t capacity,
+		uint32_t *num_entities, uint32_t *num_fields);
+
+/**
+ * Names of the entities and fields of a module's last sample, valid until the
+ * next call to resmon_sample. Entity names are NULL for numbered entities
+ * (CPUs) and single-entity modules.
+ */
+const char *resmon_entity_name(const resmon_sampler_t *sampler, resmon_module_t module, uint32_t entity);
+const char *resmon_field_name(const resmon_sampler_t *sampler, resmon_module_t module, uint32_t field);
+
+/**
+ * Sample every period_ns nanoseconds on the calling thread and call callback
+ * after every sample, until it returns false
+ */
+typedef bool (*resmon_callback_t)(resmon_sampler_t *sampler, int64_t sample_time, void *context);
+void resmon_run(resmon_sampler_t *sampler, int64_t period_ns, resmon_callback_t callback, void *context);
+
+#endif
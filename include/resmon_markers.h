@@ -0,0 +1,212 @@
+
+#ifndef __RESMON_MARKERS_H__
+#define __RESMON_MARKERS_H__
+
+/**
+ * Application phase markers for the resource monitor
+ *
+ * Header-only library for recording the begin and end of application phases
+ * in the resource monitor's traces. Markers are written into a shared-memory
+ * ring owned by the resource monitor (started with --markers), which drains
+ * the ring every tick into its markers-<hostname> trace. Timestamps use the
+ * same clock as all other traces (CLOCK_REALTIME).
+ *
+ * Recording a marker takes a clock_gettime call and a few atomic operations,
+ * it never blocks or makes a system call. If the ring is full, the marker is
+ * dropped and counted, so that the number of lost markers is recorded. The
+ * same goes for a marker whose writer is stopped for over a second while
+ * recording it, as the monitor then skips its slot.
+ *
+ * Usage:
+ *
+ *     resmon_markers_t *markers = resmon_markers_open(NULL);
+ *     resmon_marker_begin(markers, 1, "shuffle");
+ *     ...
+ *     resmon_marker_end(markers, 1, "shuffle");
+ *     resmon_markers_close(markers);
+ *
+ * All functions accept a NULL markers pointer (e.g., if the resource monitor
+ * is not running), in which case they do nothing. Link with -lrt on glibc
+ * versions before 2.34. The pid and tid of a marker are cached per thread, so
+ * a child process keeps reporting those of its parent's forking thread.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RESMON_MARKERS_DEFAULT_NAME "/resource-monitor-markers"
+#define RESMON_MARKERS_MAGIC 0x6b72616d6e6d7372ULL // "rsmnmark"
+#define RESMON_MARKERS_VERSION 2
+#define RESMON_MARKERS_LABEL_SIZE 32
+
+typedef enum {
+	RESMON_MARKER_BEGIN = 0,
+	RESMON_MARKER_END = 1,
+	RESMON_MARKER_INSTANT = 2
+} resmon_marker_type;
+
+// Flags of a slot's sequence: set while a writer fills the slot, and on a slot
+// that the monitor gave up on, which the writer one lap ahead leaves empty
+#define RESMON_MARKERS_WRITING (1ULL << 63)
+#define RESMON_MARKERS_SKIPPED (1ULL << 62)
+#define RESMON_MARKERS_FLAGS (RESMON_MARKERS_WRITING | RESMON_MARKERS_SKIPPED)
+
+// Hook for tests to stop a writer at stage 0 (claimed) or 1 (being written)
+#ifndef RESMON_MARKERS_STALL_POINT
+#define RESMON_MARKERS_STALL_POINT(stage)
+#endif
+
+// One cache line per slot
+typedef struct {
+	// Equal to the slot's position when free, position | RESMON_MARKERS_WRITING
+	// while written, and position + 1 when published
+	uint64_t sequence;
+	int64_t timestamp_ns;
+	uint32_t phase_id;
+	uint32_t pid;
+	uint32_t tid;
+	uint8_t type;
+	uint8_t reserved[3];
+	char label[RESMON_MARKERS_LABEL_SIZE];
+} resmon_marker_slot_t;
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	// Number of slots, a power of two
+	uint32_t capacity;
+	// Next position to be claimed by a writer, and next position to be read by the monitor
+	uint64_t write_position __attribute__((aligned(64)));
+	uint64_t read_position __attribute__((aligned(64)));
+	uint64_t dropped __attribute__((aligned(64)));
+	resmon_marker_slot_t slots[] __attribute__((aligned(64)));
+} resmon_markers_t;
+
+static inline size_t resmon_markers_size(uint32_t capacity) {
+	return sizeof(resmon_markers_t) + (size_t)capacity * sizeof(resmon_marker_slot_t);
+}
+
+/**
+ * Map the marker ring of a running resource monitor, name defaults to
+ * RESMON_MARKERS_DEFAULT_NAME if NULL, returns NULL if unavailable
+ */
+static inline resmon_markers_t *resmon_markers_open(const char *name) {
+	int fd = shm_open(name != NULL ? name : RESMON_MARKERS_DEFAULT_NAME, O_RDWR, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat shm_stat;
+	if (fstat(fd, &shm_stat) != 0 || (size_t)shm_stat.st_size < sizeof(resmon_markers_t)) {
+		close(fd);
+		return NULL;
+	}
+	void *mapping = mmap(NULL, (size_t)shm_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return NULL;
+	}
+
+	resmon_markers_t *markers = (resmon_markers_t *)mapping;
+	if (markers->magic != RESMON_MARKERS_MAGIC || markers->version != RESMON_MARKERS_VERSION ||
+			resmon_markers_size(markers->capacity) > (size_t)shm_stat.st_size) {
+		munmap(mapping, (size_t)shm_stat.st_size);
+		return NULL;
+	}
+	return markers;
+}
+
+static inline void resmon_markers_close(resmon_markers_t *markers) {
+	if (markers != NULL) {
+		munmap(markers, resmon_markers_size(markers->capacity));
+	}
+}
+
+/**
+ * Record a marker, returns false if it was dropped
+ */
+static inline bool resmon_marker(resmon_markers_t *markers, uint32_t phase_id, resmon_marker_type type, const char *label) {
+	if (markers == NULL) {
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	// Claim the slot at the write position if it is free (bounded MPSC queue)
+	uint32_t mask = markers->capacity - 1;
+	uint64_t position = __atomic_load_n(&markers->write_position, __ATOMIC_RELAXED);
+	resmon_marker_slot_t *slot;
+	for (;;) {
+		slot = &markers->slots[position & mask];
+		uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (sequence == position || sequence == (position | RESMON_MARKERS_SKIPPED)) {
+			if (__atomic_compare_exchange_n(&markers->write_position, &position, position + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				if (sequence == position) {
+					break;
+				}
+				// The writer one lap behind may still write to this slot, so leave it empty
+				__atomic_store_n(&slot->sequence, (position + 1) | RESMON_MARKERS_SKIPPED, __ATOMIC_RELEASE);
+				position++;
+			}
+		} else if ((sequence & ~RESMON_MARKERS_FLAGS) < position) {
+			// The slot has not been read yet, so the ring is full
+			__atomic_fetch_add(&markers->dropped, 1, __ATOMIC_RELAXED);
+			return false;
+		} else {
+			position = __atomic_load_n(&markers->write_position, __ATOMIC_RELAXED);
+		}
+	}
+	RESMON_MARKERS_STALL_POINT(0);
+
+	// The monitor gives up on slots that stay unpublished for a second and counts
+	// them as dropped, after which a late writer must not publish or fill them
+	uint64_t expected = position;
+	if (!__atomic_compare_exchange_n(&slot->sequence, &expected, position | RESMON_MARKERS_WRITING, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	RESMON_MARKERS_STALL_POINT(1);
+
+	// Cached per thread, as getpid and gettid are system calls
+	static __thread uint32_t pid = 0, tid = 0;
+	if (tid == 0) {
+		pid = (uint32_t)getpid();
+		tid = (uint32_t)syscall(SYS_gettid);
+	}
+
+	slot->timestamp_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+	slot->phase_id = phase_id;
+	slot->pid = pid;
+	slot->tid = tid;
+	slot->type = (uint8_t)type;
+	if (label != NULL) {
+		strncpy(slot->label, label, RESMON_MARKERS_LABEL_SIZE - 1);
+		slot->label[RESMON_MARKERS_LABEL_SIZE - 1] = '\0';
+	} else {
+		slot->label[0] = '\0';
+	}
+
+	// Publish the slot to the monitor, unless it gave up on the slot while it was written
+	expected = position | RESMON_MARKERS_WRITING;
+	return __atomic_compare_exchange_n(&slot->sequence, &expected, position + 1, false,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static inline bool resmon_marker_begin(resmon_markers_t *markers, uint32_t phase_id, const char *label) {
+	return resmon_marker(markers, phase_id, RESMON_MARKER_BEGIN, label);
+}
+
+static inline bool resmon_marker_end(resmon_markers_t *markers, uint32_t phase_id, const char *label) {
+	return resmon_marker(markers, phase_id, RESMON_MARKER_END, label);
+}
+
+#endif
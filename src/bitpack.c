@@ -0,0 +1,53 @@
+
+#include "bitpack.h"
+
+static inline char *store_le64(uint64_t word, char *ptr) {
+	for (unsigned int i = 0; i < 8; i++) {
+		ptr[i] = (char)(word >> (8 * i));
+	}
+	return ptr + 8;
+}
+
+void write_packed_uint64_group(const uint64_t *values, uint32_t count, char **buffer) {
+	char *ptr = *buffer;
+
+	// Determine the frame of reference and the bit width of the group
+	uint64_t min_value = count > 0 ? values[0] : 0;
+	uint64_t max_value = min_value;
+	for (uint32_t i = 1; i < count; i++) {
+		min_value = values[i] < min_value ? values[i] : min_value;
+		max_value = values[i] > max_value ? values[i] : max_value;
+	}
+	uint64_t range = max_value - min_value;
+	unsigned int width = range == 0 ? 0 : 64 - __builtin_clzll(range);
+
+	*ptr = (char)(width | (min_value != 0 ? 0x80 : 0));
+	ptr++;
+	if (min_value != 0) {
+		write_var_uint64_t(min_value, &ptr);
+	}
+
+	if (width > 0) {
+		// Accumulate packed bits in a 64-bit word and store every full word
+		uint64_t acc = 0;
+		unsigned int acc_bits = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			uint64_t value = values[i] - min_value;
+			acc |= value << acc_bits;
+			if (acc_bits + width >= 64) {
+				ptr = store_le64(acc, ptr);
+				acc = acc_bits == 0 ? 0 : value >> (64 - acc_bits);
+				acc_bits = acc_bits + width - 64;
+			} else {
+				acc_bits += width;
+			}
+		}
+		// Store the remaining bits, rounded up to whole bytes
+		for (unsigned int i = 0; i < acc_bits; i += 8) {
+			*ptr = (char)(acc >> i);
+			ptr++;
+		}
+	}
+
+	*buffer = ptr;
+}
@@ -0,0 +1,28 @@
+
+#ifndef __BITPACK_H__
+#define __BITPACK_H__
+
+#include "varint.h"
+
+#include <stdint.h>
+
+/**
+ * Frame-of-reference bit packing of groups of unsigned 64-bit values
+ *
+ * Each group is encoded as a one-byte header, followed by an optional varint
+ * reference value and the densely packed offsets of all values from that
+ * reference. The low 7 bits of the header hold the bit width of each packed
+ * value (0-64), the high bit is set if the reference value is present
+ * (otherwise it is zero). Values are packed least significant bit first and the
+ * packed values are padded to a whole number of bytes.
+ *
+ * Groups hold at most PACKED_GROUP_MAX_VALUES values, so longer arrays (e.g.,
+ * a metric column for many entities) are split into consecutive groups and
+ * every group picks its own width.
+ */
+#define PACKED_GROUP_MAX_VALUES 256
+#define PACKED_GROUP_MAX_SIZE(count) (1 + VAR_UINT64_MAX_SIZE + 8 * (count) + 8)
+
+void write_packed_uint64_group(const uint64_t *values, uint32_t count, char **buffer);
+
+#endif
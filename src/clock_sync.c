@@ -0,0 +1,115 @@
+
+#include "clock_sync.h"
+#include "varint.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/timex.h>
+
+
+/**
+ * Module data
+ */
+typedef struct {
+	nanosec_t record_period;
+	nanosec_t aligned_period;
+	// Time of the last record, or 0 before the first record
+	nanosec_t last_record_time;
+	int last_clock_state;
+	bool last_unsynchronized;
+} clock_sync_data;
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	CLOCK_SYNC = 0
+} clock_sync_msgtype;
+
+static void write_clock_sync(trace_file_t *trace_file, nanosec_t timestamp, clock_sync_data *data, int clock_state,
+		const struct timex *timex) {
+	char *buffer_ptr = trace_file->write_buffer;
+
+	DEBUG_PRINT("clock-sync: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("clock-sync: Writing message type: %u\n", CLOCK_SYNC & 0xFF);
+	*buffer_ptr = (char)CLOCK_SYNC;
+	buffer_ptr++;
+
+	// The offset is in microseconds unless the kernel runs in nanosecond mode
+	int64_t offset_ns = (int64_t)timex->offset * ((timex->status & STA_NANO) != 0 ? 1 : 1000);
+	DEBUG_PRINT("clock-sync: Writing state %d, status 0x%x, offset %lld ns, errors %ld/%ld us, frequency %ld\n",
+			clock_state, timex->status, offset_ns, timex->maxerror, timex->esterror, timex->freq);
+	*buffer_ptr = (char)clock_state;
+	buffer_ptr++;
+	write_var_uint32_t((uint32_t)timex->status, &buffer_ptr);
+	write_var_int64_t(offset_ns, &buffer_ptr);
+	write_var_uint64_t((uint64_t)timex->maxerror, &buffer_ptr);
+	write_var_uint64_t((uint64_t)timex->esterror, &buffer_ptr);
+	write_var_int64_t((int64_t)timex->freq, &buffer_ptr);
+	write_var_uint64_t(data->aligned_period, &buffer_ptr);
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * adjtimex parsing logic
+ */
+static void parse_clock_sync(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	clock_sync_data *data = (clock_sync_data *)trace_file->data;
+	// Only read the state, modes = 0 does not adjust the clock
+	struct timex timex = { .modes = 0 };
+	int clock_state = adjtimex(&timex);
+	if (clock_state < 0) {
+		return;
+	}
+
+	bool unsynchronized = clock_state == TIME_ERROR || (timex.status & STA_UNSYNC) != 0;
+	if (data->last_record_time == 0 || sample_time >= data->last_record_time + data->record_period ||
+			clock_state != data->last_clock_state || unsynchronized != data->last_unsynchronized) {
+		write_clock_sync(trace_file, sample_time, data, clock_state, &timex);
+		data->last_record_time = sample_time;
+		data->last_clock_state = clock_state;
+		data->last_unsynchronized = unsynchronized;
+	}
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static void cleanup_clock_sync(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_clock_sync_parser(const char *output_directory, const char *hostname, nanosec_t record_period,
+		nanosec_t aligned_period) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/clock-sync-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/clock-sync-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_clock_sync;
+	trace_file->cleanup_callback = cleanup_clock_sync;
+	trace_file->source_file_name = "adjtimex";
+	trace_file->data = calloc(1, sizeof(clock_sync_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	clock_sync_data *data = (clock_sync_data *)trace_file->data;
+	data->record_period = record_period;
+	data->aligned_period = aligned_period;
+
+	return trace_file;
+}
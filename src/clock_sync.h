@@ -0,0 +1,19 @@
+
+#ifndef __CLOCK_SYNC_H__
+#define __CLOCK_SYNC_H__
+
+#include "monitor.h"
+
+/**
+ * Source: the kernel's clock synchronization state (adjtimex)
+ *
+ * Records the offset and error estimates that the NTP or PTP daemon reports
+ * to the kernel, together with the period that sample instants are aligned
+ * to, so that traces merged across hosts can bound the misalignment of their
+ * samples. A record is written on the first tick, every record_period, and
+ * whenever the clock gains or loses synchronization.
+ */
+trace_file_t *init_clock_sync_parser(const char *output_directory, const char *hostname, nanosec_t record_period,
+		nanosec_t aligned_period);
+
+#endif
@@ -0,0 +1,86 @@
+
+#include "columns.h"
+#include "varint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define COLUMN_ENCODE_BLOCK_SIZE 256
+
+void metric_columns_init(metric_columns_t *columns, uint32_t num_fields, uint32_t preallocated_entities) {
+	columns->num_fields = num_fields;
+	columns->num_entities = 0;
+	columns->capacity = 0;
+	columns->preallocated_entities = preallocated_entities;
+	columns->values = NULL;
+}
+
+void metric_columns_resize(metric_columns_t *columns, uint32_t num_entities) {
+	uint32_t min_capacity = num_entities > columns->preallocated_entities ? num_entities : columns->preallocated_entities;
+	if (min_capacity > columns->capacity) {
+		free(columns->values);
+		// Round the column length up to a full cache line
+		uint32_t capacity = (min_capacity + COLUMN_VALUES_PER_LINE - 1) & ~(uint32_t)(COLUMN_VALUES_PER_LINE - 1);
+		void *values;
+		if (posix_memalign(&values, COLUMN_ALIGNMENT, sizeof(uint64_t) * columns->num_fields * capacity) != 0) {
+			values = NULL;
+			capacity = 0;
+			num_entities = 0;
+		}
+		columns->values = values;
+		columns->capacity = capacity;
+	}
+	columns->num_entities = num_entities;
+	if (columns->values != NULL) {
+		memset(columns->values, 0, sizeof(uint64_t) * columns->num_fields * columns->capacity);
+	}
+}
+
+void metric_columns_free(metric_columns_t *columns) {
+	free(columns->values);
+	columns->values = NULL;
+	columns->capacity = 0;
+	columns->num_entities = 0;
+}
+
+void metric_columns_delta(metric_columns_t *previous, const metric_columns_t *current) {
+	// Columns are laid out back-to-back and padding values are zero in both
+	// buffers, so all fields can be processed as one flat array
+	uint64_t *restrict prev = __builtin_assume_aligned(previous->values, COLUMN_ALIGNMENT);
+	const uint64_t *restrict curr = __builtin_assume_aligned(current->values, COLUMN_ALIGNMENT);
+	size_t count = (size_t)previous->num_fields * previous->capacity;
+	for (size_t i = 0; i < count; i++) {
+		prev[i] = curr[i] - prev[i];
+	}
+}
+
+void write_var_uint64_columns(const metric_columns_t *columns, uint32_t first_entity,
+		uint32_t num_entities, char **buffer) {
+	// Gather values in entity-major order into a small block and encode each
+	// block with the batch varint encoder
+	uint64_t block[COLUMN_ENCODE_BLOCK_SIZE];
+	size_t block_size = 0;
+	uint32_t end_entity = first_entity + num_entities;
+	for (uint32_t entity = first_entity; entity < end_entity; entity++) {
+		const uint64_t *value = columns->values + entity;
+		for (uint32_t field = 0; field < columns->num_fields; field++) {
+			block[block_size++] = *value;
+			value += columns->capacity;
+			if (block_size == COLUMN_ENCODE_BLOCK_SIZE) {
+				write_var_uint64_array(block, block_size, buffer);
+				block_size = 0;
+			}
+		}
+	}
+	write_var_uint64_array(block, block_size, buffer);
+}
+
+void metric_columns_read(const metric_columns_t *columns, int64_t *values) {
+	for (uint32_t entity = 0; entity < columns->num_entities; entity++) {
+		const uint64_t *value = columns->values + entity;
+		for (uint32_t field = 0; field < columns->num_fields; field++) {
+			*values++ = (int64_t)*value;
+			value += columns->capacity;
+		}
+	}
+}
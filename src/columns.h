@@ -0,0 +1,65 @@
+
+#ifndef __COLUMNS_H__
+#define __COLUMNS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Structure-of-arrays storage for per-entity metrics
+ *
+ * Every field is stored as a separate column of 64-bit values, with one value
+ * per entity (CPU, interface, disk, ...). Columns are 64-byte aligned and
+ * padded to a multiple of 8 values, so the columns of all fields together form
+ * a single contiguous array and computing the deltas of all fields for all
+ * entities is one vectorizable loop.
+ */
+#define COLUMN_ALIGNMENT 64
+#define COLUMN_VALUES_PER_LINE (COLUMN_ALIGNMENT / sizeof(uint64_t))
+
+typedef struct {
+	uint32_t num_fields;
+	uint32_t num_entities;
+	// Number of values allocated per column (multiple of COLUMN_VALUES_PER_LINE)
+	uint32_t capacity;
+	// Minimum number of entities to allocate the columns for
+	uint32_t preallocated_entities;
+	uint64_t *values;
+} metric_columns_t;
+
+/**
+ * With preallocated_entities > 0, the columns are allocated for at least that
+ * many entities, so that entities added at runtime (hotplugged CPUs, new
+ * interfaces or disks) fit without reallocating. The deltas of all allocated
+ * entities are computed on every sample, so this trades CPU time for fewer
+ * allocations.
+ */
+void metric_columns_init(metric_columns_t *columns, uint32_t num_fields, uint32_t preallocated_entities);
+void metric_columns_resize(metric_columns_t *columns, uint32_t num_entities);
+void metric_columns_free(metric_columns_t *columns);
+
+static inline uint64_t *metric_column(const metric_columns_t *columns, uint32_t field) {
+	return columns->values + (size_t)field * columns->capacity;
+}
+
+/**
+ * Compute previous := current - previous for all fields of all entities
+ */
+void metric_columns_delta(metric_columns_t *previous, const metric_columns_t *current);
+
+/**
+ * Encode the fields of entities [first_entity, first_entity + num_entities)
+ * as varints in entity-major order, i.e., all fields of the first entity,
+ * followed by all fields of the second entity, etc. The buffer must have room
+ * for num_entities * num_fields * VAR_UINT64_MAX_SIZE bytes.
+ */
+void write_var_uint64_columns(const metric_columns_t *columns, uint32_t first_entity,
+		uint32_t num_entities, char **buffer);
+
+/**
+ * Copy the fields of all entities in entity-major order, as the values of a
+ * trace_table_t
+ */
+void metric_columns_read(const metric_columns_t *columns, int64_t *values);
+
+#endif
@@ -0,0 +1,142 @@
+
+#include "hotplug.h"
+#include "monitor.h"
+
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define RECEIVE_BUFFER_SIZE (16 * 1024)
+#define SOCKET_BUFFER_SIZE (1024 * 1024)
+
+void hotplug_watcher_init(hotplug_watcher_t *watcher, hotplug_subsystem_t subsystem) {
+	watcher->subsystem = subsystem;
+	watcher->generation = 0;
+
+	int protocol = subsystem == HOTPLUG_NET ? NETLINK_ROUTE : NETLINK_KOBJECT_UEVENT;
+	watcher->socket_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+	if (watcher->socket_fd < 0) {
+		printf("Failed to create netlink socket for hotplug events, falling back to polling: %s\n", strerror(errno));
+		return;
+	}
+
+	// Increase the socket buffer to reduce the odds of dropping events between ticks
+	int socket_buffer_size = SOCKET_BUFFER_SIZE;
+	setsockopt(watcher->socket_fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(socket_buffer_size));
+
+	struct sockaddr_nl address = {
+		.nl_family = AF_NETLINK,
+		// Link notifications for rtnetlink, or kernel (as opposed to udev) uevents
+		.nl_groups = subsystem == HOTPLUG_NET ? RTMGRP_LINK : 1
+	};
+	if (bind(watcher->socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		printf("Failed to subscribe to hotplug events, falling back to polling: %s\n", strerror(errno));
+		close(watcher->socket_fd);
+		watcher->socket_fd = -1;
+	}
+}
+
+void hotplug_watcher_close(hotplug_watcher_t *watcher) {
+	if (watcher->socket_fd >= 0) {
+		close(watcher->socket_fd);
+		watcher->socket_fd = -1;
+	}
+}
+
+static bool is_known_name(const interner_t *known_names, const char *name) {
+	return interner_find(known_names, name, strlen(name)) != INTERNER_NOT_FOUND;
+}
+
+/**
+ * Returns true iff an rtnetlink message adds an unknown or removes a known interface
+ */
+static bool process_link_message(struct nlmsghdr *message, const interner_t *known_names) {
+	if (message->nlmsg_type != RTM_NEWLINK && message->nlmsg_type != RTM_DELLINK) {
+		return false;
+	}
+	struct ifinfomsg *info = NLMSG_DATA(message);
+	int attributes_length = message->nlmsg_len - NLMSG_LENGTH(sizeof(*info));
+	for (struct rtattr *attribute = IFLA_RTA(info); RTA_OK(attribute, attributes_length);
+			attribute = RTA_NEXT(attribute, attributes_length)) {
+		if (attribute->rta_type == IFLA_IFNAME) {
+			bool known = is_known_name(known_names, (const char *)RTA_DATA(attribute));
+			DEBUG_PRINT("hotplug: %s link %s (%s)\n", message->nlmsg_type == RTM_NEWLINK ? "new" : "deleted",
+					(const char *)RTA_DATA(attribute), known ? "known" : "unknown");
+			return message->nlmsg_type == RTM_NEWLINK ? !known : known;
+		}
+	}
+	// Without a name, assume the worst
+	return true;
+}
+
+/**
+ * Returns true iff a kernel uevent adds an unknown, removes a known, or moves a block device
+ */
+static bool process_block_uevent(const char *message, size_t length, const interner_t *known_names) {
+	// Format: "<action>@<devpath>\0" followed by null-terminated "KEY=value" pairs
+	const char *action = NULL, *subsystem = NULL, *devname = NULL;
+	const char *end = message + length;
+	for (const char *field = message + strnlen(message, length) + 1; field < end;
+			field += strnlen(field, end - field) + 1) {
+		if (strncmp(field, "ACTION=", 7) == 0) {
+			action = field + 7;
+		} else if (strncmp(field, "SUBSYSTEM=", 10) == 0) {
+			subsystem = field + 10;
+		} else if (strncmp(field, "DEVNAME=", 8) == 0) {
+			devname = field + 8;
+		}
+	}
+	if (action == NULL || subsystem == NULL || strcmp(subsystem, "block") != 0) {
+		return false;
+	}
+	DEBUG_PRINT("hotplug: %s block device %s\n", action, devname != NULL ? devname : "(unknown)");
+	if (devname == NULL || strcmp(action, "move") == 0) {
+		return true;
+	} else if (strcmp(action, "add") == 0) {
+		return !is_known_name(known_names, devname);
+	} else if (strcmp(action, "remove") == 0) {
+		return is_known_name(known_names, devname);
+	}
+	return false;
+}
+
+uint32_t hotplug_watcher_poll(hotplug_watcher_t *watcher, const interner_t *known_names) {
+	if (watcher->socket_fd < 0) {
+		return watcher->generation;
+	}
+
+	char buffer[RECEIVE_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	bool changed = false;
+	while (true) {
+		ssize_t length = recv(watcher->socket_fd, buffer, sizeof(buffer) - 1, 0);
+		if (length < 0) {
+			if (errno == ENOBUFS) {
+				// Events were dropped, so any entity may have changed
+				changed = true;
+				continue;
+			} else if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		if (watcher->subsystem == HOTPLUG_NET) {
+			int remaining = (int)length;
+			for (struct nlmsghdr *message = (struct nlmsghdr *)buffer; NLMSG_OK(message, remaining);
+					message = NLMSG_NEXT(message, remaining)) {
+				changed |= process_link_message(message, known_names);
+			}
+		} else {
+			buffer[length] = '\0';
+			changed |= process_block_uevent(buffer, (size_t)length, known_names);
+		}
+	}
+
+	if (changed) {
+		watcher->generation++;
+	}
+	return watcher->generation;
+}
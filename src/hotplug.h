@@ -0,0 +1,47 @@
+
+#ifndef __HOTPLUG_H__
+#define __HOTPLUG_H__
+
+#include "intern.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Event-driven detection of added, removed, and renamed entities
+ *
+ * A hotplug watcher subscribes to kernel notifications for a subsystem
+ * (RTNLGRP_LINK rtnetlink messages for network interfaces, kernel uevents for
+ * block devices) and increments a generation counter whenever an event may
+ * change the list of entities known to a module. Modules only need to verify
+ * their cached entity names when the generation changes. Events for entities
+ * that are already known (e.g., a link going up or down) are filtered out
+ * using the module's interned names.
+ *
+ * If the netlink socket cannot be created, the watcher is inactive and
+ * modules must verify their entity names every tick.
+ */
+typedef enum {
+	HOTPLUG_NET = 0,
+	HOTPLUG_BLOCK = 1
+} hotplug_subsystem_t;
+
+typedef struct {
+	hotplug_subsystem_t subsystem;
+	int socket_fd;
+	uint32_t generation;
+} hotplug_watcher_t;
+
+void hotplug_watcher_init(hotplug_watcher_t *watcher, hotplug_subsystem_t subsystem);
+void hotplug_watcher_close(hotplug_watcher_t *watcher);
+
+static inline bool hotplug_watcher_active(const hotplug_watcher_t *watcher) {
+	return watcher->socket_fd >= 0;
+}
+
+/**
+ * Process all pending events and return the current generation
+ */
+uint32_t hotplug_watcher_poll(hotplug_watcher_t *watcher, const interner_t *known_names);
+
+#endif
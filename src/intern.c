@@ -0,0 +1,135 @@
+
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_ARENA_CAPACITY 256
+#define INITIAL_NAME_CAPACITY 8
+
+static uint32_t hash_name(const char *name, uint32_t length) {
+	// 32-bit FNV-1a
+	uint32_t hash = 2166136261U;
+	for (uint32_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static void rebuild_slots(interner_t *interner, uint32_t num_slots) {
+	free(interner->slots);
+	interner->slots = calloc(num_slots, sizeof(uint32_t));
+	interner->num_slots = num_slots;
+
+	uint32_t mask = num_slots - 1;
+	for (uint32_t id = 0; id < interner->count; id++) {
+		uint32_t slot = interner->hashes[id] & mask;
+		while (interner->slots[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+		interner->slots[slot] = id + 1;
+	}
+}
+
+// Average name length to reserve arena space for with interner_preallocate
+#define PREALLOCATED_NAME_LENGTH 32
+
+void interner_init(interner_t *interner, uint32_t num_names) {
+	// The hash table size must remain a power of two
+	uint32_t initial_name_capacity = INITIAL_NAME_CAPACITY;
+	while (initial_name_capacity < num_names) {
+		initial_name_capacity *= 2;
+	}
+	uint32_t arena_capacity = initial_name_capacity > INITIAL_NAME_CAPACITY ?
+			initial_name_capacity * PREALLOCATED_NAME_LENGTH : INITIAL_ARENA_CAPACITY;
+	interner->arena = malloc(arena_capacity);
+	interner->arena_size = 0;
+	interner->arena_capacity = arena_capacity;
+	interner->offsets = malloc(sizeof(uint32_t) * (initial_name_capacity + 1));
+	interner->offsets[0] = 0;
+	interner->hashes = malloc(sizeof(uint32_t) * initial_name_capacity);
+	interner->count = 0;
+	interner->capacity = initial_name_capacity;
+	interner->slots = NULL;
+	rebuild_slots(interner, 2 * initial_name_capacity);
+}
+
+void interner_reset(interner_t *interner) {
+	interner->arena_size = 0;
+	interner->offsets[0] = 0;
+	interner->count = 0;
+	memset(interner->slots, 0, sizeof(uint32_t) * interner->num_slots);
+}
+
+void interner_free(interner_t *interner) {
+	free(interner->arena);
+	free(interner->offsets);
+	free(interner->hashes);
+	free(interner->slots);
+	memset(interner, 0, sizeof(interner_t));
+}
+
+static uint32_t find_slot(const interner_t *interner, const char *name, uint32_t length, uint32_t hash) {
+	// Linear probing, returns the slot holding the name or the first empty slot
+	uint32_t mask = interner->num_slots - 1;
+	uint32_t slot = hash & mask;
+	while (interner->slots[slot] != 0) {
+		uint32_t id = interner->slots[slot] - 1;
+		if (interner->hashes[id] == hash &&
+				interner_name_length(interner, id) == length &&
+				memcmp(interner_name(interner, id), name, length) == 0) {
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+uint32_t interner_find(const interner_t *interner, const char *name, uint32_t length) {
+	uint32_t slot = find_slot(interner, name, length, hash_name(name, length));
+	return interner->slots[slot] - 1;
+}
+
+uint32_t interner_append(interner_t *interner, const char *name, uint32_t length) {
+	// Grow the name and arena storage as needed
+	if (interner->count == interner->capacity) {
+		interner->capacity *= 2;
+		interner->offsets = realloc(interner->offsets, sizeof(uint32_t) * (interner->capacity + 1));
+		interner->hashes = realloc(interner->hashes, sizeof(uint32_t) * interner->capacity);
+	}
+	while (interner->arena_capacity - interner->arena_size < length + 1) {
+		interner->arena_capacity *= 2;
+		interner->arena = realloc(interner->arena, interner->arena_capacity);
+	}
+
+	// Append the name to the arena
+	uint32_t id = interner->count;
+	memcpy(interner->arena + interner->arena_size, name, length);
+	interner->arena[interner->arena_size + length] = '\0';
+	interner->arena_size += length + 1;
+	interner->offsets[id + 1] = interner->arena_size;
+	interner->hashes[id] = hash_name(name, length);
+	interner->count++;
+
+	// Keep the hash table at most half full
+	if (2 * interner->count > interner->num_slots) {
+		rebuild_slots(interner, 2 * interner->num_slots);
+	} else {
+		uint32_t mask = interner->num_slots - 1;
+		uint32_t slot = interner->hashes[id] & mask;
+		while (interner->slots[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+		interner->slots[slot] = id + 1;
+	}
+	return id;
+}
+
+uint32_t interner_intern(interner_t *interner, const char *name, uint32_t length) {
+	uint32_t id = interner_find(interner, name, length);
+	if (id != INTERNER_NOT_FOUND) {
+		return id;
+	}
+	return interner_append(interner, name, length);
+}
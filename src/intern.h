@@ -0,0 +1,54 @@
+
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#include <stdint.h>
+
+/**
+ * String interner for entity names (network interfaces, disks, devices, ...)
+ *
+ * Names are stored back-to-back as null-terminated strings in a single
+ * growable arena and are identified by a dense 32-bit id, assigned in order of
+ * insertion. An open-addressing hash table maps names back to their id.
+ * Resetting the interner forgets all names but keeps the allocated memory, so
+ * re-enumerating entities does not churn the heap.
+ *
+ * interner_intern returns the id of an existing equal name if there is one,
+ * interner_append always assigns a new id (e.g., for devices sharing a name).
+ */
+#define INTERNER_NOT_FOUND ((uint32_t)-1)
+
+typedef struct {
+	char *arena;
+	uint32_t arena_size;
+	uint32_t arena_capacity;
+	// Offset of each name in the arena, with offsets[count] == arena_size
+	uint32_t *offsets;
+	uint32_t *hashes;
+	uint32_t count;
+	uint32_t capacity;
+	// Hash table slots hold (id + 1), or 0 for an empty slot
+	uint32_t *slots;
+	uint32_t num_slots;
+} interner_t;
+
+/**
+ * Reserve room for num_names names, or for a few names if 0
+ */
+void interner_init(interner_t *interner, uint32_t num_names);
+void interner_reset(interner_t *interner);
+void interner_free(interner_t *interner);
+
+uint32_t interner_intern(interner_t *interner, const char *name, uint32_t length);
+uint32_t interner_append(interner_t *interner, const char *name, uint32_t length);
+uint32_t interner_find(const interner_t *interner, const char *name, uint32_t length);
+
+static inline const char *interner_name(const interner_t *interner, uint32_t id) {
+	return interner->arena + interner->offsets[id];
+}
+
+static inline uint32_t interner_name_length(const interner_t *interner, uint32_t id) {
+	return interner->offsets[id + 1] - interner->offsets[id] - 1;
+}
+
+#endif
@@ -0,0 +1,109 @@
+// sched_setaffinity is a GNU extension
+#define _GNU_SOURCE
+
+#include "isolation.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// Stack touched before locking memory, well above the monitor's deepest call chain
+#define PREFAULT_STACK_SIZE (256 * 1024)
+
+bool parse_cpu_list(const char *list, uint8_t *cpus, size_t max_cpus) {
+	if (cpus != NULL) {
+		memset(cpus, 0, max_cpus);
+	}
+	const char *ptr = list;
+	do {
+		char *end;
+		unsigned long first = strtoul(ptr, &end, 10);
+		unsigned long last = first;
+		if (end == ptr) {
+			return false;
+		}
+		if (*end == '-') {
+			ptr = end + 1;
+			last = strtoul(ptr, &end, 10);
+			if (end == ptr || last < first) {
+				return false;
+			}
+		}
+		if (last >= max_cpus) {
+			return false;
+		}
+		if (cpus != NULL) {
+			memset(cpus + first, 1, last - first + 1);
+		}
+		ptr = end;
+	} while (*ptr++ == ',');
+	return *(ptr - 1) == '\0';
+}
+
+void isolation_prepare(const monitor_options_t *opts) {
+	if (opts->cpu_affinity != NULL) {
+		uint8_t cpus[CPU_LIST_MAX_CPUS];
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		parse_cpu_list(opts->cpu_affinity, cpus, CPU_LIST_MAX_CPUS);
+		for (int cpu = 0; cpu < CPU_LIST_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+			if (cpus[cpu]) {
+				CPU_SET(cpu, &cpu_set);
+			}
+		}
+		if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+			printf("Failed to pin the monitor to CPUs %s: %s\n", opts->cpu_affinity, strerror(errno));
+		}
+	}
+
+	if (opts->lock_memory) {
+		// Serve all allocations from the heap and never return it to the kernel,
+		// so that freed and reallocated memory stays locked and mapped
+		mallopt(M_MMAP_MAX, 0);
+		mallopt(M_TRIM_THRESHOLD, -1);
+	}
+}
+
+static void prefault_stack() {
+	volatile char stack[PREFAULT_STACK_SIZE];
+	for (size_t offset = 0; offset < sizeof(stack); offset += 4096) {
+		stack[offset] = 0;
+	}
+}
+
+void isolation_apply(const monitor_options_t *opts) {
+	struct sched_param param = { .sched_priority = 0 };
+	switch (opts->scheduling_class) {
+		case SCHEDULING_DEFAULT:
+			break;
+		case SCHEDULING_NICE:
+			if (setpriority(PRIO_PROCESS, 0, opts->scheduling_priority) != 0) {
+				printf("Failed to set the monitor's nice value to %d: %s\n", opts->scheduling_priority, strerror(errno));
+			}
+			break;
+		case SCHEDULING_FIFO:
+			param.sched_priority = opts->scheduling_priority;
+			if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+				printf("Failed to run the monitor with SCHED_FIFO priority %d: %s\n", opts->scheduling_priority,
+						strerror(errno));
+			}
+			break;
+		case SCHEDULING_IDLE:
+			if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+				printf("Failed to run the monitor with SCHED_IDLE: %s\n", strerror(errno));
+			}
+			break;
+	}
+
+	if (opts->lock_memory) {
+		prefault_stack();
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+			printf("Failed to lock the monitor's memory: %s (check RLIMIT_MEMLOCK)\n", strerror(errno));
+		}
+	}
+}
@@ -0,0 +1,44 @@
+
+#ifndef __ISOLATION_H__
+#define __ISOLATION_H__
+
+#include "monitor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Self-isolation of the monitor
+ *
+ * At short intervals, the monitor's timestamps jitter when it is preempted by
+ * the workload it observes or stalls on page faults. The monitor can be
+ * pinned to housekeeping CPUs and run in a real-time, idle, or niced
+ * scheduling class. After all modules are initialized, it can lock its memory
+ * and prefault its stack so that steady-state ticks never fault. With a
+ * maximum number of entities, the per-entity buffers of all modules are
+ * preallocated, so that re-enumerating CPUs, interfaces, or disks does not
+ * allocate memory either.
+ */
+
+// Same as CPU_SETSIZE, which requires _GNU_SOURCE
+#define CPU_LIST_MAX_CPUS 1024
+
+/**
+ * Parse a CPU list such as "0,2-3" into a mask of max_cpus bytes, which may be
+ * NULL to only validate the list
+ */
+bool parse_cpu_list(const char *list, uint8_t *cpus, size_t max_cpus);
+
+/**
+ * Pin the monitor and configure the allocator, before the modules are
+ * initialized so that their memory is allocated close to the pinned CPUs
+ */
+void isolation_prepare(const monitor_options_t *opts);
+
+/**
+ * Change the scheduling class and lock all memory, after the modules are
+ * initialized
+ */
+void isolation_apply(const monitor_options_t *opts);
+
+#endif
@@ -0,0 +1,82 @@
+
+#include "jitter.h"
+
+#include <memory.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+static uint32_t bucket_of(nanosec_t value) {
+	if (value < JITTER_SUB_BUCKETS) {
+		return (uint32_t)value;
+	}
+	// The three bits below the most significant bit select the sub-bucket
+	uint32_t exponent = 63 - (uint32_t)__builtin_clzll(value);
+	uint32_t sub_bucket = (uint32_t)(value >> (exponent - 3)) & (JITTER_SUB_BUCKETS - 1);
+	return (exponent - 2) * JITTER_SUB_BUCKETS + sub_bucket;
+}
+
+static nanosec_t bucket_upper_bound(uint32_t bucket) {
+	if (bucket < JITTER_SUB_BUCKETS) {
+		return bucket;
+	}
+	uint32_t exponent = bucket / JITTER_SUB_BUCKETS + 2;
+	nanosec_t sub_bucket = bucket % JITTER_SUB_BUCKETS;
+	return ((JITTER_SUB_BUCKETS + sub_bucket + 1) << (exponent - 3)) - 1;
+}
+
+static void histogram_add(jitter_histogram_t *histogram, nanosec_t value) {
+	histogram->counts[bucket_of(value)]++;
+	histogram->num_values++;
+	if (value > histogram->max_value) {
+		histogram->max_value = value;
+	}
+}
+
+static double histogram_percentile_us(const jitter_histogram_t *histogram, double percentile) {
+	uint64_t rank = (uint64_t)(percentile / 100 * (double)histogram->num_values + 0.5);
+	rank = rank == 0 ? 1 : rank;
+	uint64_t seen = 0;
+	for (uint32_t bucket = 0; bucket < JITTER_NUM_BUCKETS; bucket++) {
+		seen += histogram->counts[bucket];
+		if (seen >= rank) {
+			nanosec_t bound = bucket_upper_bound(bucket);
+			return (double)(bound < histogram->max_value ? bound : histogram->max_value) / 1000;
+		}
+	}
+	return (double)histogram->max_value / 1000;
+}
+
+void jitter_init(jitter_stats_t *stats) {
+	memset(stats, 0, sizeof(jitter_stats_t));
+	stats->first_minor_faults = -1;
+	stats->first_major_faults = -1;
+}
+
+void jitter_record(jitter_stats_t *stats, nanosec_t scheduled_time, nanosec_t start_time, nanosec_t end_time) {
+	if (stats->first_minor_faults < 0) {
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		stats->first_minor_faults = usage.ru_minflt;
+		stats->first_major_faults = usage.ru_majflt;
+		return;
+	}
+	histogram_add(&stats->wakeup_delays, start_time > scheduled_time ? start_time - scheduled_time : 0);
+	histogram_add(&stats->sampling_times, end_time - start_time);
+}
+
+void jitter_print(const jitter_stats_t *stats) {
+	if (stats->wakeup_delays.num_values == 0) {
+		return;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Tick timing over %llu ticks (us): wake-up delay p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f; "
+			"sampling time p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f; %ld minor and %ld major page faults after the "
+			"first tick\n",
+			(unsigned long long)stats->wakeup_delays.num_values,
+			histogram_percentile_us(&stats->wakeup_delays, 50), histogram_percentile_us(&stats->wakeup_delays, 99),
+			histogram_percentile_us(&stats->wakeup_delays, 99.9), (double)stats->wakeup_delays.max_value / 1000,
+			histogram_percentile_us(&stats->sampling_times, 50), histogram_percentile_us(&stats->sampling_times, 99),
+			histogram_percentile_us(&stats->sampling_times, 99.9), (double)stats->sampling_times.max_value / 1000,
+			usage.ru_minflt - stats->first_minor_faults, usage.ru_majflt - stats->first_major_faults);
+}
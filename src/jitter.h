@@ -0,0 +1,50 @@
+
+#ifndef __JITTER_H__
+#define __JITTER_H__
+
+#include "monitor.h"
+
+#include <stdint.h>
+
+/**
+ * Tick timing statistics
+ *
+ * For every tick, the delay between its scheduled time and the moment the
+ * monitor woke up, and the time it took to sample all modules, are counted in
+ * log-linear histograms with 8 buckets per power of two (i.e., within 12.5%),
+ * so that their percentiles can be reported without allocating memory in the
+ * monitoring loop. The page faults taken after the first tick show whether
+ * the monitor's memory stayed resident.
+ */
+#define JITTER_SUB_BUCKETS 8
+#define JITTER_NUM_BUCKETS (64 * JITTER_SUB_BUCKETS)
+
+typedef struct {
+	uint64_t counts[JITTER_NUM_BUCKETS];
+	uint64_t num_values;
+	nanosec_t max_value;
+} jitter_histogram_t;
+
+typedef struct {
+	jitter_histogram_t wakeup_delays;
+	jitter_histogram_t sampling_times;
+	// Page faults at the end of the first tick, or -1 before the first tick
+	long first_minor_faults;
+	long first_major_faults;
+} jitter_stats_t;
+
+void jitter_init(jitter_stats_t *stats);
+
+/**
+ * Record a tick scheduled at scheduled_time that started at start_time and
+ * finished sampling at end_time. The first tick only takes a baseline of the
+ * page fault counters.
+ */
+void jitter_record(jitter_stats_t *stats, nanosec_t scheduled_time, nanosec_t start_time, nanosec_t end_time);
+
+/**
+ * Print the percentiles of both histograms and the page faults after the first tick
+ */
+void jitter_print(const jitter_stats_t *stats);
+
+#endif
@@ -1,10 +1,19 @@
 
 #include "monitor.h"
+#include "clock_sync.h"
 #include "daemon.h"
+#include "markers.h"
 #ifdef CUDA
 #include "nvidia.h"
 #endif
+#include "isolation.h"
+#include "jitter.h"
+#include "netlink.h"
 #include "procfs.h"
+#include "recorder.h"
+#include "rollup.h"
+#include "stream.h"
+#include "sysfs.h"
 
 #include <fcntl.h>
 #include <memory.h>
@@ -19,9 +28,11 @@
  * Catch various signals:
  * - SIGINT/SIGTERM: stop the main monitoring loop
  * - SIGUSR1: flush all metric files
+ * - SIGUSR2: trigger the flight recorder
  */
 volatile bool should_stop = false;
 volatile bool should_flush = false;
+volatile bool should_trigger = false;
 
 void sigint_handler(int signum) {
 	should_stop = true;
@@ -31,27 +42,38 @@ void sigusr1_handler(int signum) {
 	should_flush = true;
 }
 
+void sigusr2_handler(int signum) {
+	should_trigger = true;
+}
+
 void setup_sigint_handler() {
 	signal(SIGINT, sigint_handler);
 	signal(SIGTERM, sigint_handler);
 	signal(SIGUSR1, sigusr1_handler);
+	signal(SIGUSR2, sigusr2_handler);
 }
 
 /**
- * Sleep until a given moment in time.
+ * Sleep until a given moment in time. The deadline is absolute on the
+ * realtime clock, so wake-ups stay on time when the clock is adjusted.
  */
 void sleep_until(nanosec_t wake_up_time) {
-	nanosec_t current_time;
-	while ((current_time = get_time()) < wake_up_time && !should_stop) {
-		nanosec_t sleep_time = wake_up_time - current_time;
-		struct timespec sleep_timespec = {
-			.tv_sec = sleep_time / SECONDS,
-			.tv_nsec = (sleep_time % SECONDS) / NANOSECONDS
-		};
-		nanosleep(&sleep_timespec, NULL);
+	struct timespec wake_up_timespec = {
+		.tv_sec = wake_up_time / SECONDS,
+		.tv_nsec = (wake_up_time % SECONDS) / NANOSECONDS
+	};
+	while (get_time() < wake_up_time && !should_stop) {
+		clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &wake_up_timespec, NULL);
 	}
 }
 
+/**
+ * First multiple of period after time
+ */
+static nanosec_t next_aligned_time(nanosec_t time, nanosec_t period) {
+	return (time / period + 1) * period;
+}
+
 /**
  * Management of the monitor_state_t.trace_files list.
  */
@@ -80,15 +102,51 @@ monitor_state_t init_state(monitor_options_t *opts, int argc, char **argv) {
 /**
  * Initialization
  */
+trace_file_t *init_network_parser(monitor_options_t *opts, const char *hostname) {
+	if (opts->network_source == NETWORK_SOURCE_NETLINK) {
+		trace_file_t *trace_file = init_rtnl_link_parser(opts->output_directory, hostname, opts->encoding,
+				opts->max_entities);
+		if (trace_file != NULL) {
+			return trace_file;
+		}
+		printf("Falling back to /proc/net/dev for network monitoring\n");
+	}
+	return init_proc_net_dev_parser(opts->output_directory, hostname, opts->encoding, opts->max_entities);
+}
+
 void init_all_parsers(monitor_options_t *opts, monitor_state_t *state) {
 	char hostname[256];
 	gethostname(hostname, sizeof(hostname));
 	hostname[255] = '\0';
 
-	if (opts->enable_cpu_monitoring) add_trace_file(state, init_proc_stat_parser(opts->output_directory, hostname));
+	if (opts->enable_cpu_monitoring) add_trace_file(state, init_proc_stat_parser(opts->output_directory, hostname, opts->encoding,
+			opts->enable_schedstat_monitoring, opts->max_entities));
+	if (opts->enable_power_monitoring) add_trace_file(state, init_sys_power_parser(opts->output_directory, hostname,
+			opts->enable_power_msr, opts->max_entities));
+	if (opts->enable_interrupt_monitoring) {
+		add_trace_file(state, init_proc_interrupts_parser(opts->output_directory, hostname, opts->max_entities));
+		add_trace_file(state, init_proc_softirqs_parser(opts->output_directory, hostname, opts->max_entities));
+	}
 	if (opts->enable_memory_monitoring) add_trace_file(state, init_proc_meminfo_parser(opts->output_directory, hostname));
-	if (opts->enable_network_monitoring) add_trace_file(state, init_proc_net_dev_parser(opts->output_directory, hostname));
-	if (opts->enable_disk_monitoring) add_trace_file(state, init_proc_diskstats_parser(opts->output_directory, hostname));
+	if (opts->enable_numa_monitoring) add_trace_file(state, init_sys_node_parser(opts->output_directory, hostname,
+			opts->max_entities));
+	if (opts->enable_vmstat_monitoring) add_trace_file(state, init_proc_vmstat_parser(opts->output_directory, hostname, opts->vmstat_counters));
+	if (opts->enable_network_monitoring) add_trace_file(state, init_network_parser(opts, hostname));
+	if (opts->enable_snmp_monitoring) add_trace_file(state, init_proc_net_snmp_parser(opts->output_directory, hostname, opts->snmp_counters));
+	if (opts->enable_disk_monitoring) add_trace_file(state, init_proc_diskstats_parser(opts->output_directory, hostname, opts->encoding,
+			opts->enable_disk_latency, opts->max_entities));
+	if (opts->enable_process_events) {
+		trace_file_t *trace_file = init_proc_connector_parser(opts->output_directory, hostname);
+		if (trace_file != NULL) add_trace_file(state, trace_file);
+	}
+	if (opts->delay_targets != NULL) {
+		trace_file_t *trace_file = init_taskstats_delay_parser(opts->output_directory, hostname, opts->encoding,
+				opts->delay_targets, opts->max_entities);
+		if (trace_file != NULL) add_trace_file(state, trace_file);
+	}
+	if (opts->enable_markers) add_trace_file(state, init_markers_parser(opts->output_directory, hostname, opts->markers_name));
+	if (opts->align_samples) add_trace_file(state, init_clock_sync_parser(opts->output_directory, hostname,
+			opts->clock_sync_period, opts->monitor_period));
 #ifdef CUDA
 	if (opts->enable_gpu_monitoring) add_trace_file(state, init_nvml_logger(opts->output_directory, hostname));
 #endif
@@ -103,16 +161,95 @@ int main(int argc, char **argv) {
 
 	setup_sigint_handler();
 	monitor_state_t state = init_state(&opts, argc, argv);
+	isolation_prepare(&opts);
+
+	// With a unified output stream, modules are initialized in its staging directory
+	unified_stream_t *stream = NULL;
+	if (opts.enable_unified_output) {
+		stream = init_unified_stream(opts.output_directory);
+	}
+	if (stream != NULL) {
+		monitor_options_t stream_opts = opts;
+		stream_opts.output_directory = stream->staging_directory;
+		init_all_parsers(&stream_opts, &state);
+		unified_stream_attach(stream, &state);
+	} else {
+		init_all_parsers(&opts, &state);
+	}
+
+	// Rollups aggregate the regular samples, and are written next to the raw traces
+	rollup_set_t *rollups = NULL;
+	if (opts.enable_rollups) {
+		rollups = init_rollups(opts.output_directory, &state);
+	}
 
-	init_all_parsers(&opts, &state);
+	// The flight recorder samples its own instance of every module, so its
+	// high-rate deltas do not interfere with the regular output
+	flight_recorder_t *recorder = NULL;
+	if (opts.enable_flight_recorder) {
+		recorder = init_flight_recorder(&opts);
+		if (recorder != NULL) {
+			monitor_options_t recorder_opts = opts;
+			recorder_opts.output_directory = recorder->staging_directory;
+			// Markers are drained from a single ring, so only the regular instance can record them
+			recorder_opts.enable_markers = false;
+			// Process events are recorded without loss by the regular instance
+			recorder_opts.enable_process_events = false;
+			init_all_parsers(&recorder_opts, &recorder->state);
+			flight_recorder_attach(recorder);
+		}
+	}
 
-	nanosec_t last_update_time;
+	// All buffers exist now, so steady-state ticks run on locked memory
+	isolation_apply(&opts);
+	jitter_stats_t jitter;
+	jitter_init(&jitter);
+
+	nanosec_t last_update_time = 0;
+	nanosec_t next_update_time = opts.align_samples ? next_aligned_time(get_time(), opts.monitor_period) : 0;
+	nanosec_t last_flight_time = 0;
 	while (!should_stop) {
-		last_update_time = get_time();
-		DEBUG_PRINT("Monitoring at t=%llu\n", last_update_time);
+		nanosec_t current_time = get_time();
+		if (current_time >= next_update_time) {
+			nanosec_t scheduled_time = next_update_time;
+			last_update_time = current_time;
+			DEBUG_PRINT("Monitoring at t=%llu\n", last_update_time);
+
+			if (stream != NULL) {
+				unified_stream_begin_tick(stream, last_update_time);
+			}
+			for (trace_file_t *trace_file = state.trace_files; trace_file != NULL; trace_file = trace_file->next) {
+				trace_file->parse_callback(trace_file);
+			}
+			if (stream != NULL) {
+				unified_stream_end_tick(stream);
+			}
+			if (rollups != NULL) {
+				rollup_update(rollups, last_update_time);
+			}
+			jitter_record(&jitter, scheduled_time, current_time, get_time());
 
-		for (trace_file_t *trace_file = state.trace_files; trace_file != NULL; trace_file = trace_file->next) {
-			trace_file->parse_callback(trace_file);
+			// Aligned samples skip the instants that were missed, instead of drifting
+			if (opts.align_samples) {
+				next_update_time = scheduled_time + opts.monitor_period;
+				if (next_update_time <= get_time()) {
+					next_update_time = next_aligned_time(get_time(), opts.monitor_period);
+				}
+			} else {
+				next_update_time = last_update_time + opts.monitor_period;
+			}
+		}
+
+		if (recorder != NULL && current_time >= last_flight_time + opts.flight_period) {
+			last_flight_time = current_time;
+			for (trace_file_t *trace_file = recorder->state.trace_files; trace_file != NULL; trace_file = trace_file->next) {
+				trace_file->parse_callback(trace_file);
+			}
+			flight_recorder_tick(recorder, last_flight_time);
+			if (should_trigger) {
+				flight_recorder_trigger(recorder, last_flight_time, "SIGUSR2");
+				should_trigger = false;
+			}
 		}
 
 		if (should_flush) {
@@ -120,15 +257,42 @@ int main(int argc, char **argv) {
 			for (trace_file_t *trace_file = state.trace_files; trace_file != NULL; trace_file = trace_file->next) {
 				fflush(trace_file->output_file);
 			}
+			if (stream != NULL) {
+				fflush(stream->output_file);
+			}
+			if (rollups != NULL) {
+				rollup_flush(rollups);
+			}
+			jitter_print(&jitter);
 			should_flush = false;
 		}
 
-		sleep_until(last_update_time + opts.monitor_period);
+		nanosec_t wake_up_time = next_update_time;
+		if (recorder != NULL && last_flight_time + opts.flight_period < wake_up_time) {
+			wake_up_time = last_flight_time + opts.flight_period;
+		}
+		sleep_until(wake_up_time);
 	}
 
 	printf("Received SIGINT or SIGTERM, flushing output files and shutting down\n");
+	jitter_print(&jitter);
 	fflush(stdout);
-	for (trace_file_t *trace_file = state.trace_files; trace_file != NULL; trace_file = trace_file->next) {
+	if (rollups != NULL) {
+		rollup_free(rollups);
+	}
+	// Cleanup callbacks free the trace file, so advance before calling them
+	for (trace_file_t *trace_file = state.trace_files, *next; trace_file != NULL; trace_file = next) {
+		next = trace_file->next;
 		trace_file->cleanup_callback(trace_file);
 	}
+	if (stream != NULL) {
+		unified_stream_free(stream);
+	}
+	if (recorder != NULL) {
+		for (trace_file_t *trace_file = recorder->state.trace_files, *next; trace_file != NULL; trace_file = next) {
+			next = trace_file->next;
+			trace_file->cleanup_callback(trace_file);
+		}
+		flight_recorder_free(recorder);
+	}
 }
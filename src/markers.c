@@ -0,0 +1,241 @@
+
+#include "markers.h"
+#include "varint.h"
+#include "resmon_markers.h"
+
+#include <errno.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+/**
+ * Module data
+ */
+// The ring is writable by all users, so the monitor never trusts its header and
+// only uses its own capacity and read position
+#define MARKERS_CAPACITY 4096
+#define MARKERS_MASK (MARKERS_CAPACITY - 1)
+
+// A slot that stays claimed but unpublished for this long is skipped, as its
+// writer most likely died between claiming and publishing it
+#define MARKERS_STALL_TIMEOUT (1 * SECONDS)
+
+typedef struct {
+	char *shm_name;
+	resmon_markers_t *markers;
+	uint64_t read_position;
+	// Value of the ring's dropped counter at the last record
+	uint64_t dropped;
+	// Time at which the slot at the read position was first found unpublished, or 0
+	nanosec_t stall_time;
+} markers_data;
+
+static void cleanup_data_buffers(markers_data *data) {
+	if (data->markers != NULL) {
+		munmap(data->markers, resmon_markers_size(MARKERS_CAPACITY));
+		shm_unlink(data->shm_name);
+	}
+	free(data->shm_name);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	MARKERS = 1
+} markers_msgtype;
+
+#define MARKER_MAX_SIZE (VAR_UINT64_MAX_SIZE + 3 * VAR_UINT32_MAX_SIZE + 1 + RESMON_MARKERS_LABEL_SIZE)
+
+// Returns whether the slot at the read position was skipped because it stalled
+static bool skip_stalled_slot(nanosec_t timestamp, markers_data *data, uint64_t write_position) {
+	resmon_marker_slot_t *slot = &data->markers->slots[data->read_position & MARKERS_MASK];
+	uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+	if (data->read_position >= write_position ||
+			(sequence != data->read_position && sequence != (data->read_position | RESMON_MARKERS_WRITING))) {
+		data->stall_time = 0;
+		return false;
+	}
+	if (data->stall_time == 0) {
+		data->stall_time = timestamp;
+		return false;
+	}
+	if (timestamp - data->stall_time < MARKERS_STALL_TIMEOUT) {
+		return false;
+	}
+
+	// Release the slot for the writer one lap ahead, unless it changed in the meantime.
+	// A slot that is being written may still be written to by its writer, so the
+	// writer one lap ahead leaves it empty instead.
+	uint64_t released = data->read_position + MARKERS_CAPACITY;
+	if (sequence & RESMON_MARKERS_WRITING) {
+		released |= RESMON_MARKERS_SKIPPED;
+	}
+	data->stall_time = 0;
+	if (!__atomic_compare_exchange_n(&slot->sequence, &sequence, released, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	DEBUG_PRINT("markers: Skipping slot %llu, which was claimed but not published\n",
+			(unsigned long long)data->read_position);
+	data->read_position++;
+	return true;
+}
+
+// Releases the slots at the read position that writers left empty
+static void skip_empty_slots(markers_data *data, uint64_t write_position) {
+	while (data->read_position < write_position) {
+		resmon_marker_slot_t *slot = &data->markers->slots[data->read_position & MARKERS_MASK];
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ((data->read_position + 1) | RESMON_MARKERS_SKIPPED)) {
+			return;
+		}
+		__atomic_store_n(&slot->sequence, data->read_position + MARKERS_CAPACITY, __ATOMIC_RELEASE);
+		data->read_position++;
+	}
+}
+
+static void drain_markers(trace_file_t *trace_file, nanosec_t timestamp, markers_data *data) {
+	resmon_markers_t *markers = data->markers;
+	uint64_t write_position = __atomic_load_n(&markers->write_position, __ATOMIC_ACQUIRE);
+	uint64_t dropped = __atomic_load_n(&markers->dropped, __ATOMIC_RELAXED);
+	skip_empty_slots(data, write_position);
+	uint32_t num_skipped = skip_stalled_slot(timestamp, data, write_position) ? 1 : 0;
+	skip_empty_slots(data, write_position);
+	uint64_t read_position = data->read_position;
+
+	// Only read markers that were claimed before this tick; slots that are
+	// claimed but not yet published are read in a later tick
+	uint32_t num_markers = 0;
+	while (num_markers < MARKERS_CAPACITY && read_position + num_markers < write_position &&
+			__atomic_load_n(&markers->slots[(read_position + num_markers) & MARKERS_MASK].sequence, __ATOMIC_ACQUIRE) ==
+				read_position + num_markers + 1) {
+		num_markers++;
+	}
+	if (num_markers == 0 && num_skipped == 0 && dropped == data->dropped) {
+		__atomic_store_n(&markers->read_position, read_position, __ATOMIC_RELEASE);
+		return;
+	}
+
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("markers: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("markers: Writing message type: %u\n", MARKERS & 0xFF);
+	*buffer_ptr = (char)MARKERS;
+	buffer_ptr++;
+
+	// Skipped slots are counted as dropped markers
+	DEBUG_PRINT("markers: Writing num markers: %u, dropped: %llu\n", num_markers, dropped - data->dropped + num_skipped);
+	write_var_uint32_t(num_markers, &buffer_ptr);
+	write_var_uint64_t(dropped - data->dropped + num_skipped, &buffer_ptr);
+	data->dropped = dropped;
+
+	for (uint32_t marker = 0; marker < num_markers; marker++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < MARKER_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+
+		resmon_marker_slot_t *slot = &markers->slots[(read_position + marker) & MARKERS_MASK];
+		DEBUG_PRINT("markers: Writing marker %u/%u of phase %u: %s\n", slot->pid, slot->tid, slot->phase_id, slot->label);
+		// Markers precede the timestamp of the record, so their offset is usually negative
+		write_var_int64_t(slot->timestamp_ns - timestamp, &buffer_ptr);
+		write_var_uint32_t(slot->phase_id, &buffer_ptr);
+		*buffer_ptr = (char)slot->type;
+		buffer_ptr++;
+		write_var_uint32_t(slot->pid, &buffer_ptr);
+		write_var_uint32_t(slot->tid, &buffer_ptr);
+		size_t label_len = strnlen(slot->label, RESMON_MARKERS_LABEL_SIZE - 1);
+		memcpy(buffer_ptr, slot->label, label_len);
+		buffer_ptr += label_len;
+		*buffer_ptr = '\0';
+		buffer_ptr++;
+
+		// Release the slot for the writer one lap ahead
+		__atomic_store_n(&slot->sequence, read_position + marker + MARKERS_CAPACITY, __ATOMIC_RELEASE);
+	}
+	data->read_position = read_position + num_markers;
+	__atomic_store_n(&markers->read_position, data->read_position, __ATOMIC_RELEASE);
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void parse_markers(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	markers_data *data = (markers_data *)trace_file->data;
+	if (data->markers != NULL) {
+		drain_markers(trace_file, sample_time, data);
+	}
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static resmon_markers_t *create_markers_ring(const char *shm_name) {
+	// Replace the ring of a previous monitor, applications map it anew on startup
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		printf("Failed to create shared memory %s (%s), no markers will be recorded\n", shm_name, strerror(errno));
+		return NULL;
+	}
+	// Allow applications of all users to record markers regardless of the umask
+	fchmod(fd, 0666);
+
+	size_t size = resmon_markers_size(MARKERS_CAPACITY);
+	void *mapping = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0) {
+		mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		printf("Failed to map shared memory %s (%s), no markers will be recorded\n", shm_name, strerror(errno));
+		shm_unlink(shm_name);
+		return NULL;
+	}
+
+	resmon_markers_t *markers = (resmon_markers_t *)mapping;
+	markers->version = RESMON_MARKERS_VERSION;
+	markers->capacity = MARKERS_CAPACITY;
+	for (uint32_t slot = 0; slot < MARKERS_CAPACITY; slot++) {
+		markers->slots[slot].sequence = slot;
+	}
+	// Publish the magic number last, so applications never map a partially initialized ring
+	__atomic_store_n(&markers->magic, RESMON_MARKERS_MAGIC, __ATOMIC_RELEASE);
+	return markers;
+}
+
+static void cleanup_markers(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((markers_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_markers_parser(const char *output_directory, const char *hostname, const char *shm_name) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/markers-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/markers-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_markers;
+	trace_file->cleanup_callback = cleanup_markers;
+	trace_file->source_file_name = "markers";
+	trace_file->data = calloc(1, sizeof(markers_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	markers_data *data = (markers_data *)trace_file->data;
+	data->shm_name = strdup(shm_name);
+	data->markers = create_markers_ring(shm_name);
+
+	return trace_file;
+}
@@ -0,0 +1,15 @@
+
+#ifndef __MARKERS_H__
+#define __MARKERS_H__
+
+#include "monitor.h"
+
+/**
+ * Source: shared-memory ring of application phase markers (include/resmon_markers.h)
+ *
+ * Creates the ring as shm_name (e.g., /resource-monitor-markers) and removes
+ * it on cleanup. Records nothing if the ring cannot be created.
+ */
+trace_file_t *init_markers_parser(const char *output_directory, const char *hostname, const char *shm_name);
+
+#endif
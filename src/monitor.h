@@ -3,9 +3,12 @@
 #define __MONITOR_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 
+#include "varint.h"
+
 /**
  * Debug helpers
  */
@@ -35,39 +38,159 @@ static inline nanosec_t get_time() {
 /**
  * Monitor state
  */
+#define WRITE_BUFFER_SIZE (4 * 4096)
+
 typedef struct trace_file_t trace_file_t;
+
+/**
+ * Values of the last sample as a table of entities (CPUs, interfaces, ...)
+ * by fields, for modules that can be embedded as a library (see resmon.h).
+ * Counters are read as their deltas over the last tick, gauges as is.
+ */
+typedef struct {
+	// Name of the module, as in the name of its output file
+	const char *name;
+	// Shape of the table, which may change with every sample
+	void (*shape)(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields);
+	// Entity names are NULL if entities are only numbered (e.g., CPUs)
+	const char *(*entity_name)(const trace_file_t *trace_file, uint32_t entity);
+	const char *(*field_name)(const trace_file_t *trace_file, uint32_t field);
+	// Copy all values in entity-major order, returns false if the last sample holds no deltas
+	// (i.e., it is the first sample of the module or of its current entities)
+	bool (*read)(const trace_file_t *trace_file, int64_t *values);
+} trace_table_t;
+
 struct trace_file_t {
 	void (*parse_callback)(trace_file_t *);
 	void (*cleanup_callback)(trace_file_t *);
 	const char *source_file_name;
 	FILE *output_file;
 	void *data;
+	// Time that record timestamps are relative to in a unified stream (see stream.h), NULL if absolute
+	const nanosec_t *timestamp_base;
+	// Records are encoded here before being written, so that trace files never share state
+	char write_buffer[WRITE_BUFFER_SIZE];
+	// Table of the last sample's values, NULL if the module does not provide one
+	const trace_table_t *table;
+	// Records of msgtype 0 list the entities (or totals) that later records refer to (see recorder.h)
+	bool has_list_records;
 
 	trace_file_t *next;
 };
 
+/**
+ * Write the timestamp that starts every record, as a raw nanosec_t or, in a
+ * unified stream, as a var_i64 offset from the tick's timestamp
+ */
+static inline void write_timestamp(const trace_file_t *trace_file, nanosec_t timestamp, char **buffer) {
+	if (trace_file->timestamp_base != NULL) {
+		write_var_int64_t(timestamp - *trace_file->timestamp_base, buffer);
+	} else {
+		*(nanosec_t *)*buffer = timestamp;
+		*buffer += sizeof(nanosec_t);
+	}
+}
+
 typedef struct {
 	trace_file_t *trace_files;
 	int trace_file_count;
 } monitor_state_t;
 
 
+/**
+ * Encodings of metric records
+ * - ENCODING_VARINT: every value is encoded as a varint, entity by entity
+ * - ENCODING_PACKED: values are bit-packed per field (see bitpack.h)
+ */
+typedef enum {
+	ENCODING_VARINT = 0,
+	ENCODING_PACKED = 1
+} metric_encoding_t;
+
+
+/**
+ * Sources of network interface statistics
+ * - NETWORK_SOURCE_PROCFS: parse /proc/net/dev (proc_net_dev.c)
+ * - NETWORK_SOURCE_NETLINK: dump links over rtnetlink (rtnl_link.c)
+ */
+typedef enum {
+	NETWORK_SOURCE_PROCFS = 0,
+	NETWORK_SOURCE_NETLINK = 1
+} network_source_t;
+
+
+/**
+ * Scheduling classes of the monitor (see isolation.h)
+ * - SCHEDULING_DEFAULT: leave the inherited policy and nice value unchanged
+ * - SCHEDULING_NICE: SCHED_OTHER with the given nice value
+ * - SCHEDULING_FIFO: SCHED_FIFO with the given real-time priority
+ * - SCHEDULING_IDLE: SCHED_IDLE, only runs when a CPU is otherwise idle
+ */
+typedef enum {
+	SCHEDULING_DEFAULT = 0,
+	SCHEDULING_NICE,
+	SCHEDULING_FIFO,
+	SCHEDULING_IDLE
+} scheduling_class_t;
+
+
 /**
  * Program options
  */
+#define MAX_FLIGHT_TRIGGERS 8
+
 typedef struct {
 	const char *output_directory;
 	nanosec_t monitor_period;
+	// Sample at multiples of monitor_period on the realtime clock, and record the clock synchronization state
+	bool align_samples;
+	nanosec_t clock_sync_period;
+	metric_encoding_t encoding;
+	network_source_t network_source;
 	const char *log_file;
 	const char *pid_file;
 	bool daemon;
+	// Write all modules to a single stream instead of one file per module (see stream.h)
+	bool enable_unified_output;
+	// Write multi-resolution rollups of the modules' metrics (see rollup.h)
+	bool enable_rollups;
 	bool enable_cpu_monitoring;
+	bool enable_interrupt_monitoring;
+	bool enable_schedstat_monitoring;
+	bool enable_power_monitoring;
+	// Read APERF/MPERF from the MSR device, which interrupts every CPU per sample
+	bool enable_power_msr;
 #ifdef CUDA
 	bool enable_gpu_monitoring;
 #endif
 	bool enable_memory_monitoring;
+	bool enable_vmstat_monitoring;
+	bool enable_numa_monitoring;
+	const char *vmstat_counters;
 	bool enable_network_monitoring;
+	bool enable_snmp_monitoring;
+	const char *snmp_counters;
 	bool enable_disk_monitoring;
+	bool enable_disk_latency;
+	bool enable_process_events;
+	// Comma-separated delay accounting targets, or NULL to disable
+	const char *delay_targets;
+	bool enable_markers;
+	const char *markers_name;
+	// Flight recorder (see recorder.h)
+	bool enable_flight_recorder;
+	nanosec_t flight_period;
+	nanosec_t flight_pre_trigger;
+	nanosec_t flight_post_trigger;
+	size_t flight_memory;
+	const char *flight_triggers[MAX_FLIGHT_TRIGGERS];
+	uint32_t num_flight_triggers;
+	// Self-isolation (see isolation.h), CPU list to pin the monitor to or NULL to not pin it
+	const char *cpu_affinity;
+	scheduling_class_t scheduling_class;
+	int scheduling_priority;
+	bool lock_memory;
+	uint32_t max_entities;
 } monitor_options_t;
 
 monitor_options_t parse_command_line(int argc, char **argv);
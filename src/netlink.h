@@ -0,0 +1,36 @@
+
+#ifndef __NETLINK_H__
+#define __NETLINK_H__
+
+#include "monitor.h"
+
+/**
+ * Source: rtnetlink RTM_GETLINK dump (IFLA_STATS64)
+ *
+ * Alternative to /proc/net/dev that reads binary 64-bit interface counters.
+ * Buffers are preallocated for max_entities interfaces (if not 0). Returns
+ * NULL if no rtnetlink socket can be opened.
+ */
+trace_file_t *init_rtnl_link_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		uint32_t max_entities);
+
+/**
+ * Source: netlink proc connector (fork/exec/exit events) and taskstats exit statistics
+ *
+ * Records the lifecycle events of all processes and threads, and the CPU times
+ * of exiting tasks. Returns NULL if the proc connector is unavailable.
+ */
+trace_file_t *init_proc_connector_parser(const char *output_directory, const char *hostname);
+
+/**
+ * Source: taskstats generic netlink (TASKSTATS_CMD_GET)
+ *
+ * Delay accounting (CPU, block IO, swap-in, and page reclaim delays) of the
+ * given comma-separated pids, tgids, and cgroups, with buffers preallocated
+ * for max_entities tasks (if not 0). Returns NULL if taskstats is unavailable
+ * or a target is invalid.
+ */
+trace_file_t *init_taskstats_delay_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		const char *targets, uint32_t max_entities);
+
+#endif
@@ -1,4 +1,5 @@
 
+#include "intern.h"
 #include "nvidia.h"
 #include "varint.h"
 
@@ -28,7 +29,7 @@ typedef struct {
 	nvmlUnit_t *unit_handles;
 	unsigned int unit_count;
 	nvmlDevice_t *device_handles;
-	char **device_names;
+	interner_t device_names;
 	nvml_device_utilization *device_utilization;
 	unsigned int device_count;
 	bool is_initialized;
@@ -42,16 +43,12 @@ typedef enum {
 	METRICS = 1
 } nvidia_msgtype;
 
-#define WRITE_BUFFER_SIZE (4 * 4096)
-static char write_buffer[WRITE_BUFFER_SIZE];
-
-static void write_device_list(FILE *output_file, nanosec_t timestamp, nvml_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_device_list(trace_file_t *trace_file, nanosec_t timestamp, nvml_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("nvidia: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("nvidia: Writing message type: %u\n", DEVICE_LIST & 0xFF);
 	*buffer_ptr = (char)DEVICE_LIST;
@@ -61,26 +58,26 @@ static void write_device_list(FILE *output_file, nanosec_t timestamp, nvml_data
 	write_var_uint32_t(data->device_count, &buffer_ptr);
 
 	for (unsigned int device_id = 0; device_id < data->device_count; device_id++) {
-		DEBUG_PRINT("nvidia: Writing device name: %s\n", data->device_names[device_id]);
-		int device_name_len = strlen(data->device_names[device_id]);
+		const char *device_name = interner_name(&data->device_names, device_id);
+		uint32_t device_name_len = interner_name_length(&data->device_names, device_id);
+		DEBUG_PRINT("nvidia: Writing device name: %s\n", device_name);
 		if ((size_t)(end_of_buffer - buffer_ptr) < device_name_len + 1) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
 		}
-		memcpy(buffer_ptr, data->device_names[device_id], device_name_len + 1);
+		memcpy(buffer_ptr, device_name, device_name_len + 1);
 		buffer_ptr += device_name_len + 1;
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
-static void write_metrics(FILE *output_file, nanosec_t timestamp, nvml_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, nvml_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("nvidia: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("nvidia: Writing message type: %u\n", METRICS & 0xFF);
 	*buffer_ptr = (char)METRICS;
@@ -91,8 +88,8 @@ static void write_metrics(FILE *output_file, nanosec_t timestamp, nvml_data *dat
 
 	for (unsigned int device_id = 0; device_id < data->device_count; device_id++) {
 		if ((size_t)(end_of_buffer - buffer_ptr) < 12) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
 		}
 
 		nvml_device_utilization *dev_util = &data->device_utilization[device_id];
@@ -109,7 +106,7 @@ static void write_metrics(FILE *output_file, nanosec_t timestamp, nvml_data *dat
 		write_var_uint32_t(dev_util->rx_bytes, &buffer_ptr);
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
 /**
@@ -155,15 +152,17 @@ static void initialize_nvml(trace_file_t *trace_file) {
 		NVML_CALL(nvmlDeviceGetHandleByIndex_v2, device_id, &nvd->device_handles[device_id]);
 	}
 	// Get the name of each device
-	nvd->device_names = calloc(nvd->device_count, sizeof(char *));
+	// NOTE: identical GPU models share a name, so names are appended rather than interned
+	interner_init(&nvd->device_names, 0);
 	for (unsigned int device_id = 0; device_id < nvd->device_count; device_id++) {
-		nvd->device_names[device_id] = malloc(NVML_DEVICE_NAME_BUFFER_SIZE);
-		NVML_CALL(nvmlDeviceGetName, nvd->device_handles[device_id], nvd->device_names[device_id], NVML_DEVICE_NAME_BUFFER_SIZE);
+		char device_name[NVML_DEVICE_NAME_BUFFER_SIZE];
+		NVML_CALL(nvmlDeviceGetName, nvd->device_handles[device_id], device_name, NVML_DEVICE_NAME_BUFFER_SIZE);
+		interner_append(&nvd->device_names, device_name, strlen(device_name));
 	}
 	// Initialize data structures for storing device utilization
 	nvd->device_utilization = calloc(nvd->device_count, sizeof(nvml_device_utilization));
 
-	write_device_list(trace_file->output_file, sample_time, nvd);
+	write_device_list(trace_file, sample_time, nvd);
 }
 
 static void shutdown_nvml(nvml_data *nvd) {
@@ -199,7 +198,7 @@ static void log_nvml(trace_file_t *trace_file) {
 		dev_util->rx_bytes = rx_bytes;
 	}
 
-	write_metrics(trace_file->output_file, sample_time, nvd);
+	write_metrics(trace_file, sample_time, nvd);
 }
 
 /**
@@ -210,6 +209,7 @@ static void cleanup_nvml_logger(trace_file_t *trace_file) {
 	fclose(trace_file->output_file);
 	free(((nvml_data *)trace_file->data)->unit_handles);
 	free(((nvml_data *)trace_file->data)->device_handles);
+	interner_free(&((nvml_data *)trace_file->data)->device_names);
 	free(trace_file->data);
 	free(trace_file);
 }
@@ -221,10 +221,11 @@ trace_file_t *init_nvml_logger(const char *output_directory, const char *hostnam
 	strcat(output_filename, "/nvidia-");
 	strcat(output_filename, hostname);
 
-	trace_file_t *trace_file = malloc(sizeof(trace_file_t));
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
 	trace_file->parse_callback = log_nvml;
 	trace_file->cleanup_callback = cleanup_nvml_logger;
 	trace_file->source_file_name = NULL;
+	trace_file->has_list_records = true;
 	trace_file->data = calloc(1, sizeof(nvml_data));
 	trace_file->output_file = fopen(output_filename, "wb");
 
@@ -1,4 +1,7 @@
 #include "monitor.h"
+#include "isolation.h"
+#include "procfs.h"
+#include "resmon_markers.h"
 
 #include <argp.h>
 #include <string.h>
@@ -7,7 +10,12 @@
 
 #define DEFAULT_OUTPUT_DIRECTORY "."
 #define DEFAULT_MONITOR_INTERVAL 100
+#define DEFAULT_CLOCK_SYNC_INTERVAL 10
 #define DEFAULT_PID_FILE "/tmp/resource-monitor.pid"
+#define DEFAULT_FLIGHT_INTERVAL 1
+#define DEFAULT_FLIGHT_PRE_TRIGGER 10
+#define DEFAULT_FLIGHT_POST_TRIGGER 5
+#define DEFAULT_FLIGHT_MEMORY 64
 #define STR(X) #X
 #define STR2(X) STR(X)
 
@@ -17,27 +25,86 @@ static char doc[] = "A resource monitoring tool for collecting fine-grained reso
 // Define program options
 enum LONG_OPTIONS {
 	OPTION_NO_CPU = 0x100,
+	OPTION_UNIFIED,
+	OPTION_ROLLUPS,
+	OPTION_NO_INTERRUPTS,
+	OPTION_NO_SCHEDSTAT,
+	OPTION_NO_POWER,
+	OPTION_POWER_MSR,
 #ifdef CUDA
 	OPTION_NO_GPU,
 #endif
 	OPTION_NO_MEMORY,
+	OPTION_NO_VMSTAT,
+	OPTION_NO_NUMA,
 	OPTION_NO_NETWORK,
-	OPTION_NO_DISK
+	OPTION_NO_SNMP,
+	OPTION_NO_DISK,
+	OPTION_DISK_LATENCY,
+	OPTION_NETWORK_SOURCE,
+	OPTION_VMSTAT_COUNTERS,
+	OPTION_SNMP_COUNTERS,
+	OPTION_PROCESS_EVENTS,
+	OPTION_DELAY_TARGETS,
+	OPTION_MARKERS,
+	OPTION_MARKERS_NAME,
+	OPTION_FLIGHT_RECORDER,
+	OPTION_FLIGHT_INTERVAL,
+	OPTION_FLIGHT_PRE_TRIGGER,
+	OPTION_FLIGHT_POST_TRIGGER,
+	OPTION_FLIGHT_MEMORY,
+	OPTION_FLIGHT_TRIGGER,
+	OPTION_CPU_AFFINITY,
+	OPTION_PRIORITY,
+	OPTION_LOCK_MEMORY,
+	OPTION_MAX_ENTITIES,
+	OPTION_ALIGN,
+	OPTION_CLOCK_SYNC_INTERVAL
 };
 
 static struct argp_option options[] = {
 	{ "output-dir",       'o',               "DIR",  0, "Output directory to store resource traces in [default: " DEFAULT_OUTPUT_DIRECTORY "]" },
 	{ "monitor-interval", 'i',               "MS",   0, "Interval between consecutive measurements, in milliseconds [default: " STR2(DEFAULT_MONITOR_INTERVAL) "]" },
+	{ "encoding",         'e',               "ENC",  0, "Encoding of per-CPU/interface/disk metrics, 'varint' or 'packed' [default: varint]" },
 	{ "daemon",           'D',               0,      0, "Run monitor as a daemon process [default: false]" },
 	{ "pid-file",         'p',               "FILE", 0, "File to write monitoring daemon's PID to [default: " DEFAULT_PID_FILE "]" },
 	{ "log-file",         'l',               "FILE", 0, "File to write daemon logs to [default: resource-monitor-$(hostname).log]" },
+	{ "align",            OPTION_ALIGN,      0,      0, "Sample at multiples of the monitoring interval on the realtime clock, so that hosts with synchronized clocks sample at the same instants, and record the clock synchronization state [default: false]" },
+	{ "clock-sync-interval", OPTION_CLOCK_SYNC_INTERVAL, "SEC", 0, "Interval between records of the clock synchronization state with --align, in seconds [default: " STR2(DEFAULT_CLOCK_SYNC_INTERVAL) "]" },
+	{ "unified",          OPTION_UNIFIED,    0,      0, "Write all modules to a single multiplexed file per host instead of one file per module [default: false]" },
+	{ "rollups",          OPTION_ROLLUPS,    0,      0, "Also write 1 s, 10 s, 1 min, and 10 min rollups (sum/min/max/count) of the CPU, memory, vmstat, network, SNMP, and disk metrics [default: false]" },
 	{ "no-cpu",           OPTION_NO_CPU,     0,      0, "Disable monitoring of CPU resources" },
+	{ "no-interrupts",    OPTION_NO_INTERRUPTS, 0,   0, "Disable monitoring of per-CPU interrupts and softirqs" },
+	{ "no-schedstat",     OPTION_NO_SCHEDSTAT, 0,    0, "Disable monitoring of per-CPU run queue latency (/proc/schedstat)" },
+	{ "no-power",         OPTION_NO_POWER,   0,      0, "Disable monitoring of CPU frequency, throttling, and RAPL energy" },
+	{ "power-msr",        OPTION_POWER_MSR,  0,      0, "Also record the APERF/MPERF counters of every CPU, read from /dev/cpu/N/msr at the cost of an interrupt on every CPU per sample [default: false]" },
 #ifdef CUDA
 	{ "no-gpu",           OPTION_NO_GPU,     0,      0, "Disable monitoring of GPU resources" },
 #endif
 	{ "no-memory",        OPTION_NO_MEMORY,  0,      0, "Disable monitoring of memory resources" },
+	{ "no-vmstat",        OPTION_NO_VMSTAT,  0,      0, "Disable monitoring of paging, reclaim, and compaction activity" },
+	{ "no-numa",          OPTION_NO_NUMA,    0,      0, "Disable monitoring of per-NUMA-node memory" },
 	{ "no-network",       OPTION_NO_NETWORK, 0,      0, "Disable monitoring of network resources" },
+	{ "no-snmp",          OPTION_NO_SNMP,    0,      0, "Disable monitoring of IP, TCP, and UDP protocol counters" },
 	{ "no-disk",          OPTION_NO_DISK,    0,      0, "Disable monitoring of disk resources" },
+	{ "disk-latency",     OPTION_DISK_LATENCY, 0,    0, "Also record the mean IO latency and queue depth of each disk per interval [default: false]" },
+	{ "network-source",   OPTION_NETWORK_SOURCE, "SRC", 0, "Source of network statistics, 'procfs' (/proc/net/dev) or 'netlink' (rtnetlink, includes errors and drops) [default: procfs]" },
+	{ "vmstat-counters",  OPTION_VMSTAT_COUNTERS, "LIST", 0, "Comma-separated list of /proc/vmstat counters to record, a trailing '*' matches any suffix [default: " DEFAULT_VMSTAT_COUNTERS "]" },
+	{ "snmp-counters",    OPTION_SNMP_COUNTERS, "LIST", 0, "Comma-separated list of /proc/net/{snmp,netstat} counters to record as <Protocol>:<Counter>, a trailing '*' matches any suffix [default: " DEFAULT_SNMP_COUNTERS "]" },
+	{ "process-events",   OPTION_PROCESS_EVENTS, 0,  0, "Record process fork/exec/exit events and the CPU times of exiting tasks (requires root) [default: false]" },
+	{ "delay-targets",    OPTION_DELAY_TARGETS, "LIST", 0, "Record the CPU, block IO, swap-in, and reclaim delays of a comma-separated list of processes ('<tgid>'), threads ('pid:<pid>'), and cgroups ('cgroup:<path>') [default: none]" },
+	{ "markers",          OPTION_MARKERS,    0,      0, "Record application phase markers written to a shared-memory ring (see include/resmon_markers.h) [default: false]" },
+	{ "markers-name",     OPTION_MARKERS_NAME, "NAME", 0, "Name of the shared-memory ring for application phase markers [default: " RESMON_MARKERS_DEFAULT_NAME "]" },
+	{ "flight-recorder",  OPTION_FLIGHT_RECORDER, 0, 0, "Also sample all modules at a high rate into in-memory ring buffers, which are written to disk when triggered by SIGUSR2 or --flight-trigger [default: false]" },
+	{ "flight-interval",  OPTION_FLIGHT_INTERVAL, "MS", 0, "Interval between consecutive flight recorder measurements, in milliseconds [default: " STR2(DEFAULT_FLIGHT_INTERVAL) "]" },
+	{ "flight-pre",       OPTION_FLIGHT_PRE_TRIGGER, "SEC", 0, "Seconds of flight recorder data to write from before a trigger [default: " STR2(DEFAULT_FLIGHT_PRE_TRIGGER) "]" },
+	{ "flight-post",      OPTION_FLIGHT_POST_TRIGGER, "SEC", 0, "Seconds of flight recorder data to write from after a trigger [default: " STR2(DEFAULT_FLIGHT_POST_TRIGGER) "]" },
+	{ "flight-memory",    OPTION_FLIGHT_MEMORY, "MB", 0, "Memory used by the flight recorder's buffers, in MiB [default: " STR2(DEFAULT_FLIGHT_MEMORY) "]" },
+	{ "flight-trigger",   OPTION_FLIGHT_TRIGGER, "SPEC", 0, "Flight recorder trigger, either a PSI trigger 'psi:<cpu|memory|io>:<some|full>:<stall_us>:<window_us>' or a threshold '<file>[:<key>](>|<)<value>' on the number following key in file, may be repeated" },
+	{ "cpu-affinity",     OPTION_CPU_AFFINITY, "LIST", 0, "Pin the monitor to a list of (housekeeping) CPUs, e.g., '0' or '0,2-3' [default: not pinned]" },
+	{ "priority",         OPTION_PRIORITY,   "PRIO", 0, "Scheduling class of the monitor, 'fifo[:<1-99>]' (real-time, requires CAP_SYS_NICE), 'idle', or a nice value from -20 to 19 [default: inherited]" },
+	{ "lock-memory",      OPTION_LOCK_MEMORY, 0,     0, "Lock all of the monitor's memory after initialization, so that sampling never page faults (subject to RLIMIT_MEMLOCK) [default: false]" },
+	{ "max-entities",     OPTION_MAX_ENTITIES, "N",  0, "Preallocate per-entity buffers for N CPUs, interfaces, or disks per module, so that hotplugged entities do not allocate memory [default: 0, grow on demand]" },
 	{ 0 }
 };
 
@@ -59,6 +126,16 @@ static error_t option_parser(int key, char *arg, struct argp_state *state) {
 			}
 			opts->monitor_period = arg_as_int * MILLISECONDS;
 			break;
+		case 'e': // --encoding
+			if (strcmp(arg, "varint") == 0) {
+				opts->encoding = ENCODING_VARINT;
+			} else if (strcmp(arg, "packed") == 0) {
+				opts->encoding = ENCODING_PACKED;
+			} else {
+				fprintf(stderr, "Encoding must be one of 'varint' or 'packed'\n");
+				return EINVAL;
+			}
+			break;
 		case 'D': // --daemon
 			opts->daemon = true;
 			break;
@@ -68,9 +145,38 @@ static error_t option_parser(int key, char *arg, struct argp_state *state) {
 		case 'p': // --pid-file
 			opts->pid_file = arg;
 			break;
+		case OPTION_ALIGN: // --align
+			opts->align_samples = true;
+			break;
+		case OPTION_CLOCK_SYNC_INTERVAL: // --clock-sync-interval
+			arg_as_int = atoi(arg);
+			if (arg_as_int <= 0) {
+				fprintf(stderr, "Clock synchronization interval must be a postive integer\n");
+				return EINVAL;
+			}
+			opts->clock_sync_period = arg_as_int * SECONDS;
+			break;
+		case OPTION_UNIFIED: // --unified
+			opts->enable_unified_output = true;
+			break;
+		case OPTION_ROLLUPS: // --rollups
+			opts->enable_rollups = true;
+			break;
 		case OPTION_NO_CPU: // --no-cpu
 			opts->enable_cpu_monitoring = false;
 			break;
+		case OPTION_NO_INTERRUPTS: // --no-interrupts
+			opts->enable_interrupt_monitoring = false;
+			break;
+		case OPTION_NO_SCHEDSTAT: // --no-schedstat
+			opts->enable_schedstat_monitoring = false;
+			break;
+		case OPTION_NO_POWER: // --no-power
+			opts->enable_power_monitoring = false;
+			break;
+		case OPTION_POWER_MSR: // --power-msr
+			opts->enable_power_msr = true;
+			break;
 #ifdef CUDA
 		case OPTION_NO_GPU: // --no-gpu
 			opts->enable_gpu_monitoring = false;
@@ -79,12 +185,136 @@ static error_t option_parser(int key, char *arg, struct argp_state *state) {
 		case OPTION_NO_MEMORY: // --no-memory
 			opts->enable_memory_monitoring = false;
 			break;
+		case OPTION_NO_VMSTAT: // --no-vmstat
+			opts->enable_vmstat_monitoring = false;
+			break;
+		case OPTION_NO_NUMA: // --no-numa
+			opts->enable_numa_monitoring = false;
+			break;
 		case OPTION_NO_NETWORK: // --no-network
 			opts->enable_network_monitoring = false;
 			break;
+		case OPTION_NO_SNMP: // --no-snmp
+			opts->enable_snmp_monitoring = false;
+			break;
 		case OPTION_NO_DISK: // --no-disk
 			opts->enable_disk_monitoring = false;
 			break;
+		case OPTION_DISK_LATENCY: // --disk-latency
+			opts->enable_disk_latency = true;
+			break;
+		case OPTION_NETWORK_SOURCE: // --network-source
+			if (strcmp(arg, "procfs") == 0) {
+				opts->network_source = NETWORK_SOURCE_PROCFS;
+			} else if (strcmp(arg, "netlink") == 0) {
+				opts->network_source = NETWORK_SOURCE_NETLINK;
+			} else {
+				fprintf(stderr, "Network source must be one of 'procfs' or 'netlink'\n");
+				return EINVAL;
+			}
+			break;
+		case OPTION_VMSTAT_COUNTERS: // --vmstat-counters
+			opts->vmstat_counters = arg;
+			break;
+		case OPTION_SNMP_COUNTERS: // --snmp-counters
+			opts->snmp_counters = arg;
+			break;
+		case OPTION_PROCESS_EVENTS: // --process-events
+			opts->enable_process_events = true;
+			break;
+		case OPTION_DELAY_TARGETS: // --delay-targets
+			opts->delay_targets = arg;
+			break;
+		case OPTION_MARKERS: // --markers
+			opts->enable_markers = true;
+			break;
+		case OPTION_MARKERS_NAME: // --markers-name
+			if (arg[0] != '/' || strchr(arg + 1, '/') != NULL) {
+				fprintf(stderr, "Markers name must start with '/' and contain no other '/'\n");
+				return EINVAL;
+			}
+			opts->markers_name = arg;
+			break;
+		case OPTION_FLIGHT_RECORDER: // --flight-recorder
+			opts->enable_flight_recorder = true;
+			break;
+		case OPTION_FLIGHT_INTERVAL: // --flight-interval
+			arg_as_int = atoi(arg);
+			if (arg_as_int <= 0) {
+				fprintf(stderr, "Flight recorder interval must be a postive integer\n");
+				return EINVAL;
+			}
+			opts->flight_period = arg_as_int * MILLISECONDS;
+			break;
+		case OPTION_FLIGHT_PRE_TRIGGER: // --flight-pre
+			arg_as_int = atoi(arg);
+			if (arg_as_int < 0) {
+				fprintf(stderr, "Flight recorder pre-trigger duration must be a non-negative integer\n");
+				return EINVAL;
+			}
+			opts->flight_pre_trigger = arg_as_int * SECONDS;
+			break;
+		case OPTION_FLIGHT_POST_TRIGGER: // --flight-post
+			arg_as_int = atoi(arg);
+			if (arg_as_int < 0) {
+				fprintf(stderr, "Flight recorder post-trigger duration must be a non-negative integer\n");
+				return EINVAL;
+			}
+			opts->flight_post_trigger = arg_as_int * SECONDS;
+			break;
+		case OPTION_FLIGHT_MEMORY: // --flight-memory
+			arg_as_int = atoi(arg);
+			if (arg_as_int <= 0) {
+				fprintf(stderr, "Flight recorder memory must be a postive integer\n");
+				return EINVAL;
+			}
+			opts->flight_memory = (size_t)arg_as_int << 20;
+			break;
+		case OPTION_FLIGHT_TRIGGER: // --flight-trigger
+			if (opts->num_flight_triggers == MAX_FLIGHT_TRIGGERS) {
+				fprintf(stderr, "At most %d flight recorder triggers are supported\n", MAX_FLIGHT_TRIGGERS);
+				return EINVAL;
+			}
+			opts->flight_triggers[opts->num_flight_triggers++] = arg;
+			break;
+		case OPTION_CPU_AFFINITY: // --cpu-affinity
+			if (!parse_cpu_list(arg, NULL, CPU_LIST_MAX_CPUS)) {
+				fprintf(stderr, "CPU affinity must be a comma-separated list of CPUs and CPU ranges\n");
+				return EINVAL;
+			}
+			opts->cpu_affinity = arg;
+			break;
+		case OPTION_PRIORITY: // --priority
+			if (strcmp(arg, "idle") == 0) {
+				opts->scheduling_class = SCHEDULING_IDLE;
+			} else if (strncmp(arg, "fifo", 4) == 0 && (arg[4] == '\0' || arg[4] == ':')) {
+				opts->scheduling_class = SCHEDULING_FIFO;
+				opts->scheduling_priority = arg[4] == ':' ? atoi(arg + 5) : 1;
+				if (opts->scheduling_priority < 1 || opts->scheduling_priority > 99) {
+					fprintf(stderr, "Real-time priority must be between 1 and 99\n");
+					return EINVAL;
+				}
+			} else {
+				char *end;
+				opts->scheduling_class = SCHEDULING_NICE;
+				opts->scheduling_priority = (int)strtol(arg, &end, 10);
+				if (end == arg || *end != '\0' || opts->scheduling_priority < -20 || opts->scheduling_priority > 19) {
+					fprintf(stderr, "Priority must be one of 'fifo[:<1-99>]', 'idle', or a nice value from -20 to 19\n");
+					return EINVAL;
+				}
+			}
+			break;
+		case OPTION_LOCK_MEMORY: // --lock-memory
+			opts->lock_memory = true;
+			break;
+		case OPTION_MAX_ENTITIES: // --max-entities
+			arg_as_int = atoi(arg);
+			if (arg_as_int < 0) {
+				fprintf(stderr, "Maximum number of entities must be a non-negative integer\n");
+				return EINVAL;
+			}
+			opts->max_entities = (uint32_t)arg_as_int;
+			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
 	}
@@ -109,16 +339,47 @@ monitor_options_t parse_command_line(int argc, char **argv) {
 	monitor_options_t opts = {
 		.output_directory = DEFAULT_OUTPUT_DIRECTORY,
 		.monitor_period = DEFAULT_MONITOR_INTERVAL * MILLISECONDS,
+		.align_samples = false,
+		.clock_sync_period = DEFAULT_CLOCK_SYNC_INTERVAL * SECONDS,
+		.encoding = ENCODING_VARINT,
+		.network_source = NETWORK_SOURCE_PROCFS,
 		.log_file = default_log_file,
 		.pid_file = DEFAULT_PID_FILE,
 		.daemon = false,
+		.enable_unified_output = false,
+		.enable_rollups = false,
 		.enable_cpu_monitoring = true,
+		.enable_interrupt_monitoring = true,
+		.enable_schedstat_monitoring = true,
+		.enable_power_monitoring = true,
+		.enable_power_msr = false,
 #ifdef CUDA
 		.enable_gpu_monitoring = true,
 #endif
 		.enable_memory_monitoring = true,
+		.enable_vmstat_monitoring = true,
+		.enable_numa_monitoring = true,
+		.vmstat_counters = DEFAULT_VMSTAT_COUNTERS,
 		.enable_network_monitoring = true,
-		.enable_disk_monitoring = true
+		.enable_snmp_monitoring = true,
+		.snmp_counters = DEFAULT_SNMP_COUNTERS,
+		.enable_disk_monitoring = true,
+		.enable_disk_latency = false,
+		.enable_process_events = false,
+		.delay_targets = NULL,
+		.enable_markers = false,
+		.markers_name = RESMON_MARKERS_DEFAULT_NAME,
+		.enable_flight_recorder = false,
+		.flight_period = DEFAULT_FLIGHT_INTERVAL * MILLISECONDS,
+		.flight_pre_trigger = DEFAULT_FLIGHT_PRE_TRIGGER * SECONDS,
+		.flight_post_trigger = DEFAULT_FLIGHT_POST_TRIGGER * SECONDS,
+		.flight_memory = (size_t)DEFAULT_FLIGHT_MEMORY << 20,
+		.num_flight_triggers = 0,
+		.cpu_affinity = NULL,
+		.scheduling_class = SCHEDULING_DEFAULT,
+		.scheduling_priority = 0,
+		.lock_memory = false,
+		.max_entities = 0
 	};
 	// Parse any command line options
 	argp_parse(&argp, argc, argv, 0, 0, &opts);
@@ -126,16 +387,49 @@ monitor_options_t parse_command_line(int argc, char **argv) {
 	DEBUG_PRINT("Monitoring options after parsing the command line:\n");
 	DEBUG_PRINT("  output_directory = %s\n", opts.output_directory);
 	DEBUG_PRINT("  monitor_period = %llu ns\n", opts.monitor_period);
+	DEBUG_PRINT("  align_samples = %d\n", opts.align_samples);
+	DEBUG_PRINT("  clock_sync_period = %llu ns\n", opts.clock_sync_period);
+	DEBUG_PRINT("  encoding = %d\n", opts.encoding);
+	DEBUG_PRINT("  network_source = %d\n", opts.network_source);
 	DEBUG_PRINT("  daemon = %d\n", opts.daemon);
+	DEBUG_PRINT("  enable_unified_output = %d\n", opts.enable_unified_output);
+	DEBUG_PRINT("  enable_rollups = %d\n", opts.enable_rollups);
 	DEBUG_PRINT("  log_file = %s\n", opts.log_file);
 	DEBUG_PRINT("  pid_file = %s\n", opts.pid_file);
 	DEBUG_PRINT("  enable_cpu_monitoring = %d\n", opts.enable_cpu_monitoring);
+	DEBUG_PRINT("  enable_interrupt_monitoring = %d\n", opts.enable_interrupt_monitoring);
+	DEBUG_PRINT("  enable_schedstat_monitoring = %d\n", opts.enable_schedstat_monitoring);
+	DEBUG_PRINT("  enable_power_monitoring = %d\n", opts.enable_power_monitoring);
+	DEBUG_PRINT("  enable_power_msr = %d\n", opts.enable_power_msr);
 #ifdef CUDA
 	DEBUG_PRINT("  enable_gpu_monitoring = %d\n", opts.enable_gpu_monitoring);
 #endif
 	DEBUG_PRINT("  enable_memory_monitoring = %d\n", opts.enable_memory_monitoring);
+	DEBUG_PRINT("  enable_vmstat_monitoring = %d\n", opts.enable_vmstat_monitoring);
+	DEBUG_PRINT("  enable_numa_monitoring = %d\n", opts.enable_numa_monitoring);
+	DEBUG_PRINT("  vmstat_counters = %s\n", opts.vmstat_counters);
 	DEBUG_PRINT("  enable_network_monitoring = %d\n", opts.enable_network_monitoring);
+	DEBUG_PRINT("  enable_snmp_monitoring = %d\n", opts.enable_snmp_monitoring);
+	DEBUG_PRINT("  snmp_counters = %s\n", opts.snmp_counters);
 	DEBUG_PRINT("  enable_disk_monitoring = %d\n", opts.enable_disk_monitoring);
+	DEBUG_PRINT("  enable_disk_latency = %d\n", opts.enable_disk_latency);
+	DEBUG_PRINT("  enable_process_events = %d\n", opts.enable_process_events);
+	DEBUG_PRINT("  delay_targets = %s\n", opts.delay_targets);
+	DEBUG_PRINT("  enable_markers = %d\n", opts.enable_markers);
+	DEBUG_PRINT("  markers_name = %s\n", opts.markers_name);
+	DEBUG_PRINT("  enable_flight_recorder = %d\n", opts.enable_flight_recorder);
+	DEBUG_PRINT("  flight_period = %llu ns\n", opts.flight_period);
+	DEBUG_PRINT("  flight_pre_trigger = %llu ns\n", opts.flight_pre_trigger);
+	DEBUG_PRINT("  flight_post_trigger = %llu ns\n", opts.flight_post_trigger);
+	DEBUG_PRINT("  flight_memory = %zu bytes\n", opts.flight_memory);
+	for (uint32_t i = 0; i < opts.num_flight_triggers; i++) {
+		DEBUG_PRINT("  flight_triggers[%u] = %s\n", i, opts.flight_triggers[i]);
+	}
+	DEBUG_PRINT("  cpu_affinity = %s\n", opts.cpu_affinity);
+	DEBUG_PRINT("  scheduling_class = %d\n", opts.scheduling_class);
+	DEBUG_PRINT("  scheduling_priority = %d\n", opts.scheduling_priority);
+	DEBUG_PRINT("  lock_memory = %d\n", opts.lock_memory);
+	DEBUG_PRINT("  max_entities = %u\n", opts.max_entities);
 
 	// Clean up default_log_file buffer if needed
 	if (opts.log_file != default_log_file) {
@@ -0,0 +1,79 @@
+
+#include "parse.h"
+
+#include <fcntl.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define INITIAL_BUFFER_CAPACITY 4096
+
+bool proc_file_open(proc_file_t *file, const char *path) {
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	file->buffer = malloc(INITIAL_BUFFER_CAPACITY);
+	file->buffer[0] = '\0';
+	file->size = 0;
+	file->capacity = INITIAL_BUFFER_CAPACITY;
+	return file->fd >= 0;
+}
+
+void proc_file_close(proc_file_t *file) {
+	if (file->fd >= 0) {
+		close(file->fd);
+		file->fd = -1;
+	}
+	free(file->buffer);
+	file->buffer = NULL;
+	file->size = 0;
+	file->capacity = 0;
+}
+
+bool proc_file_read(proc_file_t *file) {
+	if (file->fd < 0) {
+		return false;
+	}
+
+	// procfs files are generated on read, so read until EOF, growing the
+	// buffer if needed, and keep one byte for the null terminator
+	size_t size = 0;
+	for (;;) {
+		if (file->capacity - size < 2) {
+			file->capacity *= 2;
+			file->buffer = realloc(file->buffer, file->capacity);
+		}
+		ssize_t bytes_read = pread(file->fd, file->buffer + size, file->capacity - size - 1, (off_t)size);
+		if (bytes_read < 0) {
+			file->size = 0;
+			file->buffer[0] = '\0';
+			return false;
+		}
+		if (bytes_read == 0) {
+			break;
+		}
+		size += (size_t)bytes_read;
+	}
+
+	file->size = size;
+	file->buffer[size] = '\0';
+	return true;
+}
+
+bool is_selected_counter(const char *counter_patterns, const char *name, size_t name_len) {
+	const char *pattern = counter_patterns;
+	while (*pattern != '\0') {
+		const char *end_of_pattern = pattern;
+		while (*end_of_pattern != '\0' && *end_of_pattern != ',') {
+			end_of_pattern++;
+		}
+		size_t pattern_len = (size_t)(end_of_pattern - pattern);
+		if (pattern_len > 0 && pattern[pattern_len - 1] == '*') {
+			if (name_len >= pattern_len - 1 && memcmp(name, pattern, pattern_len - 1) == 0) {
+				return true;
+			}
+		} else if (name_len == pattern_len && memcmp(name, pattern, pattern_len) == 0) {
+			return true;
+		}
+		pattern = *end_of_pattern == ',' ? end_of_pattern + 1 : end_of_pattern;
+	}
+	return false;
+}
@@ -0,0 +1,109 @@
+
+#ifndef __PARSE_H__
+#define __PARSE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Whole-file reads of procfs/sysfs files
+ *
+ * A proc_file_t keeps its file descriptor open between ticks and reads the
+ * complete file into a growable, null-terminated buffer with pread, so the
+ * file can be parsed in a single pass without stdio. The buffer grows until
+ * the whole file fits, which matters for files such as /proc/stat whose size
+ * scales with the number of CPUs and interrupts.
+ */
+typedef struct {
+	int fd;
+	char *buffer;
+	size_t size;
+	size_t capacity;
+} proc_file_t;
+
+bool proc_file_open(proc_file_t *file, const char *path);
+void proc_file_close(proc_file_t *file);
+
+/**
+ * Read the current contents of the file, returns false on error
+ */
+bool proc_file_read(proc_file_t *file);
+
+
+/**
+ * Tokenizing helpers for null-terminated buffers
+ */
+static inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline void skip_spaces(const char **ptr) {
+	while (**ptr == ' ' || **ptr == '\t') {
+		(*ptr)++;
+	}
+}
+
+static inline void skip_line(const char **ptr) {
+	while (**ptr != '\0' && **ptr != '\n') {
+		(*ptr)++;
+	}
+	if (**ptr == '\n') {
+		(*ptr)++;
+	}
+}
+
+static inline void skip_token(const char **ptr) {
+	skip_spaces(ptr);
+	while (**ptr != '\0' && **ptr != ' ' && **ptr != '\t' && **ptr != '\n') {
+		(*ptr)++;
+	}
+}
+
+static inline bool at_end_of_line(const char **ptr) {
+	skip_spaces(ptr);
+	return **ptr == '\n' || **ptr == '\0';
+}
+
+/**
+ * Parse an unsigned decimal number after optional spaces, or return 0 if there is none
+ */
+static inline uint64_t parse_uint64(const char **ptr) {
+	skip_spaces(ptr);
+	uint64_t value = 0;
+	while (is_digit(**ptr)) {
+		value = value * 10 + (uint64_t)(**ptr - '0');
+		(*ptr)++;
+	}
+	return value;
+}
+
+/**
+ * Returns true and advances past prefix iff the buffer starts with prefix
+ */
+static inline bool consume_prefix(const char **ptr, const char *prefix, size_t prefix_length) {
+	for (size_t i = 0; i < prefix_length; i++) {
+		if ((*ptr)[i] != prefix[i]) {
+			return false;
+		}
+	}
+	*ptr += prefix_length;
+	return true;
+}
+#define CONSUME_PREFIX(ptr, prefix) consume_prefix(ptr, prefix, sizeof(prefix) - 1)
+
+
+/**
+ * Selection of named counters (e.g., in /proc/vmstat)
+ *
+ * Returns whether the name matches one of the comma-separated counter_patterns,
+ * in which a trailing '*' matches any suffix. Users may select gauges as well,
+ * so the deltas of selected counters are recorded as signed values. Modules
+ * map the counters of a file to recorded indices once, with NOT_RECORDED for
+ * counters that are not selected.
+ */
+#define NOT_RECORDED (-1)
+
+bool is_selected_counter(const char *counter_patterns, const char *name, size_t name_len);
+
+#endif
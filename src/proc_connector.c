@@ -0,0 +1,344 @@
+// recvmmsg is a GNU extension
+#define _GNU_SOURCE
+
+#include "netlink.h"
+#include "taskstats.h"
+#include "varint.h"
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/**
+ * Module data
+ */
+typedef enum {
+	EVENT_FORK = 0,
+	EVENT_EXEC = 1,
+	EVENT_EXIT = 2,
+	EVENT_EXIT_STATS = 3
+} process_event_type;
+
+typedef struct {
+	uint8_t type;
+	nanosec_t timestamp;
+	uint32_t pid;
+	uint32_t tgid;
+	// Child pid and tgid of a fork, exit code and signal of an exit
+	uint32_t arguments[2];
+	// User and system CPU time of an exited task, in microseconds
+	uint64_t user_time_us;
+	uint64_t system_time_us;
+	char command[TS_COMM_LEN];
+} process_event;
+
+#define RECEIVE_BATCH_SIZE 64
+// Large enough for a connector message with one proc_event
+#define RECEIVE_MESSAGE_SIZE 256
+
+typedef struct {
+	int socket_fd;
+	char receive_buffers[RECEIVE_BATCH_SIZE][RECEIVE_MESSAGE_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	// Exit statistics, not available if the kernel lacks CONFIG_TASKSTATS
+	taskstats_socket_t taskstats;
+	bool has_taskstats;
+	// Events drained in the current tick
+	process_event *events;
+	uint32_t num_events;
+	uint32_t events_capacity;
+	// Number of times messages were lost since the last record
+	uint32_t num_overflows;
+} proc_connector_data;
+
+static process_event *append_event(proc_connector_data *data) {
+	if (data->num_events == data->events_capacity) {
+		data->events_capacity = data->events_capacity == 0 ? 64 : 2 * data->events_capacity;
+		data->events = realloc(data->events, sizeof(process_event) * data->events_capacity);
+	}
+	process_event *event = &data->events[data->num_events++];
+	memset(event, 0, sizeof(*event));
+	return event;
+}
+
+static void cleanup_data_buffers(proc_connector_data *data) {
+	close(data->socket_fd);
+	if (data->has_taskstats) {
+		taskstats_close(&data->taskstats);
+	}
+	free(data->events);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	EVENTS = 1
+} proc_connector_msgtype;
+
+#define EVENT_MAX_SIZE (1 + VAR_UINT64_MAX_SIZE + 4 * VAR_UINT32_MAX_SIZE + 2 * VAR_UINT64_MAX_SIZE + TS_COMM_LEN)
+
+static void write_events(trace_file_t *trace_file, nanosec_t timestamp, proc_connector_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-events: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-events: Writing message type: %u\n", EVENTS & 0xFF);
+	*buffer_ptr = (char)EVENTS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-events: Writing num events: %u, overflows: %u\n", data->num_events, data->num_overflows);
+	write_var_uint32_t(data->num_events, &buffer_ptr);
+	write_var_uint32_t(data->num_overflows, &buffer_ptr);
+
+	for (uint32_t event_id = 0; event_id < data->num_events; event_id++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < EVENT_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+
+		process_event *event = &data->events[event_id];
+		DEBUG_PRINT("proc-events: Writing event %u of %u/%u\n", event->type, event->pid, event->tgid);
+		*buffer_ptr = (char)event->type;
+		buffer_ptr++;
+		write_var_int64_t(event->timestamp - timestamp, &buffer_ptr);
+		write_var_uint32_t(event->pid, &buffer_ptr);
+		write_var_uint32_t(event->tgid, &buffer_ptr);
+		switch (event->type) {
+			case EVENT_FORK:
+			case EVENT_EXIT:
+				write_var_uint32_t(event->arguments[0], &buffer_ptr);
+				write_var_uint32_t(event->arguments[1], &buffer_ptr);
+				break;
+			case EVENT_EXIT_STATS: {
+				write_var_uint64_t(event->user_time_us, &buffer_ptr);
+				write_var_uint64_t(event->system_time_us, &buffer_ptr);
+				size_t command_len = strnlen(event->command, TS_COMM_LEN - 1);
+				memcpy(buffer_ptr, event->command, command_len);
+				buffer_ptr += command_len;
+				*buffer_ptr = '\0';
+				buffer_ptr++;
+				break;
+			}
+		}
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * Event receiving logic
+ */
+#define SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+
+static void store_event(proc_connector_data *data, const struct proc_event *proc_event, nanosec_t clock_offset) {
+	process_event *event;
+	switch (proc_event->what) {
+		case PROC_EVENT_FORK:
+			event = append_event(data);
+			event->type = EVENT_FORK;
+			event->pid = proc_event->event_data.fork.parent_pid;
+			event->tgid = proc_event->event_data.fork.parent_tgid;
+			event->arguments[0] = proc_event->event_data.fork.child_pid;
+			event->arguments[1] = proc_event->event_data.fork.child_tgid;
+			break;
+		case PROC_EVENT_EXEC:
+			event = append_event(data);
+			event->type = EVENT_EXEC;
+			event->pid = proc_event->event_data.exec.process_pid;
+			event->tgid = proc_event->event_data.exec.process_tgid;
+			break;
+		case PROC_EVENT_EXIT:
+			event = append_event(data);
+			event->type = EVENT_EXIT;
+			event->pid = proc_event->event_data.exit.process_pid;
+			event->tgid = proc_event->event_data.exit.process_tgid;
+			event->arguments[0] = proc_event->event_data.exit.exit_code;
+			event->arguments[1] = proc_event->event_data.exit.exit_signal;
+			break;
+		default:
+			// Other events (uid/gid/sid changes, ptrace, comm, coredump) are not recorded
+			return;
+	}
+	// Event timestamps use the monotonic clock
+	event->timestamp = (nanosec_t)proc_event->timestamp_ns + clock_offset;
+}
+
+static void receive_proc_events(proc_connector_data *data, nanosec_t clock_offset) {
+	struct mmsghdr messages[RECEIVE_BATCH_SIZE];
+	struct iovec vectors[RECEIVE_BATCH_SIZE];
+	for (int i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		vectors[i].iov_base = data->receive_buffers[i];
+		vectors[i].iov_len = RECEIVE_MESSAGE_SIZE;
+		memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (;;) {
+		int received = recvmmsg(data->socket_fd, messages, RECEIVE_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == ENOBUFS) {
+				data->num_overflows++;
+				continue;
+			}
+			// EAGAIN: no more pending events
+			return;
+		}
+
+		for (int i = 0; i < received; i++) {
+			int remaining = (int)messages[i].msg_len;
+			for (struct nlmsghdr *header = (struct nlmsghdr *)data->receive_buffers[i]; NLMSG_OK(header, remaining);
+					header = NLMSG_NEXT(header, remaining)) {
+				struct cn_msg *connector_message = NLMSG_DATA(header);
+				if (header->nlmsg_type != NLMSG_DONE || connector_message->id.idx != CN_IDX_PROC ||
+						connector_message->len < sizeof(struct proc_event)) {
+					continue;
+				}
+				store_event(data, (const struct proc_event *)connector_message->data, clock_offset);
+			}
+		}
+		if (received < RECEIVE_BATCH_SIZE) {
+			return;
+		}
+	}
+}
+
+static void store_exit_stats(void *context, uint32_t id, bool is_tgid, const struct taskstats *stats) {
+	// Per-process totals are the sum of the exit statistics of its threads
+	if (is_tgid) {
+		return;
+	}
+
+	proc_connector_data *data = (proc_connector_data *)context;
+	process_event *event = append_event(data);
+	event->type = EVENT_EXIT_STATS;
+	event->pid = id;
+	// Zero on kernels before taskstats version 13
+	event->tgid = stats->ac_tgid;
+	event->user_time_us = stats->ac_utime;
+	event->system_time_us = stats->ac_stime;
+	memcpy(event->command, stats->ac_comm, TS_COMM_LEN);
+	event->command[TS_COMM_LEN - 1] = '\0';
+}
+
+static void parse_proc_connector(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+	struct timespec monotonic_time;
+	clock_gettime(CLOCK_MONOTONIC, &monotonic_time);
+	nanosec_t clock_offset = sample_time - ((nanosec_t)monotonic_time.tv_sec * SECONDS + monotonic_time.tv_nsec);
+
+	proc_connector_data *data = (proc_connector_data *)trace_file->data;
+	data->num_events = 0;
+	receive_proc_events(data, clock_offset);
+	if (data->has_taskstats) {
+		// Exit statistics follow the events of the tick, with the tick's timestamp
+		uint32_t first_exit_stats = data->num_events;
+		if (!taskstats_receive(&data->taskstats, store_exit_stats, data)) {
+			data->num_overflows++;
+		}
+		for (uint32_t event_id = first_exit_stats; event_id < data->num_events; event_id++) {
+			data->events[event_id].timestamp = sample_time;
+		}
+	}
+
+	if (data->num_events == 0 && data->num_overflows == 0) {
+		return;
+	}
+	write_events(trace_file, sample_time, data);
+	data->num_overflows = 0;
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char proc_connector_source_name[] = "proc-connector";
+
+static bool subscribe_proc_events(int socket_fd, enum proc_cn_mcast_op op) {
+	struct {
+		struct nlmsghdr header;
+		struct cn_msg connector_message;
+		enum proc_cn_mcast_op op;
+	} __attribute__((packed)) request = {
+		.header = {
+			.nlmsg_len = sizeof(request),
+			.nlmsg_type = NLMSG_DONE,
+			.nlmsg_pid = (uint32_t)getpid()
+		},
+		.connector_message = {
+			.id = { .idx = CN_IDX_PROC, .val = CN_VAL_PROC },
+			.len = sizeof(enum proc_cn_mcast_op)
+		},
+		.op = op
+	};
+	return send(socket_fd, &request, sizeof(request), 0) >= 0;
+}
+
+static void cleanup_proc_connector(trace_file_t *trace_file) {
+	proc_connector_data *data = (proc_connector_data *)trace_file->data;
+	subscribe_proc_events(data->socket_fd, PROC_CN_MCAST_IGNORE);
+	fclose(trace_file->output_file);
+	cleanup_data_buffers(data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_proc_connector_parser(const char *output_directory, const char *hostname) {
+	int socket_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (socket_fd < 0) {
+		printf("Failed to create connector socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	struct sockaddr_nl address = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC, .nl_pid = (uint32_t)getpid() };
+	if (bind(socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+			!subscribe_proc_events(socket_fd, PROC_CN_MCAST_LISTEN)) {
+		printf("Failed to subscribe to process events: %s\n", strerror(errno));
+		close(socket_fd);
+		return NULL;
+	}
+	// Bursts of forks between ticks must fit in the socket buffer
+	int socket_buffer_size = SOCKET_BUFFER_SIZE;
+	if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUFFORCE, &socket_buffer_size, sizeof(socket_buffer_size)) < 0) {
+		setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(socket_buffer_size));
+	}
+
+	char *output_filename = malloc(strlen(output_directory) + strlen("/proc-events-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/proc-events-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_proc_connector;
+	trace_file->cleanup_callback = cleanup_proc_connector;
+	trace_file->source_file_name = proc_connector_source_name;
+	trace_file->data = calloc(1, sizeof(proc_connector_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	proc_connector_data *data = (proc_connector_data *)trace_file->data;
+	data->socket_fd = socket_fd;
+	data->has_taskstats = taskstats_open(&data->taskstats);
+	if (data->has_taskstats && !taskstats_register_exit(&data->taskstats)) {
+		printf("Failed to register for task exit statistics: %s\n", strerror(errno));
+		taskstats_close(&data->taskstats);
+		data->has_taskstats = false;
+	}
+
+	return trace_file;
+}
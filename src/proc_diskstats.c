@@ -1,4 +1,9 @@
 
+#include "bitpack.h"
+#include "columns.h"
+#include "hotplug.h"
+#include "intern.h"
+#include "parse.h"
 #include "procfs.h"
 #include "varint.h"
 
@@ -9,40 +14,68 @@
 /**
  * Module data
  */
-typedef struct {
-	uint64_t read_completed;
-	uint64_t read_sectors;
-	uint64_t read_time_ms;
-	uint64_t write_completed;
-	uint64_t write_sectors;
-	uint64_t write_time_ms;
-	uint64_t io_time_ms;
-} proc_diskstats_metrics;
-#define DELTA(prev, curr, field) ((curr)->field - (prev)->field)
+typedef enum {
+	READ_COMPLETED = 0,
+	READ_SECTORS,
+	READ_TIME_MS,
+	WRITE_COMPLETED,
+	WRITE_SECTORS,
+	WRITE_TIME_MS,
+	IO_TIME_MS,
+	IN_FLIGHT,
+	WEIGHTED_IO_TIME_MS,
+	BASE_FIELDS,
+	// Since Linux 4.18
+	DISCARD_COMPLETED = BASE_FIELDS,
+	DISCARD_SECTORS,
+	DISCARD_TIME_MS,
+	DISCARD_FIELDS,
+	// Since Linux 5.5
+	FLUSH_COMPLETED = DISCARD_FIELDS,
+	FLUSH_TIME_MS,
+	FLUSH_FIELDS,
+	PROC_DISKSTATS_FIELDS = FLUSH_FIELDS
+} proc_diskstats_field;
+
+// Number of statistics columns after the disk name in each kernel version
+#define BASE_COLUMNS 11
+#define DISCARD_COLUMNS 15
+#define FLUSH_COLUMNS 17
 
 typedef struct {
-	unsigned int num_disks;
-	char **disk_names;
-	proc_diskstats_metrics *previous_metrics;
-	proc_diskstats_metrics *current_metrics;
+	uint32_t num_disks;
+	metric_encoding_t encoding;
+	proc_file_t file;
+	// Number of statistics columns of the running kernel and the fields recorded from them
+	uint32_t num_columns;
+	uint32_t num_fields;
+	// Whether to also record the mean latency and queue depth of each tick
+	bool record_latency;
+	bool have_previous_metrics;
+	// Whether the last sample holds deltas
+	bool have_deltas;
+	nanosec_t previous_sample_time;
+	interner_t disk_names;
+	// Disk names only need to be verified if hotplug events were received
+	hotplug_watcher_t hotplug;
+	uint32_t verified_generation;
+	// Per-disk counters, one column per field
+	metric_columns_t previous_metrics;
+	metric_columns_t current_metrics;
 } proc_diskstats_data;
 
+static void resize_data_buffers(proc_diskstats_data *data, uint32_t num_disks) {
+	metric_columns_resize(&data->previous_metrics, num_disks);
+	metric_columns_resize(&data->current_metrics, num_disks);
+	data->num_disks = num_disks;
+}
+
 static void cleanup_data_buffers(proc_diskstats_data *data) {
-	if (data->disk_names != NULL) {
-		for (unsigned int i = 0; i < data->num_disks; i++) {
-			free(data->disk_names[i]);
-		}
-		free(data->disk_names);
-		data->disk_names = NULL;
-	}
-	if (data->previous_metrics != NULL) {
-		free(data->previous_metrics);
-		data->previous_metrics = NULL;
-	}
-	if (data->current_metrics != NULL) {
-		free(data->current_metrics);
-		data->current_metrics = NULL;
-	}
+	proc_file_close(&data->file);
+	hotplug_watcher_close(&data->hotplug);
+	interner_free(&data->disk_names);
+	metric_columns_free(&data->previous_metrics);
+	metric_columns_free(&data->current_metrics);
 }
 
 
@@ -51,48 +84,50 @@ static void cleanup_data_buffers(proc_diskstats_data *data) {
  */
 typedef enum {
 	DISK_LIST = 0,
-	METRICS = 1
+	METRICS = 1,
+	METRICS_PACKED = 2,
+	LATENCY = 3
 } proc_diskstats_msgtype;
 
-#define WRITE_BUFFER_SIZE (4 * 4096)
-static char write_buffer[WRITE_BUFFER_SIZE];
-
-static void write_disk_list(FILE *output_file, nanosec_t timestamp, proc_diskstats_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_disk_list(trace_file_t *trace_file, nanosec_t timestamp, proc_diskstats_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-diskstats: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("proc-diskstats: Writing message type: %u\n", DISK_LIST & 0xFF);
 	*buffer_ptr = (char)DISK_LIST;
 	buffer_ptr++;
 
+	DEBUG_PRINT("proc-diskstats: Writing num fields: %u\n", data->num_fields);
+	*buffer_ptr = (char)data->num_fields;
+	buffer_ptr++;
+
 	DEBUG_PRINT("proc-diskstats: Writing num disks: %u\n", data->num_disks);
 	write_var_uint32_t(data->num_disks, &buffer_ptr);
 
-	for (unsigned int disk_id = 0; disk_id < data->num_disks; disk_id++) {
-		DEBUG_PRINT("proc-diskstats: Writing disk name: %s\n", data->disk_names[disk_id]);
-		int disk_name_len = strlen(data->disk_names[disk_id]);
+	for (uint32_t disk_id = 0; disk_id < data->num_disks; disk_id++) {
+		const char *disk_name = interner_name(&data->disk_names, disk_id);
+		uint32_t disk_name_len = interner_name_length(&data->disk_names, disk_id);
+		DEBUG_PRINT("proc-diskstats: Writing disk name: %s\n", disk_name);
 		if ((size_t)(end_of_buffer - buffer_ptr) < disk_name_len + 1) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
 		}
-		memcpy(buffer_ptr, data->disk_names[disk_id], disk_name_len + 1);
+		memcpy(buffer_ptr, disk_name, disk_name_len + 1);
 		buffer_ptr += disk_name_len + 1;
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
-static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_diskstats_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_diskstats_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-diskstats: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("proc-diskstats: Writing message type: %u\n", METRICS & 0xFF);
 	*buffer_ptr = (char)METRICS;
@@ -101,152 +136,343 @@ static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_diskstats
 	DEBUG_PRINT("proc-diskstats: Writing num disks: %u\n", data->num_disks);
 	write_var_uint32_t(data->num_disks, &buffer_ptr);
 
-	proc_diskstats_metrics *prev = data->previous_metrics;
-	proc_diskstats_metrics *curr = data->current_metrics;
-	for (unsigned int disk_id = 0; disk_id < data->num_disks; disk_id++) {
-		if ((size_t)(end_of_buffer - buffer_ptr) < 60) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+	// Encode as many disks at once as fit in the remaining buffer space
+	uint32_t disk_id = 0;
+	while (disk_id < data->num_disks) {
+		uint32_t batch_size = (size_t)(end_of_buffer - buffer_ptr) /
+			(deltas->num_fields * VAR_UINT64_MAX_SIZE);
+		if (batch_size == 0) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+			continue;
+		}
+		if (batch_size > data->num_disks - disk_id) {
+			batch_size = data->num_disks - disk_id;
+		}
+
+		DEBUG_PRINT("proc-diskstats: Writing disks %u-%u\n", disk_id, disk_id + batch_size - 1);
+		write_var_uint64_columns(deltas, disk_id, batch_size, &buffer_ptr);
+		disk_id += batch_size;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_packed_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_diskstats_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-diskstats: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-diskstats: Writing message type: %u\n", METRICS_PACKED & 0xFF);
+	*buffer_ptr = (char)METRICS_PACKED;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-diskstats: Writing num disks: %u\n", data->num_disks);
+	write_var_uint32_t(data->num_disks, &buffer_ptr);
+
+	// Pack each field of (up to PACKED_GROUP_MAX_VALUES) disks as one group
+	for (uint32_t field = 0; field < deltas->num_fields; field++) {
+		const uint64_t *column = metric_column(deltas, field);
+		for (uint32_t disk_id = 0; disk_id < data->num_disks; disk_id += PACKED_GROUP_MAX_VALUES) {
+			uint32_t group_size = data->num_disks - disk_id;
+			if (group_size > PACKED_GROUP_MAX_VALUES) {
+				group_size = PACKED_GROUP_MAX_VALUES;
+			}
+			if ((size_t)(end_of_buffer - buffer_ptr) < PACKED_GROUP_MAX_SIZE(group_size)) {
+				fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+				buffer_ptr = trace_file->write_buffer;
+			}
+
+			DEBUG_PRINT("proc-diskstats: Writing field %u of disks %u-%u\n", field, disk_id, disk_id + group_size - 1);
+			write_packed_uint64_group(column + disk_id, group_size, &buffer_ptr);
+		}
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+static void write_latency(trace_file_t *trace_file, nanosec_t timestamp, proc_diskstats_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-diskstats: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-diskstats: Writing message type: %u\n", LATENCY & 0xFF);
+	*buffer_ptr = (char)LATENCY;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-diskstats: Writing num disks: %u\n", data->num_disks);
+	write_var_uint32_t(data->num_disks, &buffer_ptr);
+
+	nanosec_t elapsed_ns = timestamp - data->previous_sample_time;
+	for (uint32_t disk_id = 0; disk_id < data->num_disks; disk_id++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < 2 * VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+
+		// Mean latency of the IOs completed during this tick, over all IO types recorded
+		uint64_t completed = metric_column(deltas, READ_COMPLETED)[disk_id] + metric_column(deltas, WRITE_COMPLETED)[disk_id];
+		uint64_t time_ms = metric_column(deltas, READ_TIME_MS)[disk_id] + metric_column(deltas, WRITE_TIME_MS)[disk_id];
+		if (data->num_fields >= DISCARD_FIELDS) {
+			completed += metric_column(deltas, DISCARD_COMPLETED)[disk_id];
+			time_ms += metric_column(deltas, DISCARD_TIME_MS)[disk_id];
+		}
+		if (data->num_fields >= FLUSH_FIELDS) {
+			completed += metric_column(deltas, FLUSH_COMPLETED)[disk_id];
+			time_ms += metric_column(deltas, FLUSH_TIME_MS)[disk_id];
 		}
+		uint64_t mean_latency_us = completed > 0 ? time_ms * 1000 / completed : 0;
 
-		uint64_t delta_read_completed = DELTA(prev, curr, read_completed);
-		uint64_t delta_read_sectors = DELTA(prev, curr, read_sectors);
-		uint64_t delta_read_time_ms = DELTA(prev, curr, read_time_ms);
-		uint64_t delta_write_completed = DELTA(prev, curr, write_completed);
-		uint64_t delta_write_sectors = DELTA(prev, curr, write_sectors);
-		uint64_t delta_write_time_ms = DELTA(prev, curr, write_time_ms);
-		uint64_t delta_io_time_ms = DELTA(prev, curr, io_time_ms);
-		DEBUG_PRINT("proc-diskstats: Writing read (%llu/%llu/%llu), write (%llu/%llu/%llu), and total (%llu) stats for disk %s\n",
-				delta_read_completed, delta_read_sectors, delta_read_time_ms,
-				delta_write_completed, delta_write_sectors, delta_write_time_ms,
-				delta_io_time_ms, data->disk_names[disk_id]);
-
-		write_var_uint64_t(delta_read_completed, &buffer_ptr);
-		write_var_uint64_t(delta_read_sectors, &buffer_ptr);
-		write_var_uint64_t(delta_read_time_ms, &buffer_ptr);
-		write_var_uint64_t(delta_write_completed, &buffer_ptr);
-		write_var_uint64_t(delta_write_sectors, &buffer_ptr);
-		write_var_uint64_t(delta_write_time_ms, &buffer_ptr);
-		write_var_uint64_t(delta_io_time_ms, &buffer_ptr);
-
-		prev++;
-		curr++;
+		// Mean queue depth is the weighted IO time divided by the elapsed time, in thousandths
+		uint64_t queue_depth_milli = elapsed_ns > 0 ?
+			metric_column(deltas, WEIGHTED_IO_TIME_MS)[disk_id] * 1000000000ULL / elapsed_ns : 0;
+
+		DEBUG_PRINT("proc-diskstats: Writing latency of disk %u: %llu us, queue depth %llu/1000\n", disk_id,
+				mean_latency_us, queue_depth_milli);
+		write_var_uint64_t(mean_latency_us, &buffer_ptr);
+		write_var_uint64_t(queue_depth_milli, &buffer_ptr);
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
 
 /**
  * /proc/diskstats parsing logic
  */
-#define READ_BUFFER_SIZE (4096)
-static char read_buffer[READ_BUFFER_SIZE];
+static bool is_cached_name(const interner_t *disk_names, uint32_t disk_id, const char *disk_name, uint32_t disk_name_len) {
+	return disk_name_len == interner_name_length(disk_names, disk_id) &&
+		memcmp(disk_name, interner_name(disk_names, disk_id), disk_name_len) == 0;
+}
 
-#define MAX_DISK_NAME_SIZE 255
-#define STR(x) STR1(x)
-#define STR1(x) #x
+// Kernel column of each recorded field, after the major and minor numbers and the disk name
+static const uint8_t field_columns[PROC_DISKSTATS_FIELDS] = {
+	[READ_COMPLETED] = 0,
+	[READ_SECTORS] = 2,
+	[READ_TIME_MS] = 3,
+	[WRITE_COMPLETED] = 4,
+	[WRITE_SECTORS] = 6,
+	[WRITE_TIME_MS] = 7,
+	[IN_FLIGHT] = 8,
+	[IO_TIME_MS] = 9,
+	[WEIGHTED_IO_TIME_MS] = 10,
+	[DISCARD_COMPLETED] = 11,
+	[DISCARD_SECTORS] = 13,
+	[DISCARD_TIME_MS] = 14,
+	[FLUSH_COMPLETED] = 15,
+	[FLUSH_TIME_MS] = 16
+};
+
+static void detect_columns(proc_diskstats_data *data) {
+	// Count the statistics columns of the first disk, and assume the oldest
+	// format if there are no disks yet
+	uint32_t num_columns = 0;
+	if (proc_file_read(&data->file)) {
+		const char *ptr = data->file.buffer;
+		for (int i = 0; i < 3; i++) {
+			skip_token(&ptr);
+		}
+		while (!at_end_of_line(&ptr)) {
+			skip_token(&ptr);
+			num_columns++;
+		}
+	}
 
-static void enumerate_disks(trace_file_t *trace_file) {
-	nanosec_t sample_time = get_time();
+	if (num_columns >= FLUSH_COLUMNS) {
+		data->num_fields = FLUSH_FIELDS;
+	} else if (num_columns >= DISCARD_COLUMNS) {
+		data->num_fields = DISCARD_FIELDS;
+	} else {
+		data->num_fields = BASE_FIELDS;
+	}
+	data->num_columns = num_columns < BASE_COLUMNS ? BASE_COLUMNS : num_columns;
+	DEBUG_PRINT("proc-diskstats: Detected %u columns, recording %u fields\n", num_columns, data->num_fields);
+}
 
-	FILE *file_handle = fopen(trace_file->source_file_name, "rb");
-	// Read and parse until the end of the file to find all disk names
-	char disk_names_count = 0;
-	char disk_names_length = 8;
-	char **disk_names = malloc(sizeof(char *) * disk_names_length);
-	char *disk_name = malloc(MAX_DISK_NAME_SIZE + 1);
-	while (fscanf(file_handle, " %*d %*d %" STR(MAX_DISK_NAME_SIZE) "s"
-				" %*llu %*llu %*llu %*llu %*llu %*llu %*llu %*llu"
-				" %*llu %*llu %*llu", disk_name) > 0) {
-		if (disk_names_count == disk_names_length) {
-			disk_names = realloc(disk_names, sizeof(char *) * disk_names_length * 2);
-			disk_names_length *= 2;
+// Returns whether the disk names in the file buffer match the cached names
+static bool cached_names_match(const proc_diskstats_data *data) {
+	const char *ptr = data->file.buffer;
+	for (uint32_t disk_id = 0; disk_id < data->num_disks; disk_id++) {
+		skip_token(&ptr);
+		skip_token(&ptr);
+		skip_spaces(&ptr);
+		const char *disk_name = ptr;
+		skip_token(&ptr);
+		if (!is_cached_name(&data->disk_names, disk_id, disk_name, (uint32_t)(ptr - disk_name))) {
+			return false;
 		}
-		disk_names[disk_names_count] = disk_name;
-		disk_names_count++;
-
-		disk_name = malloc(MAX_DISK_NAME_SIZE + 1);
+		skip_line(&ptr);
 	}
-	fclose(file_handle);
+	return true;
+}
 
+static void enumerate_disks(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
 
-	// Clean up existing data structures
 	proc_diskstats_data *data = (proc_diskstats_data *)trace_file->data;
-	cleanup_data_buffers(data);
-	// Store enumerated disks and reallocate data structures
-	data->num_disks = disk_names_count;
-	data->disk_names = disk_names;
-	data->previous_metrics = calloc(disk_names_count, sizeof(proc_diskstats_metrics));
-	data->current_metrics = calloc(disk_names_count, sizeof(proc_diskstats_metrics));
+	// Consume pending hotplug events, as the new disk list will reflect them
+	data->verified_generation = hotplug_watcher_poll(&data->hotplug, &data->disk_names);
+	interner_reset(&data->disk_names);
+
+	// Read and parse the whole file to find all disk names
+	if (proc_file_read(&data->file)) {
+		const char *ptr = data->file.buffer;
+		while (*ptr != '\0') {
+			skip_token(&ptr);
+			skip_token(&ptr);
+			skip_spaces(&ptr);
+			const char *disk_name = ptr;
+			skip_token(&ptr);
+			interner_intern(&data->disk_names, disk_name, (uint32_t)(ptr - disk_name));
+			skip_line(&ptr);
+		}
+	}
+
+	// Reallocate data structures for the enumerated disks
+	resize_data_buffers(data, data->disk_names.count);
+	data->have_previous_metrics = false;
 
 
 	// Write the disk list to the output file
-	write_disk_list(trace_file->output_file, sample_time, data);
+	write_disk_list(trace_file, sample_time, data);
 }
 
 static void parse_proc_diskstats(trace_file_t *trace_file) {
 	nanosec_t sample_time = get_time();
 
 	proc_diskstats_data *data = (proc_diskstats_data *)trace_file->data;
+	data->have_deltas = false;
 
-	FILE *file_handle = fopen(trace_file->source_file_name, "rb");
-	// Read and parse until the end of the file to find all disk statistics
-	proc_diskstats_metrics *next_disk = data->current_metrics;
-	char disk_name[MAX_DISK_NAME_SIZE + 1];
-	unsigned int disk_id = 0;
-	uint64_t read_completed, read_sectors, read_time_ms, write_completed, write_sectors, write_time_ms, io_time_ms;
-	while (fscanf(file_handle, " %*d %*d %" STR(MAX_DISK_NAME_SIZE) "s"
-				" %llu %*llu %llu %llu %llu %*llu %llu %llu"
-				" %*llu %llu %*llu", disk_name,
-				&read_completed, &read_sectors, &read_time_ms,
-				&write_completed, &write_sectors, &write_time_ms,
-				&io_time_ms) > 0) {
+	// Disk names only need to be compared to the cached names if a hotplug
+	// event was received since they were last verified
+	uint32_t hotplug_generation = hotplug_watcher_poll(&data->hotplug, &data->disk_names);
+	bool verify_names = !hotplug_watcher_active(&data->hotplug) || hotplug_generation != data->verified_generation;
+	if (!proc_file_read(&data->file)) {
+		return;
+	}
+
+	// Parse the whole file to find all disk statistics
+	metric_columns_t *current = &data->current_metrics;
+	uint64_t values[FLUSH_COLUMNS];
+	const char *ptr = data->file.buffer;
+	uint32_t disk_id = 0;
+	while (*ptr != '\0') {
 		if (disk_id >= data->num_disks) {
 			// Number of disks has changed, so re-enumerate all disks
-			fclose(file_handle);
 			enumerate_disks(trace_file);
 			return;
 		}
 
+		skip_token(&ptr);
+		skip_token(&ptr);
+		skip_spaces(&ptr);
+		const char *disk_name = ptr;
+		skip_token(&ptr);
+
 		// Ensure that the disk name matches the cached name
-		if (strcmp(disk_name, data->disk_names[disk_id]) != 0) {
+		if (verify_names && !is_cached_name(&data->disk_names, disk_id, disk_name, (uint32_t)(ptr - disk_name))) {
 			// Disk name does not match, so re-enumerate all disks
-			fclose(file_handle);
 			enumerate_disks(trace_file);
 			return;
 		}
 
-		// Store parsed values
-		next_disk->read_completed = read_completed;
-		next_disk->read_sectors = read_sectors;
-		next_disk->read_time_ms = read_time_ms;
-		next_disk->write_completed = write_completed;;
-		next_disk->write_sectors = write_sectors;
-		next_disk->write_time_ms = write_time_ms;
-		next_disk->io_time_ms = io_time_ms;
+		// Parse the columns of the detected kernel format, missing columns read as 0
+		for (uint32_t column = 0; column < data->num_columns && column < FLUSH_COLUMNS; column++) {
+			values[column] = parse_uint64(&ptr);
+		}
+		for (uint32_t field = 0; field < data->num_fields; field++) {
+			metric_column(current, field)[disk_id] = values[field_columns[field]];
+		}
 
-		next_disk++;
+		skip_line(&ptr);
 		disk_id++;
 	}
 	if (disk_id != data->num_disks) {
 		// Number of disks has changed, so re-enumerate all disks
-		fclose(file_handle);
 		enumerate_disks(trace_file);
 		return;
 	}
-	fclose(file_handle);
 
-	// Write metrics to the output file
-	write_metrics(trace_file->output_file, sample_time, data);
+	// A disk that was removed and replaced by another one while the file was read
+	// leaves the number of disks unchanged, so verify the names after all
+	if (!verify_names && hotplug_watcher_poll(&data->hotplug, &data->disk_names) != hotplug_generation &&
+			!cached_names_match(data)) {
+		enumerate_disks(trace_file);
+		return;
+	}
+	data->verified_generation = hotplug_generation;
+
+	// Let previous = current - previous and write the deltas to the output file,
+	// except for the number of IOs in flight, which is a gauge and written as is
+	metric_columns_delta(&data->previous_metrics, &data->current_metrics);
+	memcpy(metric_column(&data->previous_metrics, IN_FLIGHT), metric_column(&data->current_metrics, IN_FLIGHT),
+			data->num_disks * sizeof(uint64_t));
+	if (data->encoding == ENCODING_PACKED) {
+		write_packed_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	} else {
+		write_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	}
+
+	// The first deltas after enumerating the disks are absolute values, so
+	// latencies can only be computed from the second tick onwards
+	if (data->record_latency && data->have_previous_metrics) {
+		write_latency(trace_file, sample_time, data, &data->previous_metrics);
+	}
+	data->have_deltas = data->have_previous_metrics;
+	data->have_previous_metrics = true;
+	data->previous_sample_time = sample_time;
 
 	// Swap the metric buffers
-	proc_diskstats_metrics *tmp = data->previous_metrics;
+	metric_columns_t tmp = data->previous_metrics;
 	data->previous_metrics = data->current_metrics;
 	data->current_metrics = tmp;
 }
 
 
+/**
+ * Table of the last sample: per-disk deltas, except for the in_flight gauge
+ */
+static const char *const proc_diskstats_field_names[PROC_DISKSTATS_FIELDS] = {
+	"read_completed", "read_sectors", "read_time_ms", "write_completed", "write_sectors", "write_time_ms",
+	"io_time_ms", "in_flight", "weighted_io_time_ms", "discard_completed", "discard_sectors", "discard_time_ms",
+	"flush_completed", "flush_time_ms"
+};
+
+static void proc_diskstats_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	const proc_diskstats_data *data = (const proc_diskstats_data *)trace_file->data;
+	*num_entities = data->num_disks;
+	*num_fields = data->num_fields;
+}
+
+static const char *proc_diskstats_table_entity_name(const trace_file_t *trace_file, uint32_t entity) {
+	return interner_name(&((const proc_diskstats_data *)trace_file->data)->disk_names, entity);
+}
+
+static const char *proc_diskstats_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return proc_diskstats_field_names[field];
+}
+
+static bool proc_diskstats_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so current_metrics holds the deltas
+	const proc_diskstats_data *data = (const proc_diskstats_data *)trace_file->data;
+	metric_columns_read(&data->current_metrics, values);
+	return data->have_deltas;
+}
+
+static const trace_table_t proc_diskstats_table = {
+	.name = "proc-diskstats",
+	.shape = proc_diskstats_table_shape,
+	.entity_name = proc_diskstats_table_entity_name,
+	.field_name = proc_diskstats_table_field_name,
+	.read = proc_diskstats_table_read
+};
+
+
 /**
  * Parse module initialization and cleanup
  */
@@ -259,22 +485,37 @@ static void cleanup_proc_diskstats(trace_file_t *trace_file) {
 	free(trace_file);
 }
 
-trace_file_t *init_proc_diskstats_parser(const char *output_directory, const char *hostname) {
+trace_file_t *init_proc_diskstats_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		bool record_latency, uint32_t max_entities) {
 	char *output_filename = malloc(strlen(output_directory) + strlen("/proc-diskstats-") + strlen(hostname) + 1);
 	*output_filename = '\0';
 	strcat(output_filename, output_directory);
 	strcat(output_filename, "/proc-diskstats-");
 	strcat(output_filename, hostname);
 
-	trace_file_t *trace_file = malloc(sizeof(trace_file_t));
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
 	trace_file->parse_callback = parse_proc_diskstats;
 	trace_file->cleanup_callback = cleanup_proc_diskstats;
 	trace_file->source_file_name = proc_diskstats_filename;
+	trace_file->has_list_records = true;
+	trace_file->table = &proc_diskstats_table;
 	trace_file->data = calloc(1, sizeof(proc_diskstats_data));
 	trace_file->output_file = fopen(output_filename, "wb");
 
 	free(output_filename);
 
+	proc_diskstats_data *data = (proc_diskstats_data *)trace_file->data;
+	data->encoding = encoding;
+	data->record_latency = record_latency;
+	if (!proc_file_open(&data->file, proc_diskstats_filename)) {
+		printf("Failed to open %s, no disk metrics will be recorded\n", proc_diskstats_filename);
+	}
+	detect_columns(data);
+	interner_init(&data->disk_names, max_entities);
+	hotplug_watcher_init(&data->hotplug, HOTPLUG_BLOCK);
+	metric_columns_init(&data->previous_metrics, data->num_fields, max_entities);
+	metric_columns_init(&data->current_metrics, data->num_fields, max_entities);
+
 	enumerate_disks(trace_file);
 
 	return trace_file;
@@ -0,0 +1,376 @@
+
+#include "intern.h"
+#include "parse.h"
+#include "procfs.h"
+#include "varint.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+/**
+ * Module data
+ *
+ * /proc/interrupts and /proc/softirqs share the same layout: a header line
+ * with a "CPUn" column per online CPU, followed by one line per interrupt
+ * (softirq class) with a "label:" and one counter per CPU. Lines in
+ * /proc/interrupts end with a description of the interrupt, and some lines
+ * (e.g., ERR and MIS on x86) have a single counter instead of one per CPU.
+ */
+typedef struct {
+	proc_file_t file;
+	const char *module_name;
+	// Header line as of the last enumeration, used to detect CPU changes
+	char *header;
+	uint32_t header_len;
+	uint32_t num_cpus;
+	uint32_t *cpu_ids;
+	// Labels and descriptions of all lines, with ids equal to line numbers
+	interner_t labels;
+	interner_t descriptions;
+	uint32_t num_lines;
+	// Counters in line-major order, i.e., the counter of line l on CPU c is at [l * num_cpus + c]
+	uint64_t *previous_metrics;
+	uint64_t *current_metrics;
+} proc_interrupts_data;
+
+static void resize_data_buffers(proc_interrupts_data *data, uint32_t num_lines) {
+	size_t num_values = (size_t)num_lines * data->num_cpus;
+	data->previous_metrics = realloc(data->previous_metrics, num_values * sizeof(uint64_t));
+	data->current_metrics = realloc(data->current_metrics, num_values * sizeof(uint64_t));
+	memset(data->previous_metrics, 0, num_values * sizeof(uint64_t));
+	memset(data->current_metrics, 0, num_values * sizeof(uint64_t));
+	data->num_lines = num_lines;
+}
+
+static void cleanup_data_buffers(proc_interrupts_data *data) {
+	proc_file_close(&data->file);
+	free(data->header);
+	free(data->cpu_ids);
+	interner_free(&data->labels);
+	interner_free(&data->descriptions);
+	free(data->previous_metrics);
+	free(data->current_metrics);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	LINE_LIST = 0,
+	METRICS = 1
+} proc_interrupts_msgtype;
+
+static void write_string(trace_file_t *trace_file, const char *string, uint32_t string_len, char **buffer_ptr) {
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+	if ((size_t)(end_of_buffer - *buffer_ptr) < string_len + 1) {
+		fwrite(trace_file->write_buffer, (size_t)(*buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+		*buffer_ptr = trace_file->write_buffer;
+	}
+	memcpy(*buffer_ptr, string, string_len + 1);
+	*buffer_ptr += string_len + 1;
+}
+
+static void write_line_list(trace_file_t *trace_file, nanosec_t timestamp, proc_interrupts_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("%s: Writing timestamp: %llu\n", data->module_name, timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("%s: Writing message type: %u\n", data->module_name, LINE_LIST & 0xFF);
+	*buffer_ptr = (char)LINE_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("%s: Writing num cpus: %u\n", data->module_name, data->num_cpus);
+	write_var_uint32_t(data->num_cpus, &buffer_ptr);
+	for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		write_var_uint32_t(data->cpu_ids[cpu], &buffer_ptr);
+	}
+
+	DEBUG_PRINT("%s: Writing num lines: %u\n", data->module_name, data->num_lines);
+	if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE) {
+		fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+		buffer_ptr = trace_file->write_buffer;
+	}
+	write_var_uint32_t(data->num_lines, &buffer_ptr);
+	for (uint32_t line = 0; line < data->num_lines; line++) {
+		DEBUG_PRINT("%s: Writing line: %s (%s)\n", data->module_name,
+				interner_name(&data->labels, line), interner_name(&data->descriptions, line));
+		write_string(trace_file, interner_name(&data->labels, line),
+				interner_name_length(&data->labels, line), &buffer_ptr);
+		write_string(trace_file, interner_name(&data->descriptions, line),
+				interner_name_length(&data->descriptions, line), &buffer_ptr);
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_interrupts_data *data, const uint64_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+	size_t max_row_size = VAR_UINT32_MAX_SIZE + (size_t)data->num_cpus * VAR_UINT64_MAX_SIZE;
+
+	DEBUG_PRINT("%s: Writing timestamp: %llu\n", data->module_name, timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("%s: Writing message type: %u\n", data->module_name, METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	// Only lines with at least one non-zero delta are written
+	uint32_t num_nonzero_lines = 0;
+	for (uint32_t line = 0; line < data->num_lines; line++) {
+		const uint64_t *row = deltas + (size_t)line * data->num_cpus;
+		uint64_t any_nonzero = 0;
+		for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+			any_nonzero |= row[cpu];
+		}
+		num_nonzero_lines += any_nonzero != 0;
+	}
+	DEBUG_PRINT("%s: Writing num non-zero lines: %u\n", data->module_name, num_nonzero_lines);
+	write_var_uint32_t(num_nonzero_lines, &buffer_ptr);
+
+	uint32_t previous_line = 0;
+	for (uint32_t line = 0; line < data->num_lines && num_nonzero_lines > 0; line++) {
+		const uint64_t *row = deltas + (size_t)line * data->num_cpus;
+		uint64_t any_nonzero = 0;
+		for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+			any_nonzero |= row[cpu];
+		}
+		if (any_nonzero == 0) {
+			continue;
+		}
+
+		if ((size_t)(end_of_buffer - buffer_ptr) < max_row_size) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		DEBUG_PRINT("%s: Writing line %u (%s)\n", data->module_name, line, interner_name(&data->labels, line));
+		// Line numbers are written as the gap to the previous non-zero line
+		write_var_uint32_t(line - previous_line, &buffer_ptr);
+		if (max_row_size <= sizeof(trace_file->write_buffer)) {
+			write_var_uint64_array(row, data->num_cpus, &buffer_ptr);
+		} else {
+			for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+				if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT64_MAX_SIZE) {
+					fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+					buffer_ptr = trace_file->write_buffer;
+				}
+				write_var_uint64_t(row[cpu], &buffer_ptr);
+			}
+		}
+		previous_line = line;
+		num_nonzero_lines--;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * /proc/interrupts and /proc/softirqs parsing logic
+ */
+static void parse_label(const char **ptr, const char **label, uint32_t *label_len) {
+	skip_spaces(ptr);
+	*label = *ptr;
+	while (**ptr != '\0' && **ptr != ':' && **ptr != '\n') {
+		(*ptr)++;
+	}
+	*label_len = (uint32_t)(*ptr - *label);
+	if (**ptr == ':') {
+		(*ptr)++;
+	}
+}
+
+static void parse_counters(const char **ptr, uint64_t *row, uint32_t num_cpus) {
+	// Lines with fewer counters than CPUs leave the remaining counters at zero
+	uint32_t cpu = 0;
+	for (; cpu < num_cpus; cpu++) {
+		skip_spaces(ptr);
+		if (!is_digit(**ptr)) {
+			break;
+		}
+		row[cpu] = parse_uint64(ptr);
+	}
+	for (; cpu < num_cpus; cpu++) {
+		row[cpu] = 0;
+	}
+}
+
+static void enumerate_lines(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	proc_interrupts_data *data = (proc_interrupts_data *)trace_file->data;
+	interner_reset(&data->labels);
+	interner_reset(&data->descriptions);
+	data->num_cpus = 0;
+	data->header_len = 0;
+
+	if (proc_file_read(&data->file)) {
+		// Parse and keep a copy of the header line with the CPU columns
+		const char *ptr = data->file.buffer;
+		const char *end_of_header = ptr;
+		skip_line(&end_of_header);
+		data->header_len = (uint32_t)(end_of_header - ptr);
+		data->header = realloc(data->header, data->header_len + 1);
+		memcpy(data->header, ptr, data->header_len);
+		while (!at_end_of_line(&ptr)) {
+			if (CONSUME_PREFIX(&ptr, "CPU")) {
+				data->cpu_ids = realloc(data->cpu_ids, (data->num_cpus + 1) * sizeof(uint32_t));
+				data->cpu_ids[data->num_cpus] = (uint32_t)parse_uint64(&ptr);
+				data->num_cpus++;
+			} else {
+				skip_token(&ptr);
+			}
+		}
+		skip_line(&ptr);
+
+		// Intern the label and description of every line
+		while (*ptr != '\0') {
+			const char *label;
+			uint32_t label_len;
+			parse_label(&ptr, &label, &label_len);
+			for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+				skip_spaces(&ptr);
+				if (!is_digit(*ptr)) {
+					break;
+				}
+				parse_uint64(&ptr);
+			}
+			skip_spaces(&ptr);
+			const char *description = ptr;
+			skip_line(&ptr);
+			uint32_t description_len = (uint32_t)(ptr - description);
+			while (description_len > 0 && (description[description_len - 1] == '\n' || description[description_len - 1] == ' ')) {
+				description_len--;
+			}
+			interner_append(&data->labels, label, label_len);
+			interner_append(&data->descriptions, description, description_len);
+		}
+	}
+
+	// Reallocate data structures for the enumerated lines
+	resize_data_buffers(data, data->labels.count);
+
+
+	// Write the line list to the output file
+	write_line_list(trace_file, sample_time, data);
+}
+
+static void parse_proc_interrupts(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	proc_interrupts_data *data = (proc_interrupts_data *)trace_file->data;
+	if (!proc_file_read(&data->file)) {
+		return;
+	}
+
+	// Re-enumerate if CPUs went online or offline
+	const char *ptr = data->file.buffer;
+	if (data->header_len == 0 || data->file.size < data->header_len ||
+			memcmp(ptr, data->header, data->header_len) != 0) {
+		enumerate_lines(trace_file);
+		return;
+	}
+	ptr += data->header_len;
+
+	// Single pass over all lines, verifying only the label of each line
+	uint32_t line = 0;
+	while (*ptr != '\0') {
+		const char *label;
+		uint32_t label_len;
+		parse_label(&ptr, &label, &label_len);
+		if (line >= data->num_lines || label_len != interner_name_length(&data->labels, line) ||
+				memcmp(label, interner_name(&data->labels, line), label_len) != 0) {
+			// Interrupts were added or removed, so re-enumerate all lines
+			enumerate_lines(trace_file);
+			return;
+		}
+		parse_counters(&ptr, data->current_metrics + (size_t)line * data->num_cpus, data->num_cpus);
+		skip_line(&ptr);
+		line++;
+	}
+	if (line != data->num_lines) {
+		// Interrupts were removed, so re-enumerate all lines
+		enumerate_lines(trace_file);
+		return;
+	}
+
+	// Let previous = current - previous, counters of interrupts that were
+	// freed and requested again between ticks restart from zero
+	size_t num_values = (size_t)data->num_lines * data->num_cpus;
+	for (size_t i = 0; i < num_values; i++) {
+		uint64_t current = data->current_metrics[i];
+		uint64_t previous = data->previous_metrics[i];
+		data->previous_metrics[i] = current >= previous ? current - previous : current;
+	}
+	write_metrics(trace_file, sample_time, data, data->previous_metrics);
+
+	// Swap the metric buffers
+	uint64_t *tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char proc_interrupts_filename[] = "/proc/interrupts";
+static const char proc_softirqs_filename[] = "/proc/softirqs";
+
+static void cleanup_proc_interrupts(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((proc_interrupts_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+static trace_file_t *init_parser(const char *output_directory, const char *hostname,
+		const char *source_file_name, const char *module_name, uint32_t max_entities) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/") + strlen(module_name) +
+			strlen("-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/");
+	strcat(output_filename, module_name);
+	strcat(output_filename, "-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_proc_interrupts;
+	trace_file->cleanup_callback = cleanup_proc_interrupts;
+	trace_file->source_file_name = source_file_name;
+	trace_file->has_list_records = true;
+	trace_file->data = calloc(1, sizeof(proc_interrupts_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	proc_interrupts_data *data = (proc_interrupts_data *)trace_file->data;
+	data->module_name = module_name;
+	interner_init(&data->labels, max_entities);
+	interner_init(&data->descriptions, max_entities);
+	if (!proc_file_open(&data->file, source_file_name)) {
+		printf("Failed to open %s, no %s metrics will be recorded\n", source_file_name, module_name);
+	}
+
+	enumerate_lines(trace_file);
+
+	return trace_file;
+}
+
+trace_file_t *init_proc_interrupts_parser(const char *output_directory, const char *hostname, uint32_t max_entities) {
+	return init_parser(output_directory, hostname, proc_interrupts_filename, "proc-interrupts", max_entities);
+}
+
+trace_file_t *init_proc_softirqs_parser(const char *output_directory, const char *hostname, uint32_t max_entities) {
+	return init_parser(output_directory, hostname, proc_softirqs_filename, "proc-softirqs", max_entities);
+}
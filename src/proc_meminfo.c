@@ -1,4 +1,5 @@
 
+#include "parse.h"
 #include "procfs.h"
 #include "varint.h"
 
@@ -18,6 +19,7 @@ typedef struct {
 #define DELTA(prev, curr, field) ((curr)->field - (prev)->field)
 
 typedef struct {
+	proc_file_t file;
 	uint64_t mem_total;
 	uint64_t swap_total;
 	proc_meminfo_metrics *previous_metrics;
@@ -33,16 +35,12 @@ typedef enum {
 	METRICS = 1
 } proc_meminfo_msgtype;
 
-#define WRITE_BUFFER_SIZE (128)
-static char write_buffer[WRITE_BUFFER_SIZE];
-
-static void write_totals(FILE *output_file, nanosec_t timestamp, proc_meminfo_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_totals(trace_file_t *trace_file, nanosec_t timestamp, proc_meminfo_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-meminfo: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("proc-meminfo: Writing message type: %u\n", TOTALS & 0xFF);
 	*buffer_ptr = (char)TOTALS;
@@ -55,16 +53,15 @@ static void write_totals(FILE *output_file, nanosec_t timestamp, proc_meminfo_da
 	*(uint64_t *)buffer_ptr = data->swap_total;
 	buffer_ptr += sizeof(uint64_t);
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
-static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_meminfo_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_meminfo_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-meminfo: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("proc-meminfo: Writing message type: %u\n", METRICS & 0xFF);
 	*buffer_ptr = (char)METRICS;
@@ -81,75 +78,69 @@ static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_meminfo_d
 	write_var_int64_t(delta_mem_available, &buffer_ptr);
 	write_var_int64_t(delta_swap_free, &buffer_ptr);
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
 
 /**
  * /proc/meminfo parsing logic
  */
-#define READ_BUFFER_SIZE 256
-static char read_buffer[READ_BUFFER_SIZE];
-
-#define FIELD_BUFFERS      "Buffers"
-#define FIELD_CACHED       "Cached"
-#define FIELD_MEMAVAILABLE "MemAvailable"
-#define FIELD_MEMFREE      "MemFree"
-#define FIELD_MEMTOTAL     "MemTotal"
-#define FIELD_SRECLAIMABLE "SReclaimable"
-#define FIELD_SWAPFREE     "SwapFree"
-#define FIELD_SWAPTOTAL    "SwapTotal"
+#define FIELD_BUFFERS      "Buffers:"
+#define FIELD_CACHED       "Cached:"
+#define FIELD_MEMAVAILABLE "MemAvailable:"
+#define FIELD_MEMFREE      "MemFree:"
+#define FIELD_MEMTOTAL     "MemTotal:"
+#define FIELD_SRECLAIMABLE "SReclaimable:"
+#define FIELD_SWAPFREE     "SwapFree:"
+#define FIELD_SWAPTOTAL    "SwapTotal:"
 
 static void parse_proc_meminfo(trace_file_t *trace_file) {
 	nanosec_t sample_time = get_time();
 
 	proc_meminfo_data *data = (proc_meminfo_data *)trace_file->data;
-	
-	FILE *file_handle = fopen(trace_file->source_file_name, "rb");
-	// Read and parse until the end of the file to find the right memory statistics
-	uint64_t mem_total;
-	uint64_t swap_total;
+	if (!proc_file_read(&data->file)) {
+		return;
+	}
+
+	// Parse until the end of the file to find the right memory statistics
+	uint64_t mem_total = 0;
+	uint64_t swap_total = 0;
 	uint64_t buff_and_cache = 0;
-	while (fgets(read_buffer, sizeof(read_buffer), file_handle) != NULL) {
-		char field[64];
-		uint64_t value;
-		if (sscanf(read_buffer, "%63s %llu", field, &value) > 0) {
-			// Trim the trailing colon
-			field[strlen(field) - 1] = '\0';
-
-			switch (field[0]) {
-			case 'B':
-				if (memcmp(field, FIELD_BUFFERS, sizeof(FIELD_BUFFERS)) == 0) {
-					buff_and_cache += value;
-				}
-				break;
-			case 'C':
-				if (memcmp(field, FIELD_CACHED, sizeof(FIELD_CACHED)) == 0) {
-					buff_and_cache += value;
-				}
-				break;
-			case 'M':
-				if (memcmp(field, FIELD_MEMAVAILABLE, sizeof(FIELD_MEMAVAILABLE)) == 0) {
-					data->current_metrics->mem_available = value;
-				} else if (memcmp(field, FIELD_MEMFREE, sizeof(FIELD_MEMFREE)) == 0) {
-					data->current_metrics->mem_free = value;
-				} else if (memcmp(field, FIELD_MEMTOTAL, sizeof(FIELD_MEMTOTAL)) == 0) {
-					mem_total = value;
-				}
-				break;
-			case 'S':
-				if (memcmp(field, FIELD_SRECLAIMABLE, sizeof(FIELD_SRECLAIMABLE)) == 0) {
-					buff_and_cache += value;
-				} else if (memcmp(field, FIELD_SWAPFREE, sizeof(FIELD_SWAPFREE)) == 0) {
-					data->current_metrics->swap_free = value;
-				} else if (memcmp(field, FIELD_SWAPTOTAL, sizeof(FIELD_SWAPTOTAL)) == 0) {
-					swap_total = value;
-				}
-				break;
-			default:
-				break;
+	const char *ptr = data->file.buffer;
+	while (*ptr != '\0') {
+		switch (*ptr) {
+		case 'B':
+			if (CONSUME_PREFIX(&ptr, FIELD_BUFFERS)) {
+				buff_and_cache += parse_uint64(&ptr);
 			}
+			break;
+		case 'C':
+			if (CONSUME_PREFIX(&ptr, FIELD_CACHED)) {
+				buff_and_cache += parse_uint64(&ptr);
+			}
+			break;
+		case 'M':
+			if (CONSUME_PREFIX(&ptr, FIELD_MEMAVAILABLE)) {
+				data->current_metrics->mem_available = parse_uint64(&ptr);
+			} else if (CONSUME_PREFIX(&ptr, FIELD_MEMFREE)) {
+				data->current_metrics->mem_free = parse_uint64(&ptr);
+			} else if (CONSUME_PREFIX(&ptr, FIELD_MEMTOTAL)) {
+				mem_total = parse_uint64(&ptr);
+			}
+			break;
+		case 'S':
+			if (CONSUME_PREFIX(&ptr, FIELD_SRECLAIMABLE)) {
+				buff_and_cache += parse_uint64(&ptr);
+			} else if (CONSUME_PREFIX(&ptr, FIELD_SWAPFREE)) {
+				data->current_metrics->swap_free = parse_uint64(&ptr);
+			} else if (CONSUME_PREFIX(&ptr, FIELD_SWAPTOTAL)) {
+				swap_total = parse_uint64(&ptr);
+			}
+			break;
+		default:
+			break;
 		}
+		skip_line(&ptr);
 	}
 
 	// Compute and store mem_used
@@ -159,10 +150,10 @@ static void parse_proc_meminfo(trace_file_t *trace_file) {
 	if ((mem_total != data->mem_total) || (swap_total != data->swap_total)) {
 		data->mem_total = mem_total;
 		data->swap_total = swap_total;
-		write_totals(trace_file->output_file, sample_time, data);
+		write_totals(trace_file, sample_time, data);
 	}
 
-	write_metrics(trace_file->output_file, sample_time, data);
+	write_metrics(trace_file, sample_time, data);
 
 	// Swap the metric buffers
 	proc_meminfo_metrics *tmp = data->previous_metrics;
@@ -171,6 +162,53 @@ static void parse_proc_meminfo(trace_file_t *trace_file) {
 }
 
 
+/**
+ * Table of the last sample: memory and swap sizes in kB, all gauges
+ */
+typedef enum {
+	TABLE_MEM_USED = 0,
+	TABLE_MEM_FREE,
+	TABLE_MEM_AVAILABLE,
+	TABLE_SWAP_FREE,
+	TABLE_MEM_TOTAL,
+	TABLE_SWAP_TOTAL,
+	PROC_MEMINFO_TABLE_FIELDS
+} proc_meminfo_table_field;
+
+static const char *const proc_meminfo_field_names[PROC_MEMINFO_TABLE_FIELDS] = {
+	"mem_used", "mem_free", "mem_available", "swap_free", "mem_total", "swap_total"
+};
+
+static void proc_meminfo_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	*num_entities = 1;
+	*num_fields = PROC_MEMINFO_TABLE_FIELDS;
+}
+
+static const char *proc_meminfo_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return proc_meminfo_field_names[field];
+}
+
+static bool proc_meminfo_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so previous_metrics holds the last sample
+	const proc_meminfo_data *data = (const proc_meminfo_data *)trace_file->data;
+	values[TABLE_MEM_USED] = (int64_t)data->previous_metrics->mem_used;
+	values[TABLE_MEM_FREE] = (int64_t)data->previous_metrics->mem_free;
+	values[TABLE_MEM_AVAILABLE] = (int64_t)data->previous_metrics->mem_available;
+	values[TABLE_SWAP_FREE] = (int64_t)data->previous_metrics->swap_free;
+	values[TABLE_MEM_TOTAL] = (int64_t)data->mem_total;
+	values[TABLE_SWAP_TOTAL] = (int64_t)data->swap_total;
+	return true;
+}
+
+static const trace_table_t proc_meminfo_table = {
+	.name = "proc-meminfo",
+	.shape = proc_meminfo_table_shape,
+	.entity_name = NULL,
+	.field_name = proc_meminfo_table_field_name,
+	.read = proc_meminfo_table_read
+};
+
+
 /**
  * Parse module initialization and cleanup
  */
@@ -178,6 +216,7 @@ static const char proc_meminfo_filename[] = "/proc/meminfo";
 
 static void cleanup_proc_meminfo(trace_file_t *trace_file) {
 	fclose(trace_file->output_file);
+	proc_file_close(&((proc_meminfo_data *)trace_file->data)->file);
 	free(trace_file->data);
 	free(trace_file);
 }
@@ -189,10 +228,12 @@ trace_file_t *init_proc_meminfo_parser(const char *output_directory, const char
 	strcat(output_filename, "/proc-meminfo-");
 	strcat(output_filename, hostname);
 
-	trace_file_t *trace_file = malloc(sizeof(trace_file_t));
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
 	trace_file->parse_callback = parse_proc_meminfo;
 	trace_file->cleanup_callback = cleanup_proc_meminfo;
 	trace_file->source_file_name = proc_meminfo_filename;
+	trace_file->has_list_records = true;
+	trace_file->table = &proc_meminfo_table;
 	trace_file->data = calloc(1, sizeof(proc_meminfo_data) + 2 * sizeof(proc_meminfo_metrics));
 	trace_file->output_file = fopen(output_filename, "wb");
 
@@ -202,6 +243,9 @@ trace_file_t *init_proc_meminfo_parser(const char *output_directory, const char
 		(proc_meminfo_metrics *)(trace_file->data + sizeof(proc_meminfo_data));
 	((proc_meminfo_data *)trace_file->data)->current_metrics =
 		(proc_meminfo_metrics *)(trace_file->data + sizeof(proc_meminfo_data) + sizeof(proc_meminfo_metrics));
+	if (!proc_file_open(&((proc_meminfo_data *)trace_file->data)->file, proc_meminfo_filename)) {
+		printf("Failed to open %s, no memory metrics will be recorded\n", proc_meminfo_filename);
+	}
 
 	return trace_file;
 }
@@ -1,4 +1,8 @@
 
+#include "bitpack.h"
+#include "columns.h"
+#include "hotplug.h"
+#include "intern.h"
 #include "procfs.h"
 #include "varint.h"
 
@@ -10,36 +14,41 @@
 /**
  * Module data
  */
-typedef struct {
-	uint64_t recv_bytes;
-	uint64_t recv_packets;
-	uint64_t send_bytes;
-	uint64_t send_packets;
-} proc_net_dev_iface_metrics;
+typedef enum {
+	RECV_BYTES = 0,
+	RECV_PACKETS,
+	SEND_BYTES,
+	SEND_PACKETS,
+	PROC_NET_DEV_FIELDS
+} proc_net_dev_field;
 
 typedef struct {
-	unsigned int num_ifaces;
-	char **iface_names;
-	proc_net_dev_iface_metrics *previous_metrics;
-	proc_net_dev_iface_metrics *current_metrics;
+	uint32_t num_ifaces;
+	metric_encoding_t encoding;
+	interner_t iface_names;
+	// Interface names only need to be verified if hotplug events were received
+	hotplug_watcher_t hotplug;
+	uint32_t verified_generation;
+	// Per-interface counters, one column per field
+	metric_columns_t previous_metrics;
+	metric_columns_t current_metrics;
+	// Whether the previous sample covers the current entities, and whether the last sample holds deltas
+	bool have_previous_metrics;
+	bool have_deltas;
 } proc_net_dev_data;
 
+static void resize_data_buffers(proc_net_dev_data *data, uint32_t num_ifaces) {
+	metric_columns_resize(&data->previous_metrics, num_ifaces);
+	metric_columns_resize(&data->current_metrics, num_ifaces);
+	data->num_ifaces = num_ifaces;
+	data->have_previous_metrics = false;
+}
+
 static void cleanup_data_buffers(proc_net_dev_data *data) {
-	if (data->iface_names != NULL) {
-		for (unsigned int i = 0; i < data->num_ifaces; i++) {
-			free(data->iface_names[i]);
-		}
-		free(data->iface_names);
-		data->iface_names = NULL;
-	}
-	if (data->previous_metrics != NULL) {
-		free(data->previous_metrics);
-		data->previous_metrics = NULL;
-	}
-	if (data->current_metrics != NULL) {
-		free(data->current_metrics);
-		data->current_metrics = NULL;
-	}
+	hotplug_watcher_close(&data->hotplug);
+	interner_free(&data->iface_names);
+	metric_columns_free(&data->previous_metrics);
+	metric_columns_free(&data->current_metrics);
 }
 
 
@@ -48,19 +57,16 @@ static void cleanup_data_buffers(proc_net_dev_data *data) {
  */
 typedef enum {
 	IFACE_LIST = 0,
-	METRICS = 1
+	METRICS = 1,
+	METRICS_PACKED = 2
 } proc_net_dev_msgtype;
 
-#define WRITE_BUFFER_SIZE (4 * 4096)
-static char write_buffer[WRITE_BUFFER_SIZE];
-
-static void write_iface_list(FILE *output_file, nanosec_t timestamp, proc_net_dev_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_iface_list(trace_file_t *trace_file, nanosec_t timestamp, proc_net_dev_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-net-dev: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("proc-net-dev: Writing message type: %u\n", IFACE_LIST & 0xFF);
 	*buffer_ptr = (char)IFACE_LIST;
@@ -69,27 +75,27 @@ static void write_iface_list(FILE *output_file, nanosec_t timestamp, proc_net_de
 	DEBUG_PRINT("proc-net-dev: Writing num interfaces: %u\n", data->num_ifaces);
 	write_var_uint32_t(data->num_ifaces, &buffer_ptr);
 
-	for (unsigned int iface_id = 0; iface_id < data->num_ifaces; iface_id++) {
-		DEBUG_PRINT("proc-net-dev: Writing interface name: %s\n", data->iface_names[iface_id]);
-		int iface_name_len = strlen(data->iface_names[iface_id]);
+	for (uint32_t iface_id = 0; iface_id < data->num_ifaces; iface_id++) {
+		const char *iface_name = interner_name(&data->iface_names, iface_id);
+		uint32_t iface_name_len = interner_name_length(&data->iface_names, iface_id);
+		DEBUG_PRINT("proc-net-dev: Writing interface name: %s\n", iface_name);
 		if ((size_t)(end_of_buffer - buffer_ptr) < iface_name_len + 1) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
 		}
-		memcpy(buffer_ptr, data->iface_names[iface_id], iface_name_len + 1);
+		memcpy(buffer_ptr, iface_name, iface_name_len + 1);
 		buffer_ptr += iface_name_len + 1;
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
-static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_net_dev_data *data) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_net_dev_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-net-dev: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
 	DEBUG_PRINT("proc-net-dev: Writing message type: %u\n", METRICS & 0xFF);
 	*buffer_ptr = (char)METRICS;
@@ -98,30 +104,61 @@ static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_net_dev_d
 	DEBUG_PRINT("proc-net-dev: Writing num interfaces: %u\n", data->num_ifaces);
 	write_var_uint32_t(data->num_ifaces, &buffer_ptr);
 
-	proc_net_dev_iface_metrics *prev = data->previous_metrics;
-	proc_net_dev_iface_metrics *curr = data->current_metrics;
-	for (unsigned int iface_id = 0; iface_id < data->num_ifaces; iface_id++) {
-		if ((size_t)(end_of_buffer - buffer_ptr) < 40) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+	// Encode as many interfaces at once as fit in the remaining buffer space
+	uint32_t iface_id = 0;
+	while (iface_id < data->num_ifaces) {
+		uint32_t batch_size = (size_t)(end_of_buffer - buffer_ptr) /
+			(PROC_NET_DEV_FIELDS * VAR_UINT64_MAX_SIZE);
+		if (batch_size == 0) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+			continue;
+		}
+		if (batch_size > data->num_ifaces - iface_id) {
+			batch_size = data->num_ifaces - iface_id;
 		}
 
-		uint64_t d_rb = curr->recv_bytes - prev->recv_bytes;
-		uint64_t d_rp = curr->recv_packets - prev->recv_packets;
-		uint64_t d_sb = curr->send_bytes - prev->send_bytes;
-		uint64_t d_sp = curr->send_packets - prev->send_packets;
-		DEBUG_PRINT("proc-net-dev: Writing recv (%llu/%llu) and send (%llu/%llu)\n", d_rb, d_rp, d_sb, d_sp);
+		DEBUG_PRINT("proc-net-dev: Writing interfaces %u-%u\n", iface_id, iface_id + batch_size - 1);
+		write_var_uint64_columns(deltas, iface_id, batch_size, &buffer_ptr);
+		iface_id += batch_size;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_packed_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_net_dev_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-net-dev: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
 
-		write_var_uint64_t(d_rb, &buffer_ptr);
-		write_var_uint64_t(d_rp, &buffer_ptr);
-		write_var_uint64_t(d_sb, &buffer_ptr);
-		write_var_uint64_t(d_sp, &buffer_ptr);
+	DEBUG_PRINT("proc-net-dev: Writing message type: %u\n", METRICS_PACKED & 0xFF);
+	*buffer_ptr = (char)METRICS_PACKED;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-net-dev: Writing num interfaces: %u\n", data->num_ifaces);
+	write_var_uint32_t(data->num_ifaces, &buffer_ptr);
 
-		prev++;
-		curr++;
+	// Pack each field of (up to PACKED_GROUP_MAX_VALUES) interfaces as one group
+	for (uint32_t field = 0; field < PROC_NET_DEV_FIELDS; field++) {
+		const uint64_t *column = metric_column(deltas, field);
+		for (uint32_t iface_id = 0; iface_id < data->num_ifaces; iface_id += PACKED_GROUP_MAX_VALUES) {
+			uint32_t group_size = data->num_ifaces - iface_id;
+			if (group_size > PACKED_GROUP_MAX_VALUES) {
+				group_size = PACKED_GROUP_MAX_VALUES;
+			}
+			if ((size_t)(end_of_buffer - buffer_ptr) < PACKED_GROUP_MAX_SIZE(group_size)) {
+				fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+				buffer_ptr = trace_file->write_buffer;
+			}
+
+			DEBUG_PRINT("proc-net-dev: Writing field %u of interfaces %u-%u\n", field, iface_id, iface_id + group_size - 1);
+			write_packed_uint64_group(column + iface_id, group_size, &buffer_ptr);
+		}
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
 
@@ -129,75 +166,79 @@ static void write_metrics(FILE *output_file, nanosec_t timestamp, proc_net_dev_d
  * /proc/net/dev parsing logic
  */
 #define READ_BUFFER_SIZE (4096)
-static char read_buffer[READ_BUFFER_SIZE];
 
 #define MAX_IFACE_NAME_SIZE 255
 #define STR(x) STR1(x)
 #define STR1(x) #x
+#define STATISTICS_FORMAT \
+	" %llu %llu %*llu %*llu %*llu %*llu %*llu %*llu" \
+	" %llu %llu %*llu %*llu %*llu %*llu %*llu %*llu"
+
+static bool is_cached_name(const interner_t *iface_names, uint32_t iface_id, const char *iface_name, uint32_t iface_name_len) {
+	return iface_name_len == interner_name_length(iface_names, iface_id) &&
+		memcmp(iface_name, interner_name(iface_names, iface_id), iface_name_len) == 0;
+}
 
 static void enumerate_interfaces(trace_file_t *trace_file) {
 	nanosec_t sample_time = get_time();
 
+	proc_net_dev_data *data = (proc_net_dev_data *)trace_file->data;
+	// Consume pending hotplug events, as the new interface list will reflect them
+	data->verified_generation = hotplug_watcher_poll(&data->hotplug, &data->iface_names);
+	interner_reset(&data->iface_names);
+
 	FILE *file_handle = fopen(trace_file->source_file_name, "rb");
 	// Read and skip the first two lines (headers)
+	char read_buffer[READ_BUFFER_SIZE];
 	fgets(read_buffer, sizeof(read_buffer), file_handle);
 	fgets(read_buffer, sizeof(read_buffer), file_handle);
 	// Read and parse until the end of the file to find all interface names
-	char iface_names_count = 0;
-	char iface_names_length = 8;
-	char **iface_names = malloc(sizeof(char *) * iface_names_length);
-	char *iface_name = malloc(MAX_IFACE_NAME_SIZE + 1);
+	char iface_name[MAX_IFACE_NAME_SIZE + 1];
 	while (fscanf(file_handle, " %" STR(MAX_IFACE_NAME_SIZE) "s"
 				" %*llu %*llu %*llu %*llu %*llu %*llu %*llu %*llu"
 				" %*llu %*llu %*llu %*llu %*llu %*llu %*llu %*llu", iface_name) > 0) {
-		// Trim the trailing colon from the interface name
-		iface_name[strlen(iface_name) - 1] = '\0';
-
-		if (iface_names_count == iface_names_length) {
-			iface_names = realloc(iface_names, sizeof(char *) * iface_names_length * 2);
-			iface_names_length *= 2;
-		}
-		iface_names[iface_names_count] = iface_name;
-		iface_names_count++;
-
-		iface_name = malloc(MAX_IFACE_NAME_SIZE + 1);
+		// Intern the interface name without its trailing colon
+		interner_intern(&data->iface_names, iface_name, strlen(iface_name) - 1);
 	}
 	fclose(file_handle);
 
-
-	// Clean up existing data structures
-	proc_net_dev_data *data = (proc_net_dev_data *)trace_file->data;
-	cleanup_data_buffers(data);
-	// Store enumerated interfaces and reallocate data structures
-	data->num_ifaces = iface_names_count;
-	data->iface_names = iface_names;
-	data->previous_metrics = calloc(iface_names_count, sizeof(proc_net_dev_iface_metrics));
-	data->current_metrics = calloc(iface_names_count, sizeof(proc_net_dev_iface_metrics));
+	// Reallocate data structures for the enumerated interfaces
+	resize_data_buffers(data, data->iface_names.count);
 
 
 	// Write the interface list to the output file
-	write_iface_list(trace_file->output_file, sample_time, data);
+	write_iface_list(trace_file, sample_time, data);
 }
 
 static void parse_proc_net_dev(trace_file_t *trace_file) {
 	nanosec_t sample_time = get_time();
 
 	proc_net_dev_data *data = (proc_net_dev_data *)trace_file->data;
+	data->have_deltas = false;
+
+	// Interface names only need to be compared to the cached names if a
+	// hotplug event was received since they were last verified
+	uint32_t hotplug_generation = hotplug_watcher_poll(&data->hotplug, &data->iface_names);
+	bool verify_names = !hotplug_watcher_active(&data->hotplug) || hotplug_generation != data->verified_generation;
 
 	FILE *file_handle = fopen(trace_file->source_file_name, "rb");
 	// Read and skip the first two lines (headers)
+	char read_buffer[READ_BUFFER_SIZE];
 	fgets(read_buffer, sizeof(read_buffer), file_handle);
 	fgets(read_buffer, sizeof(read_buffer), file_handle);
 	// Read and parse until the end of the file to find all interface statistics
-	proc_net_dev_iface_metrics *next_iface = data->current_metrics;
+	uint64_t *recv_bytes_column = metric_column(&data->current_metrics, RECV_BYTES);
+	uint64_t *recv_packets_column = metric_column(&data->current_metrics, RECV_PACKETS);
+	uint64_t *send_bytes_column = metric_column(&data->current_metrics, SEND_BYTES);
+	uint64_t *send_packets_column = metric_column(&data->current_metrics, SEND_PACKETS);
 	char iface_name[MAX_IFACE_NAME_SIZE + 1];
-	int iface_id = 0;
+	uint32_t iface_id = 0;
 	uint64_t recv_bytes, recv_packets, send_bytes, send_packets;
-	while (fscanf(file_handle, " %" STR(MAX_IFACE_NAME_SIZE) "s"
-				" %llu %llu %*llu %*llu %*llu %*llu %*llu %*llu"
-				" %llu %llu %*llu %*llu %*llu %*llu %*llu %*llu", iface_name,
-				&recv_bytes, &recv_packets,
-				&send_bytes, &send_packets) > 0) {
+	while ((verify_names ?
+				fscanf(file_handle, " %" STR(MAX_IFACE_NAME_SIZE) "s" STATISTICS_FORMAT, iface_name,
+					&recv_bytes, &recv_packets, &send_bytes, &send_packets) :
+				fscanf(file_handle, " %*s" STATISTICS_FORMAT,
+					&recv_bytes, &recv_packets, &send_bytes, &send_packets)) > 0) {
 		if (iface_id >= data->num_ifaces) {
 			// Number of interfaces has changed, so re-enumerate all interfaces
 			fclose(file_handle);
@@ -205,10 +246,8 @@ static void parse_proc_net_dev(trace_file_t *trace_file) {
 			return;
 		}
 
-		// Trim the trailing colon from the interface name
-		iface_name[strlen(iface_name) - 1] = '\0';
-		// Ensure that the interface name matches the cached name
-		if (strcmp(iface_name, data->iface_names[iface_id]) != 0) {
+		// Ensure that the interface name (minus its trailing colon) matches the cached name
+		if (verify_names && !is_cached_name(&data->iface_names, iface_id, iface_name, strlen(iface_name) - 1)) {
 			// Interface name does not match, so re-enumerate all interfaces
 			fclose(file_handle);
 			enumerate_interfaces(trace_file);
@@ -216,12 +255,11 @@ static void parse_proc_net_dev(trace_file_t *trace_file) {
 		}
 
 		// Store parsed values
-		next_iface->recv_bytes = recv_bytes;
-		next_iface->recv_packets = recv_packets;
-		next_iface->send_bytes = send_bytes;
-		next_iface->send_packets = send_packets;
+		recv_bytes_column[iface_id] = recv_bytes;
+		recv_packets_column[iface_id] = recv_packets;
+		send_bytes_column[iface_id] = send_bytes;
+		send_packets_column[iface_id] = send_packets;
 
-		next_iface++;
 		iface_id++;
 	}
 	if (iface_id != data->num_ifaces) {
@@ -232,16 +270,71 @@ static void parse_proc_net_dev(trace_file_t *trace_file) {
 	}
 	fclose(file_handle);
 
-	// Write metrics to the output file
-	write_metrics(trace_file->output_file, sample_time, data);
+	// An interface that was removed and replaced by another one while the file was
+	// read leaves the number of interfaces unchanged. Without verified names, the
+	// rows may then belong to different interfaces, so discard the sample and
+	// verify the names in the next tick.
+	if (!verify_names && hotplug_watcher_poll(&data->hotplug, &data->iface_names) != hotplug_generation) {
+		DEBUG_PRINT("proc-net-dev: Hotplug event while reading, discarding sample\n");
+		return;
+	}
+	data->verified_generation = hotplug_generation;
+
+	// Let previous = current - previous and write the deltas to the output file
+	metric_columns_delta(&data->previous_metrics, &data->current_metrics);
+	if (data->encoding == ENCODING_PACKED) {
+		write_packed_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	} else {
+		write_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	}
+
+	data->have_deltas = data->have_previous_metrics;
+	data->have_previous_metrics = true;
 
 	// Swap the metric buffers
-	proc_net_dev_iface_metrics *tmp = data->previous_metrics;
+	metric_columns_t tmp = data->previous_metrics;
 	data->previous_metrics = data->current_metrics;
 	data->current_metrics = tmp;
 }
 
 
+/**
+ * Table of the last sample: per-interface deltas
+ */
+static const char *const proc_net_dev_field_names[PROC_NET_DEV_FIELDS] = {
+	"recv_bytes", "recv_packets", "send_bytes", "send_packets"
+};
+
+static void proc_net_dev_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	const proc_net_dev_data *data = (const proc_net_dev_data *)trace_file->data;
+	*num_entities = data->num_ifaces;
+	*num_fields = PROC_NET_DEV_FIELDS;
+}
+
+static const char *proc_net_dev_table_entity_name(const trace_file_t *trace_file, uint32_t entity) {
+	return interner_name(&((const proc_net_dev_data *)trace_file->data)->iface_names, entity);
+}
+
+static const char *proc_net_dev_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return proc_net_dev_field_names[field];
+}
+
+static bool proc_net_dev_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so current_metrics holds the deltas
+	const proc_net_dev_data *data = (const proc_net_dev_data *)trace_file->data;
+	metric_columns_read(&data->current_metrics, values);
+	return data->have_deltas;
+}
+
+static const trace_table_t proc_net_dev_table = {
+	.name = "proc-net-dev",
+	.shape = proc_net_dev_table_shape,
+	.entity_name = proc_net_dev_table_entity_name,
+	.field_name = proc_net_dev_table_field_name,
+	.read = proc_net_dev_table_read
+};
+
+
 /**
  * Parse module initialization and cleanup
  */
@@ -254,22 +347,32 @@ static void cleanup_proc_net_dev(trace_file_t *trace_file) {
 	free(trace_file);
 }
 
-trace_file_t *init_proc_net_dev_parser(const char *output_directory, const char *hostname) {
+trace_file_t *init_proc_net_dev_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		uint32_t max_entities) {
 	char *output_filename = malloc(strlen(output_directory) + strlen("/proc-net-dev-") + strlen(hostname) + 1);
 	*output_filename = '\0';
 	strcat(output_filename, output_directory);
 	strcat(output_filename, "/proc-net-dev-");
 	strcat(output_filename, hostname);
 
-	trace_file_t *trace_file = malloc(sizeof(trace_file_t));
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
 	trace_file->parse_callback = parse_proc_net_dev;
 	trace_file->cleanup_callback = cleanup_proc_net_dev;
 	trace_file->source_file_name = proc_net_dev_filename;
+	trace_file->has_list_records = true;
+	trace_file->table = &proc_net_dev_table;
 	trace_file->data = calloc(1, sizeof(proc_net_dev_data));
 	trace_file->output_file = fopen(output_filename, "wb");
 
 	free(output_filename);
 
+	proc_net_dev_data *data = (proc_net_dev_data *)trace_file->data;
+	data->encoding = encoding;
+	interner_init(&data->iface_names, max_entities);
+	hotplug_watcher_init(&data->hotplug, HOTPLUG_NET);
+	metric_columns_init(&data->previous_metrics, PROC_NET_DEV_FIELDS, max_entities);
+	metric_columns_init(&data->current_metrics, PROC_NET_DEV_FIELDS, max_entities);
+
 	enumerate_interfaces(trace_file);
 
 	return trace_file;
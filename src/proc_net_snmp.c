@@ -0,0 +1,341 @@
+
+#include "intern.h"
+#include "parse.h"
+#include "procfs.h"
+#include "varint.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+/**
+ * Module data
+ */
+#define MAX_COUNTER_NAME_LEN 128
+
+// /proc/net/snmp and /proc/net/netstat share the same format of header/value line pairs
+typedef struct {
+	proc_file_t file;
+	// Index of the recorded counter for each value in the file (over all value lines), or NOT_RECORDED
+	int32_t *value_counters;
+	uint32_t num_values;
+	uint32_t values_capacity;
+} proc_net_snmp_source;
+
+typedef enum {
+	SOURCE_SNMP = 0,
+	SOURCE_NETSTAT,
+	NUM_SOURCES
+} proc_net_snmp_source_id;
+
+typedef struct {
+	proc_net_snmp_source sources[NUM_SOURCES];
+	// Comma-separated list of "<Protocol>:<Counter>" names, names ending in '*' match any counter with that prefix
+	char *counter_patterns;
+	// Names of the recorded counters, in file order
+	interner_t counter_names;
+	uint32_t num_counters;
+	uint64_t *previous_metrics;
+	uint64_t *current_metrics;
+	// Whether the previous sample covers the current entities, and whether the last sample holds deltas
+	bool have_previous_metrics;
+	bool have_deltas;
+} proc_net_snmp_data;
+
+static void resize_data_buffers(proc_net_snmp_data *data, uint32_t num_counters) {
+	data->previous_metrics = realloc(data->previous_metrics, num_counters * sizeof(uint64_t));
+	data->current_metrics = realloc(data->current_metrics, num_counters * sizeof(uint64_t));
+	memset(data->previous_metrics, 0, num_counters * sizeof(uint64_t));
+	memset(data->current_metrics, 0, num_counters * sizeof(uint64_t));
+	data->num_counters = num_counters;
+	data->have_previous_metrics = false;
+}
+
+static void cleanup_data_buffers(proc_net_snmp_data *data) {
+	for (uint32_t source = 0; source < NUM_SOURCES; source++) {
+		proc_file_close(&data->sources[source].file);
+		free(data->sources[source].value_counters);
+	}
+	free(data->counter_patterns);
+	interner_free(&data->counter_names);
+	free(data->previous_metrics);
+	free(data->current_metrics);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	COUNTER_LIST = 0,
+	METRICS = 1
+} proc_net_snmp_msgtype;
+
+static void write_counter_list(trace_file_t *trace_file, nanosec_t timestamp, proc_net_snmp_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-net-snmp: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-net-snmp: Writing message type: %u\n", COUNTER_LIST & 0xFF);
+	*buffer_ptr = (char)COUNTER_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-net-snmp: Writing num counters: %u\n", data->num_counters);
+	write_var_uint32_t(data->num_counters, &buffer_ptr);
+
+	for (uint32_t counter_id = 0; counter_id < data->num_counters; counter_id++) {
+		const char *counter_name = interner_name(&data->counter_names, counter_id);
+		uint32_t counter_name_len = interner_name_length(&data->counter_names, counter_id);
+		DEBUG_PRINT("proc-net-snmp: Writing counter name: %s\n", counter_name);
+		if ((size_t)(end_of_buffer - buffer_ptr) < counter_name_len + 1) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		memcpy(buffer_ptr, counter_name, counter_name_len + 1);
+		buffer_ptr += counter_name_len + 1;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_net_snmp_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-net-snmp: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-net-snmp: Writing message type: %u\n", METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-net-snmp: Writing num counters: %u\n", data->num_counters);
+	write_var_uint32_t(data->num_counters, &buffer_ptr);
+
+	for (uint32_t counter_id = 0; counter_id < data->num_counters; counter_id++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		// Signed for gauges (see is_selected_counter), e.g., Tcp:CurrEstab
+		int64_t delta = (int64_t)(data->current_metrics[counter_id] - data->previous_metrics[counter_id]);
+		DEBUG_PRINT("proc-net-snmp: Writing delta of %s: %lld\n", interner_name(&data->counter_names, counter_id), delta);
+		write_var_int64_t(delta, &buffer_ptr);
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * /proc/net/snmp and /proc/net/netstat parsing logic
+ */
+static uint64_t parse_signed_value(const char **ptr) {
+	// Some values are signed (e.g., Tcp:MaxConn is -1), store them in two's complement
+	skip_spaces(ptr);
+	if (**ptr == '-') {
+		(*ptr)++;
+		return -parse_uint64(ptr);
+	}
+	return parse_uint64(ptr);
+}
+
+static void enumerate_source_counters(proc_net_snmp_data *data, proc_net_snmp_source *source) {
+	source->num_values = 0;
+	if (!proc_file_read(&source->file)) {
+		return;
+	}
+
+	// Each protocol has a header line "<Protocol>: <Counter> ..." followed by
+	// a value line "<Protocol>: <value> ...", match the header names once and
+	// remember which values belong to a recorded counter for subsequent ticks
+	char counter_name[MAX_COUNTER_NAME_LEN];
+	const char *ptr = source->file.buffer;
+	while (*ptr != '\0') {
+		const char *protocol = ptr;
+		skip_token(&ptr);
+		size_t protocol_len = (size_t)(ptr - protocol);
+		if (protocol_len >= MAX_COUNTER_NAME_LEN) {
+			protocol_len = 0;
+		}
+		memcpy(counter_name, protocol, protocol_len);
+
+		while (!at_end_of_line(&ptr)) {
+			const char *name = ptr;
+			skip_token(&ptr);
+			size_t name_len = (size_t)(ptr - name);
+			if (protocol_len + name_len >= MAX_COUNTER_NAME_LEN) {
+				name_len = MAX_COUNTER_NAME_LEN - 1 - protocol_len;
+			}
+			memcpy(counter_name + protocol_len, name, name_len);
+			name_len += protocol_len;
+
+			if (source->num_values == source->values_capacity) {
+				source->values_capacity = source->values_capacity == 0 ? 256 : 2 * source->values_capacity;
+				source->value_counters = realloc(source->value_counters, source->values_capacity * sizeof(int32_t));
+			}
+			if (is_selected_counter(data->counter_patterns, counter_name, name_len)) {
+				source->value_counters[source->num_values] = (int32_t)interner_append(&data->counter_names, counter_name,
+						(uint32_t)name_len);
+			} else {
+				source->value_counters[source->num_values] = NOT_RECORDED;
+			}
+			source->num_values++;
+		}
+
+		// Skip the header and value lines
+		skip_line(&ptr);
+		skip_line(&ptr);
+	}
+}
+
+static void enumerate_counters(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	proc_net_snmp_data *data = (proc_net_snmp_data *)trace_file->data;
+	interner_reset(&data->counter_names);
+	for (uint32_t source = 0; source < NUM_SOURCES; source++) {
+		enumerate_source_counters(data, &data->sources[source]);
+	}
+
+	// Reallocate data structures for the enumerated counters
+	resize_data_buffers(data, data->counter_names.count);
+
+	// Write the counter list to the output file
+	write_counter_list(trace_file, sample_time, data);
+}
+
+static bool parse_source_counters(proc_net_snmp_data *data, proc_net_snmp_source *source) {
+	if (source->num_values == 0) {
+		return true;
+	}
+	if (!proc_file_read(&source->file)) {
+		return true;
+	}
+
+	// Counters are looked up by position, header names are not compared
+	const char *ptr = source->file.buffer;
+	uint32_t value = 0;
+	while (*ptr != '\0') {
+		skip_line(&ptr);
+		skip_token(&ptr);
+		while (!at_end_of_line(&ptr)) {
+			if (value >= source->num_values) {
+				return false;
+			}
+			int32_t counter_id = source->value_counters[value];
+			if (counter_id != NOT_RECORDED) {
+				data->current_metrics[counter_id] = parse_signed_value(&ptr);
+			} else {
+				skip_token(&ptr);
+			}
+			value++;
+		}
+		skip_line(&ptr);
+	}
+	return value == source->num_values;
+}
+
+static void parse_proc_net_snmp(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	proc_net_snmp_data *data = (proc_net_snmp_data *)trace_file->data;
+	data->have_deltas = false;
+	for (uint32_t source = 0; source < NUM_SOURCES; source++) {
+		if (!parse_source_counters(data, &data->sources[source])) {
+			// Number of counters has changed, so re-enumerate all counters
+			enumerate_counters(trace_file);
+			return;
+		}
+	}
+
+	write_metrics(trace_file, sample_time, data);
+
+	data->have_deltas = data->have_previous_metrics;
+	data->have_previous_metrics = true;
+
+	// Swap the metric buffers
+	uint64_t *tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+}
+
+
+/**
+ * Table of the last sample: deltas of the recorded counters, as a single entity
+ */
+static void proc_net_snmp_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	*num_entities = 1;
+	*num_fields = ((const proc_net_snmp_data *)trace_file->data)->num_counters;
+}
+
+static const char *proc_net_snmp_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return interner_name(&((const proc_net_snmp_data *)trace_file->data)->counter_names, field);
+}
+
+static bool proc_net_snmp_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so previous_metrics holds the last sample
+	const proc_net_snmp_data *data = (const proc_net_snmp_data *)trace_file->data;
+	for (uint32_t counter_id = 0; counter_id < data->num_counters; counter_id++) {
+		values[counter_id] = (int64_t)(data->previous_metrics[counter_id] - data->current_metrics[counter_id]);
+	}
+	return data->have_deltas;
+}
+
+static const trace_table_t proc_net_snmp_table = {
+	.name = "proc-net-snmp",
+	.shape = proc_net_snmp_table_shape,
+	.entity_name = NULL,
+	.field_name = proc_net_snmp_table_field_name,
+	.read = proc_net_snmp_table_read
+};
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char proc_net_snmp_filename[] = "/proc/net/snmp";
+static const char proc_net_netstat_filename[] = "/proc/net/netstat";
+
+static void cleanup_proc_net_snmp(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((proc_net_snmp_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_proc_net_snmp_parser(const char *output_directory, const char *hostname, const char *counters) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/proc-net-snmp-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/proc-net-snmp-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_proc_net_snmp;
+	trace_file->cleanup_callback = cleanup_proc_net_snmp;
+	trace_file->source_file_name = proc_net_snmp_filename;
+	trace_file->has_list_records = true;
+	trace_file->table = &proc_net_snmp_table;
+	trace_file->data = calloc(1, sizeof(proc_net_snmp_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	proc_net_snmp_data *data = (proc_net_snmp_data *)trace_file->data;
+	data->counter_patterns = strdup(counters);
+	interner_init(&data->counter_names, 0);
+	if (!proc_file_open(&data->sources[SOURCE_SNMP].file, proc_net_snmp_filename)) {
+		printf("Failed to open %s, no IP/TCP/UDP counters will be recorded\n", proc_net_snmp_filename);
+	}
+	if (!proc_file_open(&data->sources[SOURCE_NETSTAT].file, proc_net_netstat_filename)) {
+		printf("Failed to open %s, no extended TCP counters will be recorded\n", proc_net_netstat_filename);
+	}
+
+	enumerate_counters(trace_file);
+
+	return trace_file;
+}
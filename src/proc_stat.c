@@ -1,153 +1,434 @@
 
+#include "bitpack.h"
+#include "columns.h"
+#include "parse.h"
 #include "procfs.h"
+#include "schedstat.h"
 #include "varint.h"
 
 #include <memory.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
 /**
  * Data structures representing the relevant information of /proc/stat
  */
+typedef enum {
+	USER = 0,
+	NICE,
+	SYSTEM,
+	IDLE,
+	IOWAIT,
+	IRQ,
+	SOFTIRQ,
+	STEAL,
+	GUEST,
+	GUESTNICE,
+	PROC_STAT_CPU_FIELDS
+} proc_stat_cpu_field;
+
 typedef struct {
-	uint64_t user;
-	uint64_t nice;
-	uint64_t system;
-	uint64_t idle;
-	uint64_t iowait;
-	uint64_t irq;
-	uint64_t softirq;
-	uint64_t steal;
-	uint64_t guest;
-	uint64_t guestnice;
-} proc_stat_cpus_data;
+	// Cumulative counters
+	uint64_t interrupts;
+	uint64_t context_switches;
+	uint64_t forks;
+	uint64_t softirqs;
+	// Gauges
+	uint64_t procs_running;
+	uint64_t procs_blocked;
+} proc_stat_system_metrics;
 
 typedef struct {
+	proc_file_t file;
+	// Rows are indexed by CPU ID, for CPU IDs 0 to num_cpus - 1
 	unsigned int num_cpus;
-	proc_stat_cpus_data cpu_infos[];
+	metric_encoding_t encoding;
+	// Online state of each CPU as of the last CPU list record and the current sample
+	bool *previous_online;
+	bool *current_online;
+	// Whether each CPU was online in any sample since the buffers were reset, i.e.,
+	// whether its previous counters were read rather than zero-initialized
+	bool *seen_online;
+	unsigned int online_capacity;
+	// Per-CPU counters, one column per field
+	metric_columns_t previous_cpus;
+	metric_columns_t current_cpus;
+	// Per-CPU scheduler statistics, if enabled and available
+	bool schedstat_enabled;
+	schedstat_reader_t schedstat;
+	// System-wide counters and gauges
+	proc_stat_system_metrics previous_system;
+	proc_stat_system_metrics current_system;
+	// Whether the previous sample covers the current entities, and whether the last sample holds deltas
+	bool have_previous_metrics;
+	bool have_deltas;
 } proc_stat_data;
 
-static proc_stat_data *alloc_proc_stat_data(unsigned int num_cpus) {
-	proc_stat_data *res = calloc(1, sizeof(proc_stat_data) +
-			sizeof(proc_stat_cpus_data) * num_cpus);
-	res->num_cpus = num_cpus;
+static void resize_data_buffers(proc_stat_data *data, unsigned int num_cpus) {
+	metric_columns_resize(&data->previous_cpus, num_cpus);
+	metric_columns_resize(&data->current_cpus, num_cpus);
+	// Keep the online states as large as the (possibly preallocated) columns
+	if (data->current_cpus.capacity > data->online_capacity) {
+		data->online_capacity = data->current_cpus.capacity;
+		data->previous_online = realloc(data->previous_online, data->online_capacity * sizeof(bool));
+		data->current_online = realloc(data->current_online, data->online_capacity * sizeof(bool));
+		data->seen_online = realloc(data->seen_online, data->online_capacity * sizeof(bool));
+	}
+	memset(data->previous_online, 0, num_cpus * sizeof(bool));
+	memset(data->current_online, 0, num_cpus * sizeof(bool));
+	memset(data->seen_online, 0, num_cpus * sizeof(bool));
+	if (data->schedstat_enabled) {
+		schedstat_reader_resize(&data->schedstat, num_cpus);
+	}
+	data->num_cpus = num_cpus;
+	data->have_previous_metrics = false;
+}
+
+static proc_stat_data *alloc_proc_stat_data(unsigned int num_cpus, metric_encoding_t encoding, bool enable_schedstat,
+		uint32_t max_entities) {
+	proc_stat_data *res = calloc(1, sizeof(proc_stat_data));
+	res->encoding = encoding;
+	metric_columns_init(&res->previous_cpus, PROC_STAT_CPU_FIELDS, max_entities);
+	metric_columns_init(&res->current_cpus, PROC_STAT_CPU_FIELDS, max_entities);
+	if (enable_schedstat) {
+		res->schedstat_enabled = schedstat_reader_init(&res->schedstat, num_cpus, max_entities);
+		if (!res->schedstat_enabled) {
+			schedstat_reader_free(&res->schedstat);
+		}
+	}
+	resize_data_buffers(res, num_cpus);
 	return res;
 }
 
 
 /**
- * /proc/stat parsing logic
+ * Message writing logic
  */
-#define WRITE_BUFFER_SIZE (4 * 4096)
-static char write_buffer[WRITE_BUFFER_SIZE];
-static proc_stat_data *temp_data;
-
-static void read_proc_stat(const char *filename, proc_stat_data *out_data) {
-	// Format: first line contains aggregate numbers (skip), next <num_cpus>
-	// lines contain "cpuXX" followed by 10 values, remaining lines are skipped
-	
-	FILE *file_handle = fopen(filename, "rb");
-	// Read and skip first line
-	char buffer[255];
-	fgets(buffer, sizeof(buffer), file_handle);
-	// Read and parse next <num_cpus> lines
-	for (unsigned int cpu_id = 0; cpu_id < out_data->num_cpus; cpu_id++) {
-		fscanf(file_handle, "cpu%*d %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu ",
-				&out_data->cpu_infos[cpu_id].user,
-				&out_data->cpu_infos[cpu_id].nice,
-				&out_data->cpu_infos[cpu_id].system,
-				&out_data->cpu_infos[cpu_id].idle,
-				&out_data->cpu_infos[cpu_id].iowait,
-				&out_data->cpu_infos[cpu_id].irq,
-				&out_data->cpu_infos[cpu_id].softirq,
-				&out_data->cpu_infos[cpu_id].steal,
-				&out_data->cpu_infos[cpu_id].guest,
-				&out_data->cpu_infos[cpu_id].guestnice);
-	}
-	// Skip remaining lines
-	fclose(file_handle);
+typedef enum {
+	CPU_LIST = 0,
+	METRICS = 1,
+	METRICS_PACKED = 2,
+	SYSTEM_METRICS = 3,
+	SCHED_METRICS = 4,
+	SCHED_METRICS_PACKED = 5
+} proc_stat_msgtype;
+
+static void write_cpu_list(trace_file_t *trace_file, nanosec_t timestamp, unsigned int num_cpus, const bool *online) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-stat: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-stat: Writing message type: %u\n", CPU_LIST & 0xFF);
+	*buffer_ptr = (char)CPU_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-stat: Writing num cpus: %u\n", num_cpus);
+	write_var_uint32_t(num_cpus, &buffer_ptr);
+	for (unsigned int cpu_id = 0; cpu_id < num_cpus; cpu_id++) {
+		if (buffer_ptr == end_of_buffer) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		DEBUG_PRINT("proc-stat: Writing cpu %u state: %s\n", cpu_id, online[cpu_id] ? "online" : "offline");
+		*buffer_ptr = (char)online[cpu_id];
+		buffer_ptr++;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_deltas(trace_file_t *trace_file, nanosec_t timestamp, proc_stat_msgtype msgtype, unsigned int num_cpus,
+		metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-stat: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-stat: Writing message type: %u\n", msgtype & 0xFF);
+	*buffer_ptr = (char)msgtype;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-stat: Writing num cpus: %u\n", num_cpus);
+	write_var_uint32_t(num_cpus, &buffer_ptr);
+	// Encode as many CPUs at once as fit in the remaining buffer space
+	unsigned int cpu_id = 0;
+	while (cpu_id < num_cpus) {
+		unsigned int batch_size = (size_t)(end_of_buffer - buffer_ptr) /
+			(deltas->num_fields * VAR_UINT64_MAX_SIZE);
+		if (batch_size == 0) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+			continue;
+		}
+		if (batch_size > num_cpus - cpu_id) {
+			batch_size = num_cpus - cpu_id;
+		}
+
+		DEBUG_PRINT("proc-stat: Writing cpus %u-%u\n", cpu_id, cpu_id + batch_size - 1);
+		write_var_uint64_columns(deltas, cpu_id, batch_size, &buffer_ptr);
+		cpu_id += batch_size;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
 }
 
-static void write_deltas(FILE *output_file, nanosec_t timestamp, proc_stat_data *deltas) {
-	char *buffer_ptr = write_buffer;
-	char *end_of_buffer = write_buffer + sizeof(write_buffer);
+static void write_packed_deltas(trace_file_t *trace_file, nanosec_t timestamp, proc_stat_msgtype msgtype, unsigned int num_cpus,
+		metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
 
 	DEBUG_PRINT("proc-stat: Writing timestamp: %llu\n", timestamp);
-	*(nanosec_t *)buffer_ptr = timestamp;
-	buffer_ptr += sizeof(nanosec_t);
-
-	DEBUG_PRINT("proc-stat: Writing num cpus: %u\n", deltas->num_cpus);
-	write_var_uint32_t(deltas->num_cpus, &buffer_ptr);
-	for (unsigned int cpu_id = 0; cpu_id < deltas->num_cpus; cpu_id++) {
-		if ((size_t)(end_of_buffer - buffer_ptr) < 100) {
-			fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
-			buffer_ptr = write_buffer;
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-stat: Writing message type: %u\n", msgtype & 0xFF);
+	*buffer_ptr = (char)msgtype;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-stat: Writing num cpus: %u\n", num_cpus);
+	write_var_uint32_t(num_cpus, &buffer_ptr);
+	// Pack each field of (up to PACKED_GROUP_MAX_VALUES) CPUs as one group
+	for (unsigned int field = 0; field < deltas->num_fields; field++) {
+		const uint64_t *column = metric_column(deltas, field);
+		for (unsigned int cpu_id = 0; cpu_id < num_cpus; cpu_id += PACKED_GROUP_MAX_VALUES) {
+			unsigned int group_size = num_cpus - cpu_id;
+			if (group_size > PACKED_GROUP_MAX_VALUES) {
+				group_size = PACKED_GROUP_MAX_VALUES;
+			}
+			if ((size_t)(end_of_buffer - buffer_ptr) < PACKED_GROUP_MAX_SIZE(group_size)) {
+				fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+				buffer_ptr = trace_file->write_buffer;
+			}
+
+			DEBUG_PRINT("proc-stat: Writing field %u of cpus %u-%u\n", field, cpu_id, cpu_id + group_size - 1);
+			write_packed_uint64_group(column + cpu_id, group_size, &buffer_ptr);
+		}
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_system_metrics(trace_file_t *trace_file, nanosec_t timestamp, const proc_stat_system_metrics *previous,
+		const proc_stat_system_metrics *current) {
+	char *buffer_ptr = trace_file->write_buffer;
+
+	DEBUG_PRINT("proc-stat: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-stat: Writing message type: %u\n", SYSTEM_METRICS & 0xFF);
+	*buffer_ptr = (char)SYSTEM_METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-stat: Writing system counters (%llu/%llu/%llu/%llu) and gauges (%llu/%llu)\n",
+			current->interrupts - previous->interrupts, current->context_switches - previous->context_switches,
+			current->forks - previous->forks, current->softirqs - previous->softirqs,
+			current->procs_running, current->procs_blocked);
+	write_var_uint64_t(current->interrupts - previous->interrupts, &buffer_ptr);
+	write_var_uint64_t(current->context_switches - previous->context_switches, &buffer_ptr);
+	write_var_uint64_t(current->forks - previous->forks, &buffer_ptr);
+	write_var_uint64_t(current->softirqs - previous->softirqs, &buffer_ptr);
+	write_var_uint64_t(current->procs_running, &buffer_ptr);
+	write_var_uint64_t(current->procs_blocked, &buffer_ptr);
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * /proc/stat parsing logic
+ */
+// Returns false if the file could not be read, in which case nothing is changed
+static bool read_proc_stat(proc_stat_data *data) {
+	// Format: first line contains aggregate numbers (skip), next lines contain
+	// "cpuN" followed by 10 values for each online CPU, remaining lines contain
+	// a name followed by one or more system-wide values
+	if (!proc_file_read(&data->file)) {
+		return false;
+	}
+	memset(data->current_online, 0, data->num_cpus * sizeof(bool));
+
+	const char *ptr = data->file.buffer;
+	skip_line(&ptr);
+	while (CONSUME_PREFIX(&ptr, "cpu")) {
+		unsigned int cpu_id = (unsigned int)parse_uint64(&ptr);
+		if (cpu_id >= data->num_cpus) {
+			// More CPUs than expected were hot-added, so start over with larger buffers
+			DEBUG_PRINT("proc-stat: Found cpu %u, resizing to %u cpus\n", cpu_id, cpu_id + 1);
+			resize_data_buffers(data, cpu_id + 1);
+			return read_proc_stat(data);
 		}
 
-		uint64_t *cpu_data = (uint64_t *)&deltas->cpu_infos[cpu_id];
-		for (unsigned int field = 0; field < 10; field++) {
-			DEBUG_PRINT("proc-stat: Writing cpu %u, field %u: %llu\n", cpu_id, field, cpu_data[field]);
-			write_var_uint32_t(cpu_data[field], &buffer_ptr);
+		data->current_online[cpu_id] = true;
+		for (unsigned int field = 0; field < PROC_STAT_CPU_FIELDS; field++) {
+			metric_column(&data->current_cpus, field)[cpu_id] = parse_uint64(&ptr);
 		}
+		skip_line(&ptr);
 	}
 
-	fwrite(write_buffer, (size_t)(buffer_ptr - write_buffer), 1, output_file);
+	// Parse the system-wide counters, keeping only the totals of intr and softirq
+	proc_stat_system_metrics *system = &data->current_system;
+	while (*ptr != '\0') {
+		if (CONSUME_PREFIX(&ptr, "intr ")) {
+			system->interrupts = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "ctxt ")) {
+			system->context_switches = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "processes ")) {
+			system->forks = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "procs_running ")) {
+			system->procs_running = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "procs_blocked ")) {
+			system->procs_blocked = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "softirq ")) {
+			system->softirqs = parse_uint64(&ptr);
+		}
+		skip_line(&ptr);
+	}
+	return true;
 }
 
 static void parse_proc_stat(trace_file_t *trace_file) {
-	proc_stat_data *previous_data = (proc_stat_data *)trace_file->data;
-	proc_stat_data *current_data = temp_data;
+	proc_stat_data *data = (proc_stat_data *)trace_file->data;
+	data->have_deltas = false;
 
 	nanosec_t sample_time = get_time();
-	read_proc_stat(trace_file->source_file_name, current_data);
-
-	// Let previous_data = current_data - previous_data to prepare for writing deltas
-	for (unsigned int cpu_id = 0; cpu_id < current_data->num_cpus; cpu_id++) {
-		uint64_t *current_cpu_data = (uint64_t *)&current_data->cpu_infos[cpu_id];
-		uint64_t *previous_cpu_data = (uint64_t *)&previous_data->cpu_infos[cpu_id];
-		for (unsigned int field_id = 0; field_id < 10; field_id++) {
-			previous_cpu_data[field_id] = current_cpu_data[field_id] - previous_cpu_data[field_id];
+	if (!read_proc_stat(data)) {
+		return;
+	}
+	// Scheduler statistics are read in the same tick and indexed by the same CPU IDs
+	if (data->schedstat_enabled) {
+		schedstat_read(&data->schedstat, data->num_cpus);
+	}
+
+	// Offline CPUs keep their last known counters, so their deltas are zero
+	// and the deltas of CPUs coming back online cover the offline period
+	for (unsigned int cpu_id = 0; cpu_id < data->num_cpus; cpu_id++) {
+		if (!data->current_online[cpu_id]) {
+			for (unsigned int field = 0; field < PROC_STAT_CPU_FIELDS; field++) {
+				metric_column(&data->current_cpus, field)[cpu_id] = metric_column(&data->previous_cpus, field)[cpu_id];
+			}
+		} else if (!data->seen_online[cpu_id]) {
+			// A CPU that was offline since the first sample has no previous counters, so
+			// seed them with its current counters instead of writing its since-boot totals
+			data->seen_online[cpu_id] = true;
+			if (data->have_previous_metrics) {
+				for (unsigned int field = 0; field < PROC_STAT_CPU_FIELDS; field++) {
+					metric_column(&data->previous_cpus, field)[cpu_id] = metric_column(&data->current_cpus, field)[cpu_id];
+				}
+				if (data->schedstat_enabled) {
+					schedstat_seed_cpu(&data->schedstat, cpu_id);
+				}
+			}
+		}
+	}
+
+	// Write a new CPU list if any CPU went online or offline
+	if (memcmp(data->previous_online, data->current_online, data->num_cpus * sizeof(bool)) != 0) {
+		write_cpu_list(trace_file, sample_time, data->num_cpus, data->current_online);
+		bool *tmp = data->previous_online;
+		data->previous_online = data->current_online;
+		data->current_online = tmp;
+	}
+
+	// Let previous = current - previous to prepare for writing deltas
+	metric_columns_delta(&data->previous_cpus, &data->current_cpus);
+
+	if (data->encoding == ENCODING_PACKED) {
+		write_packed_deltas(trace_file, sample_time, METRICS_PACKED, data->num_cpus, &data->previous_cpus);
+	} else {
+		write_deltas(trace_file, sample_time, METRICS, data->num_cpus, &data->previous_cpus);
+	}
+
+	if (data->schedstat_enabled) {
+		schedstat_reader_t *schedstat = &data->schedstat;
+		metric_columns_delta(&schedstat->previous_cpus, &schedstat->current_cpus);
+		if (data->encoding == ENCODING_PACKED) {
+			write_packed_deltas(trace_file, sample_time, SCHED_METRICS_PACKED, data->num_cpus, &schedstat->previous_cpus);
+		} else {
+			write_deltas(trace_file, sample_time, SCHED_METRICS, data->num_cpus, &schedstat->previous_cpus);
 		}
+		metric_columns_t tmp = schedstat->previous_cpus;
+		schedstat->previous_cpus = schedstat->current_cpus;
+		schedstat->current_cpus = tmp;
 	}
 
-	write_deltas(trace_file->output_file, sample_time, previous_data);
+	write_system_metrics(trace_file, sample_time, &data->previous_system, &data->current_system);
+
+	data->have_deltas = data->have_previous_metrics;
+	data->have_previous_metrics = true;
 
 	// Swap buffers for next iteration
-	trace_file->data = current_data;
-	temp_data = previous_data;
+	metric_columns_t tmp = data->previous_cpus;
+	data->previous_cpus = data->current_cpus;
+	data->current_cpus = tmp;
+	data->previous_system = data->current_system;
 }
 
 
+/**
+ * Table of the last sample: per-CPU deltas, in clock ticks
+ */
+static const char *const proc_stat_field_names[PROC_STAT_CPU_FIELDS] = {
+	"user", "nice", "system", "idle", "iowait", "irq", "softirq", "steal", "guest", "guest_nice"
+};
+
+static void proc_stat_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	*num_entities = ((const proc_stat_data *)trace_file->data)->num_cpus;
+	*num_fields = PROC_STAT_CPU_FIELDS;
+}
+
+static const char *proc_stat_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return proc_stat_field_names[field];
+}
+
+static bool proc_stat_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so current_cpus holds the deltas
+	const proc_stat_data *data = (const proc_stat_data *)trace_file->data;
+	metric_columns_read(&data->current_cpus, values);
+	return data->have_deltas;
+}
+
+static const trace_table_t proc_stat_table = {
+	.name = "proc-stat",
+	.shape = proc_stat_table_shape,
+	.entity_name = NULL,
+	.field_name = proc_stat_table_field_name,
+	.read = proc_stat_table_read
+};
+
+
 /**
  * Parse module initialization
  */
 static const char proc_stat_filename[] = "/proc/stat";
 
 static unsigned int count_num_cpus() {
-	FILE *stat_file = fopen(proc_stat_filename, "rb");
-	// Skip the first line
-	char buffer[255];
-	fgets(buffer, sizeof(buffer), stat_file);
-	// Attempt to scan lines that match cpu info and count the matching lines
-	unsigned int num_cpus = 0;
-	unsigned int cpu_id;
-	while (fscanf(stat_file, "cpu%d %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s ", &cpu_id) > 0) {
-		num_cpus++;
-	}
-
-	return num_cpus;
+	// Configured (i.e., online or offline) CPUs, more are added when hot-added CPUs show up
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	return num_cpus > 0 ? (unsigned int)num_cpus : 1;
 }
 
 static void cleanup_proc_stat(trace_file_t *trace_file) {
-	free(temp_data);
+	proc_stat_data *data = (proc_stat_data *)trace_file->data;
+	proc_file_close(&data->file);
+	if (data->schedstat_enabled) {
+		schedstat_reader_free(&data->schedstat);
+	}
+	free(data->previous_online);
+	free(data->current_online);
+	free(data->seen_online);
+	metric_columns_free(&data->previous_cpus);
+	metric_columns_free(&data->current_cpus);
 	free(trace_file->data);
 	fclose(trace_file->output_file);
 	free(trace_file);
 }
 
-trace_file_t *init_proc_stat_parser(const char *output_directory, const char *hostname) {
+trace_file_t *init_proc_stat_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		bool enable_schedstat, uint32_t max_entities) {
 	unsigned int num_cpus = count_num_cpus();
-	temp_data = alloc_proc_stat_data(num_cpus);
 
 	char *output_filename = malloc(strlen(output_directory) + strlen("/proc-stat-") + strlen(hostname) + 1);
 	*output_filename = '\0';
@@ -155,14 +436,21 @@ trace_file_t *init_proc_stat_parser(const char *output_directory, const char *ho
 	strcat(output_filename, "/proc-stat-");
 	strcat(output_filename, hostname);
 
-	trace_file_t *trace_file = malloc(sizeof(trace_file_t));
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
 	trace_file->parse_callback = parse_proc_stat;
 	trace_file->cleanup_callback = cleanup_proc_stat;
 	trace_file->source_file_name = proc_stat_filename;
-	trace_file->data = alloc_proc_stat_data(num_cpus);
+	trace_file->has_list_records = true;
+	trace_file->table = &proc_stat_table;
+	trace_file->data = alloc_proc_stat_data(num_cpus, encoding, enable_schedstat, max_entities);
 	trace_file->output_file = fopen(output_filename, "wb");
 
 	free(output_filename);
 
+	proc_stat_data *data = (proc_stat_data *)trace_file->data;
+	if (!proc_file_open(&data->file, proc_stat_filename)) {
+		printf("Failed to open %s, no CPU metrics will be recorded\n", proc_stat_filename);
+	}
+
 	return trace_file;
 }
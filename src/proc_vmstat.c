@@ -0,0 +1,273 @@
+
+#include "intern.h"
+#include "parse.h"
+#include "procfs.h"
+#include "varint.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+/**
+ * Module data
+ */
+typedef struct {
+	proc_file_t file;
+	// Comma-separated list of counter names, names ending in '*' match any counter with that prefix
+	char *counter_patterns;
+	// Names of the recorded counters, in file order
+	interner_t counter_names;
+	uint32_t num_counters;
+	// Index of the recorded counter on each line of the file, or NOT_RECORDED
+	int32_t *line_counters;
+	uint32_t num_lines;
+	uint64_t *previous_metrics;
+	uint64_t *current_metrics;
+	// Whether the previous sample covers the current entities, and whether the last sample holds deltas
+	bool have_previous_metrics;
+	bool have_deltas;
+} proc_vmstat_data;
+
+static void resize_data_buffers(proc_vmstat_data *data, uint32_t num_counters) {
+	data->previous_metrics = realloc(data->previous_metrics, num_counters * sizeof(uint64_t));
+	data->current_metrics = realloc(data->current_metrics, num_counters * sizeof(uint64_t));
+	memset(data->previous_metrics, 0, num_counters * sizeof(uint64_t));
+	memset(data->current_metrics, 0, num_counters * sizeof(uint64_t));
+	data->num_counters = num_counters;
+	data->have_previous_metrics = false;
+}
+
+static void cleanup_data_buffers(proc_vmstat_data *data) {
+	proc_file_close(&data->file);
+	free(data->counter_patterns);
+	interner_free(&data->counter_names);
+	free(data->line_counters);
+	free(data->previous_metrics);
+	free(data->current_metrics);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	COUNTER_LIST = 0,
+	METRICS = 1
+} proc_vmstat_msgtype;
+
+static void write_counter_list(trace_file_t *trace_file, nanosec_t timestamp, proc_vmstat_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-vmstat: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-vmstat: Writing message type: %u\n", COUNTER_LIST & 0xFF);
+	*buffer_ptr = (char)COUNTER_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-vmstat: Writing num counters: %u\n", data->num_counters);
+	write_var_uint32_t(data->num_counters, &buffer_ptr);
+
+	for (uint32_t counter_id = 0; counter_id < data->num_counters; counter_id++) {
+		const char *counter_name = interner_name(&data->counter_names, counter_id);
+		uint32_t counter_name_len = interner_name_length(&data->counter_names, counter_id);
+		DEBUG_PRINT("proc-vmstat: Writing counter name: %s\n", counter_name);
+		if ((size_t)(end_of_buffer - buffer_ptr) < counter_name_len + 1) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		memcpy(buffer_ptr, counter_name, counter_name_len + 1);
+		buffer_ptr += counter_name_len + 1;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, proc_vmstat_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("proc-vmstat: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("proc-vmstat: Writing message type: %u\n", METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("proc-vmstat: Writing num counters: %u\n", data->num_counters);
+	write_var_uint32_t(data->num_counters, &buffer_ptr);
+
+	for (uint32_t counter_id = 0; counter_id < data->num_counters; counter_id++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		// Signed for gauges (see is_selected_counter), e.g., nr_free_pages
+		int64_t delta = (int64_t)(data->current_metrics[counter_id] - data->previous_metrics[counter_id]);
+		DEBUG_PRINT("proc-vmstat: Writing delta of %s: %lld\n", interner_name(&data->counter_names, counter_id), delta);
+		write_var_int64_t(delta, &buffer_ptr);
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * /proc/vmstat parsing logic
+ */
+static void enumerate_counters(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	proc_vmstat_data *data = (proc_vmstat_data *)trace_file->data;
+	interner_reset(&data->counter_names);
+	data->num_lines = 0;
+
+	// Match the name on each line against the selected counters once, and
+	// remember which lines hold a recorded counter for subsequent ticks
+	uint32_t lines_capacity = 0;
+	if (proc_file_read(&data->file)) {
+		const char *ptr = data->file.buffer;
+		while (*ptr != '\0') {
+			const char *name = ptr;
+			skip_token(&ptr);
+			size_t name_len = (size_t)(ptr - name);
+
+			if (data->num_lines == lines_capacity) {
+				lines_capacity = lines_capacity == 0 ? 256 : 2 * lines_capacity;
+				data->line_counters = realloc(data->line_counters, lines_capacity * sizeof(int32_t));
+			}
+			if (is_selected_counter(data->counter_patterns, name, name_len)) {
+				data->line_counters[data->num_lines] = (int32_t)interner_append(&data->counter_names, name, (uint32_t)name_len);
+			} else {
+				data->line_counters[data->num_lines] = NOT_RECORDED;
+			}
+			data->num_lines++;
+			skip_line(&ptr);
+		}
+	}
+
+	// Reallocate data structures for the enumerated counters
+	resize_data_buffers(data, data->counter_names.count);
+
+
+	// Write the counter list to the output file
+	write_counter_list(trace_file, sample_time, data);
+}
+
+static void parse_proc_vmstat(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	proc_vmstat_data *data = (proc_vmstat_data *)trace_file->data;
+	data->have_deltas = false;
+	if (!proc_file_read(&data->file)) {
+		return;
+	}
+
+	// Counters are looked up by line number, names are not compared
+	const char *ptr = data->file.buffer;
+	uint32_t line = 0;
+	while (*ptr != '\0') {
+		if (line >= data->num_lines) {
+			// Number of lines has changed, so re-enumerate all counters
+			enumerate_counters(trace_file);
+			return;
+		}
+		int32_t counter_id = data->line_counters[line];
+		if (counter_id != NOT_RECORDED) {
+			skip_token(&ptr);
+			data->current_metrics[counter_id] = parse_uint64(&ptr);
+		}
+		skip_line(&ptr);
+		line++;
+	}
+	if (line != data->num_lines) {
+		// Number of lines has changed, so re-enumerate all counters
+		enumerate_counters(trace_file);
+		return;
+	}
+
+	write_metrics(trace_file, sample_time, data);
+
+	data->have_deltas = data->have_previous_metrics;
+	data->have_previous_metrics = true;
+
+	// Swap the metric buffers
+	uint64_t *tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+}
+
+
+/**
+ * Table of the last sample: deltas of the recorded counters, as a single entity
+ */
+static void proc_vmstat_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	*num_entities = 1;
+	*num_fields = ((const proc_vmstat_data *)trace_file->data)->num_counters;
+}
+
+static const char *proc_vmstat_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return interner_name(&((const proc_vmstat_data *)trace_file->data)->counter_names, field);
+}
+
+static bool proc_vmstat_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so previous_metrics holds the last sample
+	const proc_vmstat_data *data = (const proc_vmstat_data *)trace_file->data;
+	for (uint32_t counter_id = 0; counter_id < data->num_counters; counter_id++) {
+		values[counter_id] = (int64_t)(data->previous_metrics[counter_id] - data->current_metrics[counter_id]);
+	}
+	return data->have_deltas;
+}
+
+static const trace_table_t proc_vmstat_table = {
+	.name = "proc-vmstat",
+	.shape = proc_vmstat_table_shape,
+	.entity_name = NULL,
+	.field_name = proc_vmstat_table_field_name,
+	.read = proc_vmstat_table_read
+};
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char proc_vmstat_filename[] = "/proc/vmstat";
+
+static void cleanup_proc_vmstat(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((proc_vmstat_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_proc_vmstat_parser(const char *output_directory, const char *hostname, const char *counters) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/proc-vmstat-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/proc-vmstat-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_proc_vmstat;
+	trace_file->cleanup_callback = cleanup_proc_vmstat;
+	trace_file->source_file_name = proc_vmstat_filename;
+	trace_file->has_list_records = true;
+	trace_file->table = &proc_vmstat_table;
+	trace_file->data = calloc(1, sizeof(proc_vmstat_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	proc_vmstat_data *data = (proc_vmstat_data *)trace_file->data;
+	data->counter_patterns = strdup(counters);
+	interner_init(&data->counter_names, 0);
+	if (!proc_file_open(&data->file, proc_vmstat_filename)) {
+		printf("Failed to open %s, no vmstat counters will be recorded\n", proc_vmstat_filename);
+	}
+
+	enumerate_counters(trace_file);
+
+	return trace_file;
+}
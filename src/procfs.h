@@ -5,23 +5,56 @@
 #include "monitor.h"
 
 /**
- * File: /proc/stat
+ * Parsers of per-entity files take max_entities, the number of entities
+ * (CPUs, interfaces, disks, or interrupt lines) to preallocate their buffers
+ * for, or 0 to allocate them as entities show up
  */
-trace_file_t *init_proc_stat_parser(const char *output_directory, const char *hostname);
+
+/**
+ * Files: /proc/stat, /proc/schedstat (if enable_schedstat)
+ */
+trace_file_t *init_proc_stat_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		bool enable_schedstat, uint32_t max_entities);
 
 /**
  * File: /proc/net/dev
  */
-trace_file_t *init_proc_net_dev_parser(const char *output_directory, const char *hostname);
+trace_file_t *init_proc_net_dev_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		uint32_t max_entities);
+
+/**
+ * Files: /proc/net/snmp, /proc/net/netstat
+ */
+#define DEFAULT_SNMP_COUNTERS "Tcp:ActiveOpens,Tcp:PassiveOpens,Tcp:AttemptFails,Tcp:EstabResets,Tcp:CurrEstab,Tcp:InSegs," \
+	"Tcp:OutSegs,Tcp:RetransSegs,Tcp:InErrs,Tcp:OutRsts,Udp:InDatagrams,Udp:OutDatagrams,Udp:NoPorts,Udp:InErrors," \
+	"Udp:RcvbufErrors,Udp:SndbufErrors,TcpExt:ListenOverflows,TcpExt:ListenDrops,TcpExt:TCPTimeouts,TcpExt:TCPLostRetransmit," \
+	"TcpExt:TCPFastRetrans,TcpExt:TCPSlowStartRetrans,TcpExt:TCPMemoryPressures,TcpExt:TCPAbortOnMemory,TcpExt:TCPBacklogDrop," \
+	"TcpExt:TCPRcvQDrop,TcpExt:TCPZeroWindowDrop,TcpExt:PruneCalled,TcpExt:RcvPruned,TcpExt:TCPOFOQueue"
+trace_file_t *init_proc_net_snmp_parser(const char *output_directory, const char *hostname, const char *counters);
 
 /**
  * File: /proc/diskstats
  */
-trace_file_t *init_proc_diskstats_parser(const char *output_directory, const char *hostname);
+trace_file_t *init_proc_diskstats_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		bool record_latency, uint32_t max_entities);
 
 /**
  * File: /proc/meminfo
  */
 trace_file_t *init_proc_meminfo_parser(const char *output_directory, const char *hostname);
 
+/**
+ * File: /proc/vmstat
+ */
+#define DEFAULT_VMSTAT_COUNTERS "pgfault,pgmajfault,pgpgin,pgpgout,pswpin,pswpout,pgscan_*,pgsteal_*,allocstall_*," \
+	"compact_stall,compact_fail,compact_success,thp_fault_alloc,thp_fault_fallback,thp_collapse_alloc," \
+	"numa_hit,numa_miss,numa_foreign,workingset_refault_*,oom_kill"
+trace_file_t *init_proc_vmstat_parser(const char *output_directory, const char *hostname, const char *counters);
+
+/**
+ * Files: /proc/interrupts, /proc/softirqs
+ */
+trace_file_t *init_proc_interrupts_parser(const char *output_directory, const char *hostname, uint32_t max_entities);
+trace_file_t *init_proc_softirqs_parser(const char *output_directory, const char *hostname, uint32_t max_entities);
+
 #endif
@@ -0,0 +1,480 @@
+// fopencookie is a GNU extension
+#define _GNU_SOURCE
+
+#include "recorder.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <memory.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * Ring buffer management
+ */
+typedef struct {
+	nanosec_t time;
+	uint32_t size;
+} chunk_header_t;
+
+static void ring_copy_in(flight_ring_t *ring, size_t offset, const void *source, size_t size) {
+	offset %= ring->capacity;
+	size_t first_part = ring->capacity - offset < size ? ring->capacity - offset : size;
+	memcpy(ring->buffer + offset, source, first_part);
+	memcpy(ring->buffer, (const char *)source + first_part, size - first_part);
+}
+
+static void ring_copy_out(const flight_ring_t *ring, size_t offset, void *destination, size_t size) {
+	offset %= ring->capacity;
+	size_t first_part = ring->capacity - offset < size ? ring->capacity - offset : size;
+	memcpy(destination, ring->buffer + offset, first_part);
+	memcpy((char *)destination + first_part, ring->buffer, size - first_part);
+}
+
+static size_t ring_tail(const flight_ring_t *ring) {
+	return (ring->head + ring->capacity - ring->used) % ring->capacity;
+}
+
+// Records start with a u64 timestamp followed by their msgtype, which is 0 for list records
+static bool is_list_chunk(const char *records, size_t size) {
+	return size > sizeof(nanosec_t) && records[sizeof(nanosec_t)] == 0;
+}
+
+static bool ring_chunk_is_list(const flight_ring_t *ring, size_t offset, const chunk_header_t *header) {
+	char msgtype = 1;
+	if (ring->has_list_records && header->size > sizeof(nanosec_t)) {
+		ring_copy_out(ring, offset + sizeof(chunk_header_t) + sizeof(nanosec_t), &msgtype, 1);
+	}
+	return msgtype == 0;
+}
+
+static void ring_evict_oldest(flight_ring_t *ring) {
+	chunk_header_t header;
+	size_t offset = ring_tail(ring);
+	ring_copy_out(ring, offset, &header, sizeof(header));
+	// The remaining chunks may still require the evicted list records (see recorder.h),
+	// which fit the header as no chunk exceeds the pending capacity
+	if (ring_chunk_is_list(ring, offset, &header)) {
+		ring_copy_out(ring, offset + sizeof(header), ring->header, header.size);
+		ring->header_size = header.size;
+	}
+	ring->used -= sizeof(header) + header.size;
+}
+
+static void ring_drop_pending(flight_ring_t *ring) {
+	// Only the first drop is reported right away, all others when the drops are next reported
+	if (ring->num_dropped == 0) {
+		printf("Flight recorder: records of %s exceed the buffer size, dropping them\n", ring->name);
+	}
+	ring->num_dropped++;
+}
+
+static void report_dropped_chunks(flight_ring_t *ring) {
+	if (ring->num_dropped > 0) {
+		printf("Flight recorder: dropped the records of %llu ticks of %s\n", (unsigned long long)ring->num_dropped, ring->name);
+		ring->num_dropped = 0;
+	}
+}
+
+// Returns whether the records of the current tick are kept, i.e., they fit and can be decoded
+static bool ring_accept_pending(flight_ring_t *ring) {
+	if (ring->pending_overflow) {
+		ring_drop_pending(ring);
+		// Later records cannot be decoded without the dropped list records
+		ring->awaiting_list |= ring->pending_is_list;
+		return false;
+	}
+	if (ring->awaiting_list) {
+		if (!ring->pending_is_list) {
+			if (ring->pending_size > 0) {
+				ring_drop_pending(ring);
+			}
+			return false;
+		}
+		ring->awaiting_list = false;
+	}
+	return true;
+}
+
+static void write_pending_to_dump(flight_ring_t *ring) {
+	if (ring->dump_file != NULL) {
+		fwrite(ring->pending, ring->pending_size, 1, ring->dump_file);
+	}
+}
+
+static void ring_commit(flight_ring_t *ring, nanosec_t time) {
+	if (ring_accept_pending(ring)) {
+		write_pending_to_dump(ring);
+
+		// Chunks never exceed the pending capacity, which is far below the ring's
+		chunk_header_t header = { .time = time, .size = (uint32_t)ring->pending_size };
+		while (ring->capacity - ring->used < sizeof(header) + header.size) {
+			ring_evict_oldest(ring);
+		}
+		ring_copy_in(ring, ring->head, &header, sizeof(header));
+		ring_copy_in(ring, ring->head + sizeof(header), ring->pending, ring->pending_size);
+		ring->head = (ring->head + sizeof(header) + header.size) % ring->capacity;
+		ring->used += sizeof(header) + header.size;
+	}
+	ring->pending_size = 0;
+	ring->pending_overflow = false;
+	ring->pending_is_list = false;
+}
+
+static ssize_t ring_cookie_write(void *cookie, const char *buffer, size_t size) {
+	flight_ring_t *ring = (flight_ring_t *)cookie;
+	if (ring->pending_size == 0 && !ring->pending_overflow) {
+		ring->pending_is_list = ring->has_list_records && is_list_chunk(buffer, size);
+	}
+	if (ring->pending_size + size > ring->pending_capacity) {
+		ring->pending_overflow = true;
+	} else {
+		memcpy(ring->pending + ring->pending_size, buffer, size);
+		ring->pending_size += size;
+	}
+	return (ssize_t)size;
+}
+
+static const cookie_io_functions_t ring_cookie_functions = {
+	.read = NULL,
+	.write = ring_cookie_write,
+	.seek = NULL,
+	.close = NULL
+};
+
+
+/**
+ * Dump logic
+ */
+static void write_chunk_to_dump(flight_ring_t *ring, size_t offset, const chunk_header_t *header) {
+	char copy_buffer[4096];
+	offset += sizeof(chunk_header_t);
+	for (size_t copied = 0; copied < header->size; copied += sizeof(copy_buffer)) {
+		size_t part = header->size - copied < sizeof(copy_buffer) ? header->size - copied : sizeof(copy_buffer);
+		ring_copy_out(ring, offset + copied, copy_buffer, part);
+		fwrite(copy_buffer, part, 1, ring->dump_file);
+	}
+}
+
+static void write_ring_to_dump(flight_ring_t *ring, nanosec_t start_time) {
+	// Find the first chunk at or after start_time, and the last list chunk before it
+	size_t offset = ring_tail(ring);
+	size_t remaining = ring->used;
+	size_t list_offset = 0;
+	chunk_header_t list_header = { .size = 0 };
+	chunk_header_t header;
+	while (remaining > 0) {
+		ring_copy_out(ring, offset, &header, sizeof(header));
+		if (header.time >= start_time) {
+			break;
+		}
+		if (ring_chunk_is_list(ring, offset, &header)) {
+			list_offset = offset;
+			list_header = header;
+		}
+		offset = (offset + sizeof(header) + header.size) % ring->capacity;
+		remaining -= sizeof(header) + header.size;
+	}
+
+	// The dumped chunks can only be decoded following the list records in effect at their start
+	if (list_header.size > 0) {
+		write_chunk_to_dump(ring, list_offset, &list_header);
+	} else if (ring->header_size > 0) {
+		fwrite(ring->header, ring->header_size, 1, ring->dump_file);
+	}
+
+	while (remaining > 0) {
+		ring_copy_out(ring, offset, &header, sizeof(header));
+		write_chunk_to_dump(ring, offset, &header);
+		offset = (offset + sizeof(header) + header.size) % ring->capacity;
+		remaining -= sizeof(header) + header.size;
+	}
+}
+
+void flight_recorder_trigger(flight_recorder_t *recorder, nanosec_t trigger_time, const char *reason) {
+	if (recorder->dump_end_time != 0) {
+		DEBUG_PRINT("flight-recorder: Ignoring trigger (%s) during dump\n", reason);
+		return;
+	}
+
+	char *dump_directory = malloc(strlen(recorder->output_directory) + strlen(recorder->hostname) + 64);
+	sprintf(dump_directory, "%s/flight-recorder-%s-%lld", recorder->output_directory, recorder->hostname,
+			trigger_time / MILLISECONDS);
+	printf("Flight recorder triggered by %s, writing %s\n", reason, dump_directory);
+	if (mkdir(dump_directory, 0755) != 0 && errno != EEXIST) {
+		printf("Failed to create %s, discarding trigger\n", dump_directory);
+		free(dump_directory);
+		return;
+	}
+
+	char *dump_filename = malloc(strlen(dump_directory) + NAME_MAX + 2);
+	for (uint32_t ring_id = 0; ring_id < recorder->num_rings; ring_id++) {
+		flight_ring_t *ring = &recorder->rings[ring_id];
+		sprintf(dump_filename, "%s/%s", dump_directory, ring->name);
+		ring->dump_file = fopen(dump_filename, "wb");
+		if (ring->dump_file != NULL) {
+			write_ring_to_dump(ring, trigger_time - recorder->pre_trigger);
+		}
+		report_dropped_chunks(ring);
+	}
+	free(dump_filename);
+	free(dump_directory);
+
+	// Records of the next post_trigger seconds are appended as they are sampled
+	recorder->dump_end_time = trigger_time + recorder->post_trigger;
+}
+
+static void finish_dump(flight_recorder_t *recorder) {
+	for (uint32_t ring_id = 0; ring_id < recorder->num_rings; ring_id++) {
+		flight_ring_t *ring = &recorder->rings[ring_id];
+		if (ring->dump_file != NULL) {
+			fclose(ring->dump_file);
+			ring->dump_file = NULL;
+		}
+	}
+	recorder->dump_end_time = 0;
+	printf("Flight recorder dump complete\n");
+}
+
+
+/**
+ * Trigger logic
+ */
+static bool init_psi_trigger(flight_trigger_t *trigger) {
+	// Format: psi:<cpu|memory|io>:<some|full>:<stall_us>:<window_us>
+	char resource[16], type[8];
+	unsigned long long stall_us, window_us;
+	if (sscanf(trigger->spec, "psi:%15[a-z]:%7[a-z]:%llu:%llu", resource, type, &stall_us, &window_us) != 4) {
+		return false;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+	trigger->psi_fd = open(path, O_RDWR | O_NONBLOCK);
+	if (trigger->psi_fd < 0) {
+		printf("Failed to open %s, ignoring trigger %s\n", path, trigger->spec);
+		return false;
+	}
+
+	char registration[64];
+	snprintf(registration, sizeof(registration), "%s %llu %llu", type, stall_us, window_us);
+	if (write(trigger->psi_fd, registration, strlen(registration) + 1) < 0) {
+		printf("Failed to register PSI trigger \"%s\" with %s, ignoring trigger %s\n", registration, path, trigger->spec);
+		close(trigger->psi_fd);
+		return false;
+	}
+	return true;
+}
+
+static bool init_threshold_trigger(flight_trigger_t *trigger) {
+	// Format: <path>[:<key>](>|<)<value>, where the key may not contain '/'
+	const char *comparison = strpbrk(trigger->spec, "<>");
+	if (comparison == NULL || comparison == trigger->spec) {
+		return false;
+	}
+	trigger->above = *comparison == '>';
+	char *end_of_threshold;
+	trigger->threshold = strtod(comparison + 1, &end_of_threshold);
+	if (end_of_threshold == comparison + 1) {
+		return false;
+	}
+
+	char *path = strndup(trigger->spec, (size_t)(comparison - trigger->spec));
+	char *last_slash = strrchr(path, '/');
+	char *key_separator = strchr(last_slash != NULL ? last_slash : path, ':');
+	if (key_separator != NULL) {
+		*key_separator = '\0';
+		trigger->key = strdup(key_separator + 1);
+	}
+	bool opened = proc_file_open(&trigger->file, path);
+	if (!opened) {
+		printf("Failed to open %s, ignoring trigger %s\n", path, trigger->spec);
+		proc_file_close(&trigger->file);
+		free((char *)trigger->key);
+	}
+	free(path);
+	return opened;
+}
+
+static bool check_psi_trigger(flight_trigger_t *trigger) {
+	struct pollfd poll_fd = { .fd = trigger->psi_fd, .events = POLLPRI };
+	return poll(&poll_fd, 1, 0) > 0 && (poll_fd.revents & POLLPRI) != 0;
+}
+
+static bool check_threshold_trigger(flight_trigger_t *trigger) {
+	if (!proc_file_read(&trigger->file)) {
+		return false;
+	}
+	const char *value = trigger->file.buffer;
+	if (trigger->key != NULL) {
+		value = strstr(value, trigger->key);
+		if (value == NULL) {
+			return false;
+		}
+		value += strlen(trigger->key);
+	}
+	double current = strtod(value, NULL);
+	bool exceeded = trigger->above ? current > trigger->threshold : current < trigger->threshold;
+
+	// Only fire when the threshold is crossed, not while it stays exceeded
+	bool fire = exceeded && !trigger->exceeded;
+	trigger->exceeded = exceeded;
+	return fire;
+}
+
+static void check_triggers(flight_recorder_t *recorder, nanosec_t sample_time) {
+	for (uint32_t trigger_id = 0; trigger_id < recorder->num_triggers; trigger_id++) {
+		flight_trigger_t *trigger = &recorder->triggers[trigger_id];
+		bool fired = trigger->type == TRIGGER_PSI ? check_psi_trigger(trigger) : check_threshold_trigger(trigger);
+		if (fired) {
+			flight_recorder_trigger(recorder, sample_time, trigger->spec);
+		}
+	}
+}
+
+
+/**
+ * Flight recorder initialization, sampling, and cleanup
+ */
+flight_recorder_t *init_flight_recorder(monitor_options_t *opts) {
+	flight_recorder_t *recorder = calloc(1, sizeof(flight_recorder_t));
+	gethostname(recorder->hostname, sizeof(recorder->hostname));
+	recorder->hostname[sizeof(recorder->hostname) - 1] = '\0';
+	recorder->output_directory = opts->output_directory;
+	recorder->memory_budget = opts->flight_memory;
+	recorder->pre_trigger = opts->flight_pre_trigger;
+	recorder->post_trigger = opts->flight_post_trigger;
+
+	// Modules are initialized with their output in a staging directory, from
+	// which their initial records are moved into the ring buffers
+	recorder->staging_directory = malloc(strlen(opts->output_directory) + strlen(recorder->hostname) + 32);
+	sprintf(recorder->staging_directory, "%s/.flight-recorder-%s", opts->output_directory, recorder->hostname);
+	if (mkdir(recorder->staging_directory, 0755) != 0 && errno != EEXIST) {
+		printf("Failed to create %s, the flight recorder is disabled\n", recorder->staging_directory);
+		free(recorder->staging_directory);
+		free(recorder);
+		return NULL;
+	}
+
+	for (uint32_t trigger_id = 0; trigger_id < opts->num_flight_triggers; trigger_id++) {
+		flight_trigger_t *trigger = &recorder->triggers[recorder->num_triggers];
+		trigger->spec = opts->flight_triggers[trigger_id];
+		trigger->type = strncmp(trigger->spec, "psi:", 4) == 0 ? TRIGGER_PSI : TRIGGER_THRESHOLD;
+		bool valid = trigger->type == TRIGGER_PSI ? init_psi_trigger(trigger) : init_threshold_trigger(trigger);
+		if (valid) {
+			recorder->num_triggers++;
+		} else {
+			printf("Ignoring invalid flight recorder trigger: %s\n", trigger->spec);
+		}
+	}
+
+	return recorder;
+}
+
+void flight_recorder_attach(flight_recorder_t *recorder) {
+	recorder->rings = calloc(recorder->state.trace_file_count, sizeof(flight_ring_t));
+	if (recorder->state.trace_file_count == 0) {
+		rmdir(recorder->staging_directory);
+		return;
+	}
+
+	// Split the memory budget evenly across modules, 3/4 for the ring and
+	// 1/8 each for the pending records and the evicted list records
+	size_t module_budget = recorder->memory_budget / recorder->state.trace_file_count;
+	for (trace_file_t **link = &recorder->state.trace_files; *link != NULL;) {
+		trace_file_t *trace_file = *link;
+
+		// Recover the output file name and the records written during initialization
+		char fd_path[64], output_path[PATH_MAX];
+		snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fileno(trace_file->output_file));
+		ssize_t path_len = readlink(fd_path, output_path, sizeof(output_path) - 1);
+		output_path[path_len > 0 ? path_len : 0] = '\0';
+		const char *name = strrchr(output_path, '/');
+
+		// The initial records contain the first list records, without which no
+		// later records can be decoded, so they have to fit the pending records
+		fflush(trace_file->output_file);
+		struct stat staged_stat;
+		if (fstat(fileno(trace_file->output_file), &staged_stat) == 0 && (size_t)staged_stat.st_size > module_budget / 8) {
+			printf("Flight recorder: initial records of %s (%lld bytes) exceed its buffer size of %zu bytes, not recording it\n",
+					name != NULL ? name + 1 : trace_file->source_file_name, (long long)staged_stat.st_size, module_budget / 8);
+			*link = trace_file->next;
+			recorder->state.trace_file_count--;
+			trace_file->cleanup_callback(trace_file);
+			unlink(output_path);
+			continue;
+		}
+
+		flight_ring_t *ring = &recorder->rings[recorder->num_rings++];
+		ring->name = strdup(name != NULL ? name + 1 : trace_file->source_file_name);
+		ring->has_list_records = trace_file->has_list_records;
+		ring->capacity = module_budget / 4 * 3;
+		ring->pending_capacity = module_budget / 8;
+		ring->buffer = malloc(ring->capacity);
+		ring->pending = malloc(ring->pending_capacity);
+		ring->header = malloc(ring->pending_capacity);
+
+		fclose(trace_file->output_file);
+		FILE *staged_file = fopen(output_path, "rb");
+		if (staged_file != NULL) {
+			ring->pending_size = fread(ring->pending, 1, ring->pending_capacity, staged_file);
+			ring->pending_is_list = ring->has_list_records && is_list_chunk(ring->pending, ring->pending_size);
+			fclose(staged_file);
+		}
+		unlink(output_path);
+
+		// Redirect the module's output into the ring, unbuffered as the module
+		// buffers its records itself
+		trace_file->output_file = fopencookie(ring, "wb", ring_cookie_functions);
+		setvbuf(trace_file->output_file, NULL, _IONBF, 0);
+		ring_commit(ring, get_time());
+		link = &trace_file->next;
+	}
+	rmdir(recorder->staging_directory);
+
+	printf("Flight recorder enabled with %zu bytes of memory for %u modules\n", recorder->memory_budget, recorder->num_rings);
+}
+
+void flight_recorder_tick(flight_recorder_t *recorder, nanosec_t sample_time) {
+	for (uint32_t ring_id = 0; ring_id < recorder->num_rings; ring_id++) {
+		flight_ring_t *ring = &recorder->rings[ring_id];
+		ring_commit(ring, sample_time);
+	}
+
+	if (recorder->dump_end_time != 0 && sample_time >= recorder->dump_end_time) {
+		finish_dump(recorder);
+	}
+	check_triggers(recorder, sample_time);
+}
+
+void flight_recorder_free(flight_recorder_t *recorder) {
+	if (recorder->dump_end_time != 0) {
+		finish_dump(recorder);
+	}
+	for (uint32_t ring_id = 0; ring_id < recorder->num_rings; ring_id++) {
+		flight_ring_t *ring = &recorder->rings[ring_id];
+		report_dropped_chunks(ring);
+		free(ring->name);
+		free(ring->buffer);
+		free(ring->pending);
+		free(ring->header);
+	}
+	free(recorder->rings);
+	for (uint32_t trigger_id = 0; trigger_id < recorder->num_triggers; trigger_id++) {
+		flight_trigger_t *trigger = &recorder->triggers[trigger_id];
+		if (trigger->type == TRIGGER_PSI) {
+			close(trigger->psi_fd);
+		} else {
+			proc_file_close(&trigger->file);
+			free((char *)trigger->key);
+		}
+	}
+	free(recorder->staging_directory);
+	free(recorder);
+}
@@ -0,0 +1,110 @@
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include "monitor.h"
+#include "parse.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * In-memory flight recorder
+ *
+ * A second instance of every enabled module samples at a high rate and writes
+ * its records into a fixed-size ring buffer instead of a file. The records
+ * written by a module in one tick form a chunk, and the oldest chunks are
+ * evicted when the ring is full, so memory use never exceeds the configured
+ * budget. When a trigger fires, the chunks of the last pre_trigger seconds
+ * and all chunks of the next post_trigger seconds are written to a separate
+ * directory, in the same format as the regular output files.
+ *
+ * List records (msgtype 0 of modules with has_list_records) are required to
+ * decode the records following them. The most recent chunk starting with a
+ * list record that was evicted from the ring is kept aside. A dump starts with
+ * the list chunk in effect at the start of the dumped window, taken from the
+ * ring if it is still there, or else from the chunk kept aside.
+ *
+ * A module's budget is split into 3/4 for the ring and 1/8 each for the
+ * records of the current tick and the chunk kept aside, none of which grow.
+ * Modules whose initial list records exceed 1/8 are not recorded. Chunks that
+ * exceed it are dropped and counted, and if a list chunk is dropped, so are
+ * all chunks up to the next list chunk, as they cannot be decoded.
+ */
+typedef struct {
+	char *name;
+	FILE *dump_file;
+	// Ring of chunks, each a (nanosec_t time, uint32_t size) header followed by the chunk's records
+	char *buffer;
+	size_t capacity;
+	size_t head;
+	size_t used;
+	bool has_list_records;
+	// Records written during the current tick, dropped if they exceed the capacity
+	char *pending;
+	size_t pending_size;
+	size_t pending_capacity;
+	bool pending_overflow;
+	bool pending_is_list;
+	// Set when a list chunk was dropped, until the next list chunk
+	bool awaiting_list;
+	// Number of chunks dropped since the last report
+	uint64_t num_dropped;
+	// Most recent chunk starting with a list record that is no longer in the ring,
+	// with the same capacity as the pending records
+	char *header;
+	size_t header_size;
+} flight_ring_t;
+
+typedef enum {
+	TRIGGER_PSI,
+	TRIGGER_THRESHOLD
+} flight_trigger_type;
+
+typedef struct {
+	flight_trigger_type type;
+	const char *spec;
+	// PSI triggers: fd of /proc/pressure/<resource> with a registered trigger
+	int psi_fd;
+	// Threshold triggers: value following key in file compared to threshold
+	proc_file_t file;
+	const char *key;
+	bool above;
+	double threshold;
+	bool exceeded;
+} flight_trigger_t;
+
+typedef struct {
+	monitor_state_t state;
+	char hostname[256];
+	const char *output_directory;
+	char *staging_directory;
+	flight_ring_t *rings;
+	uint32_t num_rings;
+	size_t memory_budget;
+	nanosec_t pre_trigger;
+	nanosec_t post_trigger;
+	flight_trigger_t triggers[MAX_FLIGHT_TRIGGERS];
+	uint32_t num_triggers;
+	// End of the post-trigger capture, or 0 if no dump is in progress
+	nanosec_t dump_end_time;
+} flight_recorder_t;
+
+/**
+ * Create a flight recorder and the staging directory its modules must be
+ * initialized in (i.e., their output_directory), followed by a call to
+ * flight_recorder_attach to move their output into ring buffers
+ */
+flight_recorder_t *init_flight_recorder(monitor_options_t *opts);
+void flight_recorder_attach(flight_recorder_t *recorder);
+
+/**
+ * Commit the records written by all modules since the last tick and check
+ * the triggers, must be called after each high-rate sample
+ */
+void flight_recorder_tick(flight_recorder_t *recorder, nanosec_t sample_time);
+void flight_recorder_trigger(flight_recorder_t *recorder, nanosec_t trigger_time, const char *reason);
+
+void flight_recorder_free(flight_recorder_t *recorder);
+
+#endif
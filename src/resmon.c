@@ -0,0 +1,228 @@
+// fopencookie is a GNU extension
+#define _GNU_SOURCE
+
+#include "resmon.h"
+
+#include "monitor.h"
+#include "netlink.h"
+#include "procfs.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+struct resmon_sampler {
+	// Trace file of each module, NULL if the module is not sampled
+	trace_file_t *modules[RESMON_NUM_MODULES];
+};
+
+
+/**
+ * Discarding module output
+ */
+static ssize_t discard_cookie_write(void *cookie, const char *buffer, size_t size) {
+	return (ssize_t)size;
+}
+
+static const cookie_io_functions_t discard_cookie_functions = {
+	.read = NULL,
+	.write = discard_cookie_write,
+	.seek = NULL,
+	.close = NULL
+};
+
+static void discard_output(trace_file_t *trace_file) {
+	// Remove the file written during initialization
+	char fd_path[64], output_path[PATH_MAX];
+	snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fileno(trace_file->output_file));
+	ssize_t path_len = readlink(fd_path, output_path, sizeof(output_path) - 1);
+	fclose(trace_file->output_file);
+	if (path_len > 0) {
+		output_path[path_len] = '\0';
+		unlink(output_path);
+	}
+
+	// Unbuffered, so that records are dropped without being copied
+	trace_file->output_file = fopencookie(NULL, "wb", discard_cookie_functions);
+	setvbuf(trace_file->output_file, NULL, _IONBF, 0);
+}
+
+
+/**
+ * Sampler initialization and cleanup
+ */
+static trace_file_t *init_module(const resmon_config_t *config, resmon_module_t module, const char *output_directory,
+		const char *hostname) {
+	switch (module) {
+		case RESMON_CPU:
+			return init_proc_stat_parser(output_directory, hostname, ENCODING_VARINT, false, config->max_entities);
+		case RESMON_MEMORY:
+			return init_proc_meminfo_parser(output_directory, hostname);
+		case RESMON_VMSTAT:
+			return init_proc_vmstat_parser(output_directory, hostname,
+					config->vmstat_counters != NULL ? config->vmstat_counters : DEFAULT_VMSTAT_COUNTERS);
+		case RESMON_NETWORK:
+			if (config->network_netlink) {
+				trace_file_t *trace_file = init_rtnl_link_parser(output_directory, hostname, ENCODING_VARINT,
+						config->max_entities);
+				if (trace_file != NULL) {
+					return trace_file;
+				}
+			}
+			return init_proc_net_dev_parser(output_directory, hostname, ENCODING_VARINT, config->max_entities);
+		case RESMON_SNMP:
+			return init_proc_net_snmp_parser(output_directory, hostname,
+					config->snmp_counters != NULL ? config->snmp_counters : DEFAULT_SNMP_COUNTERS);
+		case RESMON_DISK:
+			return init_proc_diskstats_parser(output_directory, hostname, ENCODING_VARINT, false, config->max_entities);
+		default:
+			return NULL;
+	}
+}
+
+resmon_sampler_t *resmon_sampler_create(const resmon_config_t *config) {
+	char hostname[256];
+	gethostname(hostname, sizeof(hostname));
+	hostname[255] = '\0';
+
+	// Without an output directory, modules are initialized in a temporary
+	// directory and their output is discarded afterwards
+	char staging_directory[] = "/tmp/.resmon-XXXXXX";
+	const char *output_directory = config->output_directory;
+	if (output_directory == NULL) {
+		if (mkdtemp(staging_directory) == NULL) {
+			printf("libresmon: Failed to create %s: %s\n", staging_directory, strerror(errno));
+			return NULL;
+		}
+		output_directory = staging_directory;
+	}
+
+	resmon_sampler_t *sampler = calloc(1, sizeof(resmon_sampler_t));
+	bool failed = false;
+	for (uint32_t module = 0; module < RESMON_NUM_MODULES; module++) {
+		if ((config->modules & RESMON_MODULE_BIT(module)) == 0) {
+			continue;
+		}
+		trace_file_t *trace_file = init_module(config, (resmon_module_t)module, output_directory, hostname);
+		if (trace_file == NULL || trace_file->output_file == NULL) {
+			printf("libresmon: Failed to initialize module %u\n", module);
+			if (trace_file != NULL) {
+				// Cleanup callbacks close the output file
+				trace_file->output_file = fopencookie(NULL, "wb", discard_cookie_functions);
+				trace_file->cleanup_callback(trace_file);
+			}
+			failed = true;
+			continue;
+		}
+		if (config->output_directory == NULL) {
+			discard_output(trace_file);
+		}
+		sampler->modules[module] = trace_file;
+	}
+	if (config->output_directory == NULL) {
+		rmdir(staging_directory);
+	}
+	if (failed) {
+		resmon_sampler_free(sampler);
+		return NULL;
+	}
+
+	resmon_sample(sampler);
+	return sampler;
+}
+
+void resmon_sampler_free(resmon_sampler_t *sampler) {
+	if (sampler == NULL) {
+		return;
+	}
+	for (uint32_t module = 0; module < RESMON_NUM_MODULES; module++) {
+		if (sampler->modules[module] != NULL) {
+			sampler->modules[module]->cleanup_callback(sampler->modules[module]);
+		}
+	}
+	free(sampler);
+}
+
+
+/**
+ * Sampling and reading
+ */
+int64_t resmon_sample(resmon_sampler_t *sampler) {
+	nanosec_t sample_time = get_time();
+	for (uint32_t module = 0; module < RESMON_NUM_MODULES; module++) {
+		if (sampler->modules[module] != NULL) {
+			sampler->modules[module]->parse_callback(sampler->modules[module]);
+		}
+	}
+	return sample_time;
+}
+
+int64_t resmon_read(const resmon_sampler_t *sampler, resmon_module_t module, int64_t *values, size_t capacity,
+		uint32_t *num_entities, uint32_t *num_fields) {
+	*num_entities = 0;
+	*num_fields = 0;
+	if (module >= RESMON_NUM_MODULES || sampler->modules[module] == NULL) {
+		return 0;
+	}
+
+	const trace_file_t *trace_file = sampler->modules[module];
+	trace_file->table->shape(trace_file, num_entities, num_fields);
+	size_t num_values = (size_t)*num_entities * *num_fields;
+	if (num_values > capacity) {
+		return -1;
+	}
+	if (!trace_file->table->read(trace_file, values)) {
+		return 0;
+	}
+	return (int64_t)num_values;
+}
+
+const char *resmon_entity_name(const resmon_sampler_t *sampler, resmon_module_t module, uint32_t entity) {
+	if (module >= RESMON_NUM_MODULES || sampler->modules[module] == NULL) {
+		return NULL;
+	}
+	const trace_file_t *trace_file = sampler->modules[module];
+	uint32_t num_entities, num_fields;
+	trace_file->table->shape(trace_file, &num_entities, &num_fields);
+	if (trace_file->table->entity_name == NULL || entity >= num_entities) {
+		return NULL;
+	}
+	return trace_file->table->entity_name(trace_file, entity);
+}
+
+const char *resmon_field_name(const resmon_sampler_t *sampler, resmon_module_t module, uint32_t field) {
+	if (module >= RESMON_NUM_MODULES || sampler->modules[module] == NULL) {
+		return NULL;
+	}
+	const trace_file_t *trace_file = sampler->modules[module];
+	uint32_t num_entities, num_fields;
+	trace_file->table->shape(trace_file, &num_entities, &num_fields);
+	if (field >= num_fields) {
+		return NULL;
+	}
+	return trace_file->table->field_name(trace_file, field);
+}
+
+void resmon_run(resmon_sampler_t *sampler, int64_t period_ns, resmon_callback_t callback, void *context) {
+	nanosec_t next_sample_time = get_time();
+	for (;;) {
+		struct timespec wake_up = {
+			.tv_sec = next_sample_time / SECONDS,
+			.tv_nsec = next_sample_time % SECONDS
+		};
+		while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &wake_up, NULL) == EINTR);
+
+		nanosec_t sample_time = resmon_sample(sampler);
+		if (!callback(sampler, sample_time, context)) {
+			return;
+		}
+		next_sample_time += period_ns;
+		// Skip the samples that were missed while the callback was running
+		if (next_sample_time < sample_time) {
+			next_sample_time = sample_time;
+		}
+	}
+}
@@ -0,0 +1,301 @@
+
+#include "rollup.h"
+
+#include "varint.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const struct {
+	const char *label;
+	nanosec_t period;
+} rollup_levels[NUM_ROLLUP_LEVELS] = {
+	{ "1s", 1 * SECONDS },
+	{ "10s", 10 * SECONDS },
+	{ "1m", 60 * SECONDS },
+	{ "10m", 600 * SECONDS }
+};
+
+// Windows between consecutive index entries
+#define ROLLUP_INDEX_INTERVAL 64
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	ENTITY_LIST = 0,
+	WINDOW = 1
+} rollup_msgtype;
+
+static void reserve(char **buffer, size_t *capacity, size_t size) {
+	if (size > *capacity) {
+		*capacity = size > 2 * *capacity ? size : 2 * *capacity;
+		*buffer = realloc(*buffer, *capacity);
+	}
+}
+
+static void write_name(const char *name, char **buffer_ptr) {
+	// Numbered entities have no name
+	if (name == NULL) {
+		name = "";
+	}
+	size_t name_len = strlen(name);
+	memcpy(*buffer_ptr, name, name_len + 1);
+	*buffer_ptr += name_len + 1;
+}
+
+/**
+ * Encode the entity and field names of the given shape into the scratch
+ * record, without the timestamp and message type
+ */
+static size_t encode_entity_list(rollup_module_t *module, uint32_t num_entities, uint32_t num_fields) {
+	const trace_file_t *trace_file = module->trace_file;
+	size_t size = 2 * VAR_UINT32_MAX_SIZE;
+	for (uint32_t entity = 0; entity < num_entities; entity++) {
+		const char *name = trace_file->table->entity_name != NULL ? trace_file->table->entity_name(trace_file, entity) : NULL;
+		size += (name != NULL ? strlen(name) : 0) + 1;
+	}
+	for (uint32_t field = 0; field < num_fields; field++) {
+		size += strlen(trace_file->table->field_name(trace_file, field)) + 1;
+	}
+	if (size > module->record_capacity) {
+		reserve(&module->list_record, &module->record_capacity, size);
+		module->scratch_record = realloc(module->scratch_record, module->record_capacity);
+	}
+
+	char *buffer_ptr = module->scratch_record;
+	write_var_uint32_t(num_entities, &buffer_ptr);
+	write_var_uint32_t(num_fields, &buffer_ptr);
+	for (uint32_t entity = 0; entity < num_entities; entity++) {
+		write_name(trace_file->table->entity_name != NULL ? trace_file->table->entity_name(trace_file, entity) : NULL,
+				&buffer_ptr);
+	}
+	for (uint32_t field = 0; field < num_fields; field++) {
+		write_name(trace_file->table->field_name(trace_file, field), &buffer_ptr);
+	}
+	return (size_t)(buffer_ptr - module->scratch_record);
+}
+
+static void write_entity_list(rollup_module_t *module, rollup_level_t *level, nanosec_t timestamp) {
+	char header[sizeof(nanosec_t) + 1];
+	*(nanosec_t *)header = timestamp;
+	header[sizeof(nanosec_t)] = (char)ENTITY_LIST;
+
+	DEBUG_PRINT("rollup: Writing %s entity list with %u entities and %u fields\n",
+			module->trace_file->table->name, module->num_entities, module->num_fields);
+	level->list_offset = (uint64_t)ftell(level->output_file);
+	fwrite(header, sizeof(header), 1, level->output_file);
+	fwrite(module->list_record, module->list_record_size, 1, level->output_file);
+	// Index the first window after every entity list
+	level->windows_since_index = ROLLUP_INDEX_INTERVAL;
+}
+
+static void write_window(rollup_module_t *module, rollup_level_t *level) {
+	size_t num_values = (size_t)module->num_entities * module->num_fields;
+	reserve(&module->write_buffer, &module->write_buffer_capacity,
+			sizeof(nanosec_t) + 1 + VAR_UINT32_MAX_SIZE + 3 * num_values * VAR_UINT64_MAX_SIZE);
+	char *buffer_ptr = module->write_buffer;
+
+	DEBUG_PRINT("rollup: Writing %s window at %llu with %u samples\n", module->trace_file->table->name,
+			level->window_start, level->num_samples);
+	*(nanosec_t *)buffer_ptr = level->window_start;
+	buffer_ptr += sizeof(nanosec_t);
+	*buffer_ptr = (char)WINDOW;
+	buffer_ptr++;
+	write_var_uint32_t(level->num_samples, &buffer_ptr);
+	for (size_t value = 0; value < num_values; value++) {
+		write_var_int64_t(level->sums[value], &buffer_ptr);
+		write_var_int64_t(level->minimums[value], &buffer_ptr);
+		write_var_int64_t(level->maximums[value], &buffer_ptr);
+	}
+
+	uint64_t window_offset = (uint64_t)ftell(level->output_file);
+	fwrite(module->write_buffer, (size_t)(buffer_ptr - module->write_buffer), 1, level->output_file);
+
+	if (level->windows_since_index >= ROLLUP_INDEX_INTERVAL) {
+		uint64_t index_entry[3] = { (uint64_t)level->window_start, window_offset, level->list_offset };
+		fwrite(index_entry, sizeof(index_entry), 1, level->index_file);
+		level->windows_since_index = 0;
+	}
+	level->windows_since_index++;
+	level->num_samples = 0;
+	level->window_start = 0;
+}
+
+
+/**
+ * Aggregation logic
+ */
+static void reshape_module(rollup_module_t *module, uint32_t num_entities, uint32_t num_fields, size_t list_size,
+		nanosec_t sample_time) {
+	// Windows of the previous shape end early
+	for (uint32_t level_id = 0; level_id < NUM_ROLLUP_LEVELS; level_id++) {
+		if (module->levels[level_id].num_samples > 0) {
+			write_window(module, &module->levels[level_id]);
+		}
+	}
+	module->num_entities = num_entities;
+	module->num_fields = num_fields;
+
+	char *tmp = module->list_record;
+	module->list_record = module->scratch_record;
+	module->scratch_record = tmp;
+	module->list_record_size = list_size;
+
+	size_t num_values = (size_t)module->num_entities * module->num_fields;
+	for (uint32_t level_id = 0; level_id < NUM_ROLLUP_LEVELS; level_id++) {
+		rollup_level_t *level = &module->levels[level_id];
+		level->sums = realloc(level->sums, num_values * sizeof(int64_t));
+		level->minimums = realloc(level->minimums, num_values * sizeof(int64_t));
+		level->maximums = realloc(level->maximums, num_values * sizeof(int64_t));
+		write_entity_list(module, level, sample_time);
+	}
+}
+
+static void add_sample(rollup_module_t *module, rollup_level_t *level, nanosec_t sample_time) {
+	nanosec_t window_start = sample_time - sample_time % level->period;
+	if (level->num_samples > 0 && window_start != level->window_start) {
+		write_window(module, level);
+	}
+
+	size_t num_values = (size_t)module->num_entities * module->num_fields;
+	const int64_t *values = module->values;
+	if (level->num_samples == 0) {
+		level->window_start = window_start;
+		memcpy(level->sums, values, num_values * sizeof(int64_t));
+		memcpy(level->minimums, values, num_values * sizeof(int64_t));
+		memcpy(level->maximums, values, num_values * sizeof(int64_t));
+	} else {
+		for (size_t value = 0; value < num_values; value++) {
+			level->sums[value] += values[value];
+			level->minimums[value] = values[value] < level->minimums[value] ? values[value] : level->minimums[value];
+			level->maximums[value] = values[value] > level->maximums[value] ? values[value] : level->maximums[value];
+		}
+	}
+	level->num_samples++;
+}
+
+void rollup_update(rollup_set_t *rollups, nanosec_t sample_time) {
+	for (uint32_t module_id = 0; module_id < rollups->num_modules; module_id++) {
+		rollup_module_t *module = &rollups->modules[module_id];
+		const trace_file_t *trace_file = module->trace_file;
+		uint32_t num_entities, num_fields;
+		trace_file->table->shape(trace_file, &num_entities, &num_fields);
+		size_t num_values = (size_t)num_entities * num_fields;
+		if (num_values > module->values_capacity) {
+			module->values_capacity = num_values;
+			module->values = realloc(module->values, num_values * sizeof(int64_t));
+		}
+		// Samples holding totals instead of deltas (i.e., after the entities changed) are skipped
+		if (!trace_file->table->read(trace_file, module->values)) {
+			continue;
+		}
+
+		size_t list_size = encode_entity_list(module, num_entities, num_fields);
+		if (list_size != module->list_record_size || memcmp(module->scratch_record, module->list_record, list_size) != 0) {
+			reshape_module(module, num_entities, num_fields, list_size, sample_time);
+		}
+
+		for (uint32_t level_id = 0; level_id < NUM_ROLLUP_LEVELS; level_id++) {
+			add_sample(module, &module->levels[level_id], sample_time);
+		}
+	}
+}
+
+
+/**
+ * Rollup initialization and cleanup
+ */
+static FILE *open_rollup_file(const char *output_directory, const char *label, const char *name, const char *hostname,
+		const char *suffix) {
+	char *output_filename = malloc(strlen(output_directory) + strlen(label) + strlen(name) + strlen(hostname) +
+			strlen(suffix) + 16);
+	sprintf(output_filename, "%s/rollup-%s-%s-%s%s", output_directory, label, name, hostname, suffix);
+	FILE *output_file = fopen(output_filename, "wb");
+	if (output_file == NULL) {
+		printf("Failed to create rollup file %s\n", output_filename);
+	}
+	free(output_filename);
+	return output_file;
+}
+
+rollup_set_t *init_rollups(const char *output_directory, monitor_state_t *state) {
+	char hostname[256];
+	gethostname(hostname, sizeof(hostname));
+	hostname[255] = '\0';
+
+	uint32_t num_modules = 0;
+	for (trace_file_t *trace_file = state->trace_files; trace_file != NULL; trace_file = trace_file->next) {
+		if (trace_file->table != NULL) {
+			num_modules++;
+		}
+	}
+	if (num_modules == 0) {
+		return NULL;
+	}
+
+	rollup_set_t *rollups = calloc(1, sizeof(rollup_set_t));
+	rollups->modules = calloc(num_modules, sizeof(rollup_module_t));
+	for (trace_file_t *trace_file = state->trace_files; trace_file != NULL; trace_file = trace_file->next) {
+		if (trace_file->table == NULL) {
+			continue;
+		}
+		rollup_module_t *module = &rollups->modules[rollups->num_modules];
+		bool opened = true;
+		for (uint32_t level_id = 0; level_id < NUM_ROLLUP_LEVELS; level_id++) {
+			rollup_level_t *level = &module->levels[level_id];
+			level->period = rollup_levels[level_id].period;
+			level->output_file = open_rollup_file(output_directory, rollup_levels[level_id].label,
+					trace_file->table->name, hostname, "");
+			level->index_file = open_rollup_file(output_directory, rollup_levels[level_id].label,
+					trace_file->table->name, hostname, ".index");
+			opened = opened && level->output_file != NULL && level->index_file != NULL;
+		}
+		module->trace_file = trace_file;
+		rollups->num_modules++;
+		if (!opened) {
+			rollup_free(rollups);
+			return NULL;
+		}
+	}
+	return rollups;
+}
+
+void rollup_flush(rollup_set_t *rollups) {
+	for (uint32_t module_id = 0; module_id < rollups->num_modules; module_id++) {
+		for (uint32_t level_id = 0; level_id < NUM_ROLLUP_LEVELS; level_id++) {
+			fflush(rollups->modules[module_id].levels[level_id].output_file);
+			fflush(rollups->modules[module_id].levels[level_id].index_file);
+		}
+	}
+}
+
+void rollup_free(rollup_set_t *rollups) {
+	for (uint32_t module_id = 0; module_id < rollups->num_modules; module_id++) {
+		rollup_module_t *module = &rollups->modules[module_id];
+		for (uint32_t level_id = 0; level_id < NUM_ROLLUP_LEVELS; level_id++) {
+			rollup_level_t *level = &module->levels[level_id];
+			if (level->num_samples > 0) {
+				write_window(module, level);
+			}
+			if (level->output_file != NULL) {
+				fclose(level->output_file);
+			}
+			if (level->index_file != NULL) {
+				fclose(level->index_file);
+			}
+			free(level->sums);
+			free(level->minimums);
+			free(level->maximums);
+		}
+		free(module->values);
+		free(module->list_record);
+		free(module->scratch_record);
+		free(module->write_buffer);
+	}
+	free(rollups->modules);
+	free(rollups);
+}
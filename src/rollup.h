@@ -0,0 +1,79 @@
+
+#ifndef __ROLLUP_H__
+#define __ROLLUP_H__
+
+#include "monitor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Multi-resolution rollups
+ *
+ * Alongside the raw traces, the values of every module with a trace_table_t
+ * are aggregated into windows of 1 s, 10 s, 1 min, and 10 min, aligned to
+ * multiples of the window length. Each window stores the number of samples
+ * and the sum, minimum, and maximum of every value, so that queries over long
+ * traces at a coarse zoom level read a small rollup file instead of decoding
+ * all raw samples. Each rollup file has a sparse index of window offsets.
+ */
+#define NUM_ROLLUP_LEVELS 4
+
+typedef struct {
+	nanosec_t period;
+	FILE *output_file;
+	FILE *index_file;
+	// Start of the open window, or 0 if no window is open
+	nanosec_t window_start;
+	uint32_t num_samples;
+	int64_t *sums;
+	int64_t *minimums;
+	int64_t *maximums;
+	// Offset of the last entity list record and number of windows since the last index entry
+	uint64_t list_offset;
+	uint32_t windows_since_index;
+} rollup_level_t;
+
+typedef struct {
+	trace_file_t *trace_file;
+	// Shape of the open windows
+	uint32_t num_entities;
+	uint32_t num_fields;
+	// Values of the current sample
+	int64_t *values;
+	size_t values_capacity;
+	// Entity list record of the current shape, and a scratch copy to detect changes
+	char *list_record;
+	size_t list_record_size;
+	char *scratch_record;
+	size_t record_capacity;
+	// Encoded window records
+	char *write_buffer;
+	size_t write_buffer_capacity;
+	rollup_level_t levels[NUM_ROLLUP_LEVELS];
+} rollup_module_t;
+
+typedef struct {
+	rollup_module_t *modules;
+	uint32_t num_modules;
+} rollup_set_t;
+
+/**
+ * Create the rollup files of all modules of a monitor state that provide a
+ * trace_table_t, or return NULL if there are none
+ */
+rollup_set_t *init_rollups(const char *output_directory, monitor_state_t *state);
+
+/**
+ * Add the values of the modules' last sample, after all modules were sampled
+ */
+void rollup_update(rollup_set_t *rollups, nanosec_t sample_time);
+void rollup_flush(rollup_set_t *rollups);
+
+/**
+ * Write the open windows and close all files, must be called before the
+ * cleanup of the modules
+ */
+void rollup_free(rollup_set_t *rollups);
+
+#endif
@@ -0,0 +1,494 @@
+
+#include "bitpack.h"
+#include "columns.h"
+#include "intern.h"
+#include "netlink.h"
+#include "varint.h"
+
+#include <errno.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/**
+ * Module data
+ */
+typedef enum {
+	RECV_BYTES = 0,
+	RECV_PACKETS,
+	SEND_BYTES,
+	SEND_PACKETS,
+	RECV_ERRORS,
+	SEND_ERRORS,
+	RECV_DROPPED,
+	SEND_DROPPED,
+	MULTICAST,
+	RTNL_LINK_FIELDS
+} rtnl_link_field;
+
+typedef struct {
+	int socket_fd;
+	uint32_t sequence_number;
+	// Dump responses, grown when the kernel sends a larger message
+	char *receive_buffer;
+	size_t receive_buffer_size;
+	uint32_t num_ifaces;
+	metric_encoding_t encoding;
+	interner_t iface_names;
+	// Interface index of each interface, in dump order
+	int *iface_indices;
+	uint32_t iface_capacity;
+	// Set when a dumped interface does not match the cached interface list
+	bool ifaces_changed;
+	// Per-interface counters, one column per field
+	metric_columns_t previous_metrics;
+	metric_columns_t current_metrics;
+	// Whether the previous sample covers the current entities, and whether the last sample holds deltas
+	bool have_previous_metrics;
+	bool have_deltas;
+} rtnl_link_data;
+
+static void resize_data_buffers(rtnl_link_data *data, uint32_t num_ifaces) {
+	metric_columns_resize(&data->previous_metrics, num_ifaces);
+	metric_columns_resize(&data->current_metrics, num_ifaces);
+	// Keep room for as many interfaces as the (possibly preallocated) columns
+	if (data->current_metrics.capacity > data->iface_capacity) {
+		data->iface_capacity = data->current_metrics.capacity;
+		data->iface_indices = realloc(data->iface_indices, sizeof(int) * data->iface_capacity);
+	}
+	data->num_ifaces = num_ifaces;
+	data->have_previous_metrics = false;
+}
+
+static void cleanup_data_buffers(rtnl_link_data *data) {
+	close(data->socket_fd);
+	free(data->receive_buffer);
+	interner_free(&data->iface_names);
+	free(data->iface_indices);
+	metric_columns_free(&data->previous_metrics);
+	metric_columns_free(&data->current_metrics);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	IFACE_LIST = 0,
+	METRICS = 1,
+	METRICS_PACKED = 2
+} rtnl_link_msgtype;
+
+static void write_iface_list(trace_file_t *trace_file, nanosec_t timestamp, rtnl_link_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("rtnl-link: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("rtnl-link: Writing message type: %u\n", IFACE_LIST & 0xFF);
+	*buffer_ptr = (char)IFACE_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("rtnl-link: Writing num interfaces: %u\n", data->num_ifaces);
+	write_var_uint32_t(data->num_ifaces, &buffer_ptr);
+
+	for (uint32_t iface_id = 0; iface_id < data->num_ifaces; iface_id++) {
+		const char *iface_name = interner_name(&data->iface_names, iface_id);
+		uint32_t iface_name_len = interner_name_length(&data->iface_names, iface_id);
+		DEBUG_PRINT("rtnl-link: Writing interface name: %s\n", iface_name);
+		if ((size_t)(end_of_buffer - buffer_ptr) < iface_name_len + 1) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		memcpy(buffer_ptr, iface_name, iface_name_len + 1);
+		buffer_ptr += iface_name_len + 1;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, rtnl_link_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("rtnl-link: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("rtnl-link: Writing message type: %u\n", METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("rtnl-link: Writing num interfaces: %u\n", data->num_ifaces);
+	write_var_uint32_t(data->num_ifaces, &buffer_ptr);
+
+	// Encode as many interfaces at once as fit in the remaining buffer space
+	uint32_t iface_id = 0;
+	while (iface_id < data->num_ifaces) {
+		uint32_t batch_size = (size_t)(end_of_buffer - buffer_ptr) /
+			(RTNL_LINK_FIELDS * VAR_UINT64_MAX_SIZE);
+		if (batch_size == 0) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+			continue;
+		}
+		if (batch_size > data->num_ifaces - iface_id) {
+			batch_size = data->num_ifaces - iface_id;
+		}
+
+		DEBUG_PRINT("rtnl-link: Writing interfaces %u-%u\n", iface_id, iface_id + batch_size - 1);
+		write_var_uint64_columns(deltas, iface_id, batch_size, &buffer_ptr);
+		iface_id += batch_size;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_packed_metrics(trace_file_t *trace_file, nanosec_t timestamp, rtnl_link_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("rtnl-link: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("rtnl-link: Writing message type: %u\n", METRICS_PACKED & 0xFF);
+	*buffer_ptr = (char)METRICS_PACKED;
+	buffer_ptr++;
+
+	DEBUG_PRINT("rtnl-link: Writing num interfaces: %u\n", data->num_ifaces);
+	write_var_uint32_t(data->num_ifaces, &buffer_ptr);
+
+	// Pack each field of (up to PACKED_GROUP_MAX_VALUES) interfaces as one group
+	for (uint32_t field = 0; field < RTNL_LINK_FIELDS; field++) {
+		const uint64_t *column = metric_column(deltas, field);
+		for (uint32_t iface_id = 0; iface_id < data->num_ifaces; iface_id += PACKED_GROUP_MAX_VALUES) {
+			uint32_t group_size = data->num_ifaces - iface_id;
+			if (group_size > PACKED_GROUP_MAX_VALUES) {
+				group_size = PACKED_GROUP_MAX_VALUES;
+			}
+			if ((size_t)(end_of_buffer - buffer_ptr) < PACKED_GROUP_MAX_SIZE(group_size)) {
+				fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+				buffer_ptr = trace_file->write_buffer;
+			}
+
+			DEBUG_PRINT("rtnl-link: Writing field %u of interfaces %u-%u\n", field, iface_id, iface_id + group_size - 1);
+			write_packed_uint64_group(column + iface_id, group_size, &buffer_ptr);
+		}
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * RTM_GETLINK dump logic
+ */
+// Large enough for the biggest multi-part message the kernel usually sends for a dump
+#define RECEIVE_BUFFER_SIZE (32 * 1024)
+
+typedef struct {
+	int iface_index;
+	const char *iface_name;
+	uint32_t iface_name_len;
+	// Zero when the attribute is missing, and zero-padded when the kernel sends fewer counters
+	struct rtnl_link_stats64 stats;
+} rtnl_link_info;
+
+// Returns false to ignore the remainder of the dump
+typedef bool (*rtnl_link_handler)(rtnl_link_data *data, uint32_t position, const rtnl_link_info *link);
+
+static bool request_link_dump(rtnl_link_data *data) {
+	struct {
+		struct nlmsghdr header;
+		struct ifinfomsg info;
+	} request = {
+		.header = {
+			.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+			.nlmsg_type = RTM_GETLINK,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+			.nlmsg_seq = ++data->sequence_number
+		},
+		.info = { .ifi_family = AF_UNSPEC }
+	};
+	return send(data->socket_fd, &request, request.header.nlmsg_len, 0) >= 0;
+}
+
+/**
+ * Dump all links and call handler for each, returns the number of links or -1 on error
+ */
+static int64_t dump_links(rtnl_link_data *data, rtnl_link_handler handler) {
+	if (!request_link_dump(data)) {
+		return -1;
+	}
+
+	uint32_t position = 0;
+	bool handling = true;
+	// Set when a message did not fit the receive buffer, the rest of the dump is drained and discarded
+	bool truncated = false;
+	for (;;) {
+		// With MSG_TRUNC, recv returns the full message length even when it does not fit the buffer.
+		// The kernel queues the next part of a dump while recv runs, so once the dump is being
+		// discarded, an empty socket means it is complete.
+		ssize_t received = recv(data->socket_fd, data->receive_buffer, data->receive_buffer_size,
+				MSG_TRUNC | (truncated ? MSG_DONTWAIT : 0));
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (truncated && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				errno = EMSGSIZE;
+			}
+			return -1;
+		}
+		if ((size_t)received > data->receive_buffer_size) {
+			// The links in the lost part of the message would silently disappear, so fail the
+			// whole dump and grow the buffer for the next one
+			printf("rtnl-link: Dump message of %zd bytes exceeds the %zu byte receive buffer\n", received,
+					data->receive_buffer_size);
+			data->receive_buffer_size = ((size_t)received + 4095) & ~(size_t)4095;
+			data->receive_buffer = realloc(data->receive_buffer, data->receive_buffer_size);
+			handling = false;
+			truncated = true;
+			continue;
+		}
+
+		int remaining = (int)received;
+		for (struct nlmsghdr *message = (struct nlmsghdr *)data->receive_buffer; NLMSG_OK(message, remaining);
+				message = NLMSG_NEXT(message, remaining)) {
+			if (message->nlmsg_seq != data->sequence_number) {
+				// Left over from an earlier, interrupted dump
+				continue;
+			}
+			if (message->nlmsg_type == NLMSG_DONE) {
+				if (truncated) {
+					errno = EMSGSIZE;
+					return -1;
+				}
+				return position;
+			}
+			if (message->nlmsg_type == NLMSG_ERROR) {
+				return -1;
+			}
+			if (message->nlmsg_type != RTM_NEWLINK) {
+				continue;
+			}
+
+			struct ifinfomsg *info = NLMSG_DATA(message);
+			rtnl_link_info link = { .iface_index = info->ifi_index };
+			int attributes_length = message->nlmsg_len - NLMSG_LENGTH(sizeof(*info));
+			for (struct rtattr *attribute = IFLA_RTA(info); RTA_OK(attribute, attributes_length);
+					attribute = RTA_NEXT(attribute, attributes_length)) {
+				if (attribute->rta_type == IFLA_IFNAME) {
+					link.iface_name = (const char *)RTA_DATA(attribute);
+					link.iface_name_len = strnlen(link.iface_name, RTA_PAYLOAD(attribute));
+				} else if (attribute->rta_type == IFLA_STATS64) {
+					// The structure grows across kernel versions, so the kernel's copy may be
+					// shorter or longer than this build's. Attribute payloads are only guaranteed
+					// to be 4-byte aligned, so copy instead of pointing into the message.
+					size_t length = RTA_PAYLOAD(attribute);
+					memcpy(&link.stats, RTA_DATA(attribute), length < sizeof(link.stats) ? length : sizeof(link.stats));
+				}
+			}
+			if (link.iface_name == NULL) {
+				continue;
+			}
+
+			// Keep draining the socket after the handler bails out
+			if (handling) {
+				handling = handler(data, position, &link);
+			}
+			position++;
+		}
+	}
+}
+
+static bool record_iface(rtnl_link_data *data, uint32_t position, const rtnl_link_info *link) {
+	if (position >= data->iface_capacity) {
+		data->iface_capacity = data->iface_capacity == 0 ? 16 : 2 * data->iface_capacity;
+		data->iface_indices = realloc(data->iface_indices, sizeof(int) * data->iface_capacity);
+	}
+	data->iface_indices[position] = link->iface_index;
+	interner_append(&data->iface_names, link->iface_name, link->iface_name_len);
+	return true;
+}
+
+static bool store_iface_stats(rtnl_link_data *data, uint32_t position, const rtnl_link_info *link) {
+	// Verify that the interface matches the cached interface at this position
+	if (position >= data->num_ifaces || data->iface_indices[position] != link->iface_index ||
+			link->iface_name_len != interner_name_length(&data->iface_names, position) ||
+			memcmp(link->iface_name, interner_name(&data->iface_names, position), link->iface_name_len) != 0) {
+		data->ifaces_changed = true;
+		return false;
+	}
+
+	const struct rtnl_link_stats64 *stats = &link->stats;
+	metric_column(&data->current_metrics, RECV_BYTES)[position] = stats->rx_bytes;
+	metric_column(&data->current_metrics, RECV_PACKETS)[position] = stats->rx_packets;
+	metric_column(&data->current_metrics, SEND_BYTES)[position] = stats->tx_bytes;
+	metric_column(&data->current_metrics, SEND_PACKETS)[position] = stats->tx_packets;
+	metric_column(&data->current_metrics, RECV_ERRORS)[position] = stats->rx_errors;
+	metric_column(&data->current_metrics, SEND_ERRORS)[position] = stats->tx_errors;
+	metric_column(&data->current_metrics, RECV_DROPPED)[position] = stats->rx_dropped;
+	metric_column(&data->current_metrics, SEND_DROPPED)[position] = stats->tx_dropped;
+	metric_column(&data->current_metrics, MULTICAST)[position] = stats->multicast;
+	return true;
+}
+
+static void enumerate_interfaces(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	rtnl_link_data *data = (rtnl_link_data *)trace_file->data;
+	interner_reset(&data->iface_names);
+	// Interface names are unique, so appending skips the hash table lookup
+	int64_t num_ifaces = dump_links(data, record_iface);
+	if (num_ifaces < 0) {
+		DEBUG_PRINT("rtnl-link: Failed to dump links: %s\n", strerror(errno));
+		interner_reset(&data->iface_names);
+		num_ifaces = 0;
+	}
+
+	// Reallocate data structures for the enumerated interfaces
+	resize_data_buffers(data, (uint32_t)num_ifaces);
+
+
+	// Write the interface list to the output file
+	write_iface_list(trace_file, sample_time, data);
+}
+
+static void parse_rtnl_link(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	rtnl_link_data *data = (rtnl_link_data *)trace_file->data;
+	data->have_deltas = false;
+
+	// Dump all links and store their statistics, as long as the interfaces match the cached list
+	data->ifaces_changed = false;
+	int64_t num_ifaces = dump_links(data, store_iface_stats);
+	if (num_ifaces < 0) {
+		DEBUG_PRINT("rtnl-link: Failed to dump links: %s\n", strerror(errno));
+		return;
+	}
+	if (data->ifaces_changed || (uint32_t)num_ifaces != data->num_ifaces) {
+		// Interfaces were added, removed, or renamed, so re-enumerate all interfaces
+		enumerate_interfaces(trace_file);
+		return;
+	}
+
+	// Let previous = current - previous and write the deltas to the output file
+	metric_columns_delta(&data->previous_metrics, &data->current_metrics);
+	if (data->encoding == ENCODING_PACKED) {
+		write_packed_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	} else {
+		write_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	}
+
+	data->have_deltas = data->have_previous_metrics;
+	data->have_previous_metrics = true;
+
+	// Swap the metric buffers
+	metric_columns_t tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+}
+
+
+/**
+ * Table of the last sample: per-interface deltas
+ */
+static const char *const rtnl_link_field_names[RTNL_LINK_FIELDS] = {
+	"recv_bytes", "recv_packets", "send_bytes", "send_packets",
+	"recv_errors", "send_errors", "recv_dropped", "send_dropped", "multicast"
+};
+
+static void rtnl_link_table_shape(const trace_file_t *trace_file, uint32_t *num_entities, uint32_t *num_fields) {
+	const rtnl_link_data *data = (const rtnl_link_data *)trace_file->data;
+	*num_entities = data->num_ifaces;
+	*num_fields = RTNL_LINK_FIELDS;
+}
+
+static const char *rtnl_link_table_entity_name(const trace_file_t *trace_file, uint32_t entity) {
+	return interner_name(&((const rtnl_link_data *)trace_file->data)->iface_names, entity);
+}
+
+static const char *rtnl_link_table_field_name(const trace_file_t *trace_file, uint32_t field) {
+	return rtnl_link_field_names[field];
+}
+
+static bool rtnl_link_table_read(const trace_file_t *trace_file, int64_t *values) {
+	// The buffers were swapped after writing, so current_metrics holds the deltas
+	const rtnl_link_data *data = (const rtnl_link_data *)trace_file->data;
+	metric_columns_read(&data->current_metrics, values);
+	return data->have_deltas;
+}
+
+static const trace_table_t rtnl_link_table = {
+	.name = "rtnl-link",
+	.shape = rtnl_link_table_shape,
+	.entity_name = rtnl_link_table_entity_name,
+	.field_name = rtnl_link_table_field_name,
+	.read = rtnl_link_table_read
+};
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char rtnl_link_source_name[] = "rtnetlink";
+
+static void cleanup_rtnl_link(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((rtnl_link_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_rtnl_link_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		uint32_t max_entities) {
+	int socket_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (socket_fd < 0) {
+		printf("Failed to create rtnetlink socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	struct sockaddr_nl address = { .nl_family = AF_NETLINK };
+	if (bind(socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		printf("Failed to bind rtnetlink socket: %s\n", strerror(errno));
+		close(socket_fd);
+		return NULL;
+	}
+
+	char *output_filename = malloc(strlen(output_directory) + strlen("/rtnl-link-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/rtnl-link-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_rtnl_link;
+	trace_file->cleanup_callback = cleanup_rtnl_link;
+	trace_file->source_file_name = rtnl_link_source_name;
+	trace_file->has_list_records = true;
+	trace_file->table = &rtnl_link_table;
+	trace_file->data = calloc(1, sizeof(rtnl_link_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	rtnl_link_data *data = (rtnl_link_data *)trace_file->data;
+	data->socket_fd = socket_fd;
+	data->receive_buffer_size = RECEIVE_BUFFER_SIZE;
+	data->receive_buffer = malloc(data->receive_buffer_size);
+	data->encoding = encoding;
+	interner_init(&data->iface_names, max_entities);
+	metric_columns_init(&data->previous_metrics, RTNL_LINK_FIELDS, max_entities);
+	metric_columns_init(&data->current_metrics, RTNL_LINK_FIELDS, max_entities);
+
+	enumerate_interfaces(trace_file);
+
+	return trace_file;
+}
@@ -0,0 +1,84 @@
+
+#include "schedstat.h"
+#include "monitor.h"
+
+#include <memory.h>
+#include <stdio.h>
+
+#define MIN_SCHEDSTAT_VERSION 15
+
+static const char proc_schedstat_filename[] = "/proc/schedstat";
+
+bool schedstat_reader_init(schedstat_reader_t *reader, unsigned int num_cpus, uint32_t max_entities) {
+	metric_columns_init(&reader->previous_cpus, SCHEDSTAT_FIELDS, max_entities);
+	metric_columns_init(&reader->current_cpus, SCHEDSTAT_FIELDS, max_entities);
+	schedstat_reader_resize(reader, num_cpus);
+
+	if (!proc_file_open(&reader->file, proc_schedstat_filename) || !proc_file_read(&reader->file)) {
+		printf("Failed to read %s, no scheduler metrics will be recorded\n", proc_schedstat_filename);
+		return false;
+	}
+
+	// Format of the cpu lines has been stable since version 15
+	const char *ptr = reader->file.buffer;
+	unsigned int version = 0;
+	if (CONSUME_PREFIX(&ptr, "version ")) {
+		version = (unsigned int)parse_uint64(&ptr);
+	}
+	if (version < MIN_SCHEDSTAT_VERSION) {
+		printf("Unsupported %s version %u, no scheduler metrics will be recorded\n", proc_schedstat_filename, version);
+		return false;
+	}
+
+	return true;
+}
+
+void schedstat_reader_resize(schedstat_reader_t *reader, unsigned int num_cpus) {
+	metric_columns_resize(&reader->previous_cpus, num_cpus);
+	metric_columns_resize(&reader->current_cpus, num_cpus);
+}
+
+void schedstat_reader_free(schedstat_reader_t *reader) {
+	proc_file_close(&reader->file);
+	metric_columns_free(&reader->previous_cpus);
+	metric_columns_free(&reader->current_cpus);
+}
+
+void schedstat_read(schedstat_reader_t *reader, unsigned int num_cpus) {
+	uint64_t *running = metric_column(&reader->current_cpus, SCHEDSTAT_RUNNING_NS);
+	uint64_t *waiting = metric_column(&reader->current_cpus, SCHEDSTAT_WAITING_NS);
+	uint64_t *timeslices = metric_column(&reader->current_cpus, SCHEDSTAT_TIMESLICES);
+
+	// CPUs missing from /proc/schedstat (i.e., offline CPUs) keep their previous counters
+	memcpy(reader->current_cpus.values, reader->previous_cpus.values,
+			(size_t)SCHEDSTAT_FIELDS * reader->current_cpus.capacity * sizeof(uint64_t));
+	if (!proc_file_read(&reader->file)) {
+		return;
+	}
+
+	// Format: "version", "timestamp", then for each online CPU a line
+	// "cpuN" followed by 9 values and one "domainN" line per scheduling domain:
+	// yld_count, (unused), sched_count, sched_goidle, ttwu_count, ttwu_local,
+	// running time (ns), waiting time (ns), timeslices
+	const char *ptr = reader->file.buffer;
+	while (*ptr != '\0') {
+		if (CONSUME_PREFIX(&ptr, "cpu")) {
+			unsigned int cpu_id = (unsigned int)parse_uint64(&ptr);
+			if (cpu_id < num_cpus) {
+				for (unsigned int i = 0; i < 6; i++) {
+					parse_uint64(&ptr);
+				}
+				running[cpu_id] = parse_uint64(&ptr);
+				waiting[cpu_id] = parse_uint64(&ptr);
+				timeslices[cpu_id] = parse_uint64(&ptr);
+			}
+		}
+		skip_line(&ptr);
+	}
+}
+
+void schedstat_seed_cpu(schedstat_reader_t *reader, unsigned int cpu_id) {
+	for (unsigned int field = 0; field < SCHEDSTAT_FIELDS; field++) {
+		metric_column(&reader->previous_cpus, field)[cpu_id] = metric_column(&reader->current_cpus, field)[cpu_id];
+	}
+}
@@ -0,0 +1,50 @@
+
+#ifndef __SCHEDSTAT_H__
+#define __SCHEDSTAT_H__
+
+#include "columns.h"
+#include "parse.h"
+
+#include <stdbool.h>
+
+/**
+ * Per-CPU scheduler statistics from /proc/schedstat
+ *
+ * Read as part of the /proc/stat module's tick, so scheduler and CPU
+ * utilization metrics share timestamps and CPU IDs. The file requires a kernel
+ * with CONFIG_SCHEDSTATS. Its running and waiting times and timeslices come
+ * from sched_info (CONFIG_SCHED_INFO, selected by CONFIG_SCHEDSTATS), which
+ * counts them even if the kernel.sched_schedstats sysctl is disabled.
+ */
+typedef enum {
+	SCHEDSTAT_RUNNING_NS = 0,
+	SCHEDSTAT_WAITING_NS,
+	SCHEDSTAT_TIMESLICES,
+	SCHEDSTAT_FIELDS
+} schedstat_field;
+
+typedef struct {
+	proc_file_t file;
+	// Per-CPU counters indexed by CPU ID, one column per field
+	metric_columns_t previous_cpus;
+	metric_columns_t current_cpus;
+} schedstat_reader_t;
+
+/**
+ * Returns false if /proc/schedstat cannot be read or has an unsupported version
+ */
+bool schedstat_reader_init(schedstat_reader_t *reader, unsigned int num_cpus, uint32_t max_entities);
+void schedstat_reader_resize(schedstat_reader_t *reader, unsigned int num_cpus);
+void schedstat_reader_free(schedstat_reader_t *reader);
+
+/**
+ * Read the counters of all online CPUs into current_cpus, offline CPUs keep their previous counters
+ */
+void schedstat_read(schedstat_reader_t *reader, unsigned int num_cpus);
+
+/**
+ * Let the previous counters of a CPU equal its current counters, so that its next delta is zero
+ */
+void schedstat_seed_cpu(schedstat_reader_t *reader, unsigned int cpu_id);
+
+#endif
@@ -0,0 +1,221 @@
+// fopencookie is a GNU extension
+#define _GNU_SOURCE
+
+#include "stream.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	MODULE = 0,
+	TICK = 1
+} stream_msgtype;
+
+// The stream is written in large blocks, one tick at a time
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+static void reserve_tick_buffer(unified_stream_t *stream, size_t size) {
+	if (size > stream->tick_capacity) {
+		stream->tick_capacity = size > 2 * stream->tick_capacity ? size : 2 * stream->tick_capacity;
+		stream->tick_buffer = realloc(stream->tick_buffer, stream->tick_capacity);
+	}
+}
+
+static void write_module(unified_stream_t *stream, uint32_t module_id, const char *records, size_t size) {
+	stream_section_t *section = &stream->sections[module_id];
+	size_t name_len = strlen(section->name);
+	reserve_tick_buffer(stream, 1 + 2 * VAR_UINT32_MAX_SIZE + name_len + 1 + size);
+	char *buffer_ptr = stream->tick_buffer;
+
+	DEBUG_PRINT("stream: Writing message type: %u\n", MODULE & 0xFF);
+	*buffer_ptr = (char)MODULE;
+	buffer_ptr++;
+
+	DEBUG_PRINT("stream: Writing module %u: %s with %zu bytes of initial records\n", module_id, section->name, size);
+	write_var_uint32_t(module_id, &buffer_ptr);
+	memcpy(buffer_ptr, section->name, name_len + 1);
+	buffer_ptr += name_len + 1;
+	write_var_uint32_t((uint32_t)size, &buffer_ptr);
+	memcpy(buffer_ptr, records, size);
+	buffer_ptr += size;
+
+	fwrite(stream->tick_buffer, (size_t)(buffer_ptr - stream->tick_buffer), 1, stream->output_file);
+}
+
+void unified_stream_end_tick(unified_stream_t *stream) {
+	uint32_t num_sections = 0;
+	size_t tick_size = 1 + VAR_UINT64_MAX_SIZE + VAR_UINT32_MAX_SIZE;
+	for (uint32_t module_id = 0; module_id < stream->num_sections; module_id++) {
+		if (stream->sections[module_id].size > 0) {
+			num_sections++;
+			tick_size += 2 * VAR_UINT32_MAX_SIZE + stream->sections[module_id].size;
+		}
+	}
+	if (num_sections == 0) {
+		return;
+	}
+
+	reserve_tick_buffer(stream, tick_size);
+	char *buffer_ptr = stream->tick_buffer;
+
+	DEBUG_PRINT("stream: Writing message type: %u\n", TICK & 0xFF);
+	*buffer_ptr = (char)TICK;
+	buffer_ptr++;
+
+	DEBUG_PRINT("stream: Writing tick timestamp: %llu\n", stream->tick_time);
+	write_var_int64_t(stream->tick_time - stream->previous_tick_time, &buffer_ptr);
+	stream->previous_tick_time = stream->tick_time;
+
+	DEBUG_PRINT("stream: Writing num sections: %u\n", num_sections);
+	write_var_uint32_t(num_sections, &buffer_ptr);
+
+	for (uint32_t module_id = 0; module_id < stream->num_sections; module_id++) {
+		stream_section_t *section = &stream->sections[module_id];
+		if (section->size == 0) {
+			continue;
+		}
+		DEBUG_PRINT("stream: Writing section of module %u: %zu bytes\n", module_id, section->size);
+		write_var_uint32_t(module_id, &buffer_ptr);
+		write_var_uint32_t((uint32_t)section->size, &buffer_ptr);
+		memcpy(buffer_ptr, section->buffer, section->size);
+		buffer_ptr += section->size;
+		section->size = 0;
+	}
+
+	fwrite(stream->tick_buffer, (size_t)(buffer_ptr - stream->tick_buffer), 1, stream->output_file);
+}
+
+
+/**
+ * Module output redirection
+ */
+static ssize_t section_cookie_write(void *cookie, const char *buffer, size_t size) {
+	stream_section_t *section = (stream_section_t *)cookie;
+	if (section->size + size > section->capacity) {
+		section->capacity = section->size + size > 2 * section->capacity ? section->size + size : 2 * section->capacity;
+		section->buffer = realloc(section->buffer, section->capacity);
+	}
+	memcpy(section->buffer + section->size, buffer, size);
+	section->size += size;
+	return (ssize_t)size;
+}
+
+static int section_cookie_close(void *cookie) {
+	// Sections are owned by the stream
+	(void)cookie;
+	return 0;
+}
+
+static const cookie_io_functions_t section_cookie_functions = {
+	.read = NULL,
+	.write = section_cookie_write,
+	.seek = NULL,
+	.close = section_cookie_close
+};
+
+
+/**
+ * Stream initialization and cleanup
+ */
+unified_stream_t *init_unified_stream(const char *output_directory) {
+	unified_stream_t *stream = calloc(1, sizeof(unified_stream_t));
+	gethostname(stream->hostname, sizeof(stream->hostname));
+	stream->hostname[sizeof(stream->hostname) - 1] = '\0';
+
+	char *output_filename = malloc(strlen(output_directory) + strlen("/resource-monitor-") + strlen(stream->hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/resource-monitor-");
+	strcat(output_filename, stream->hostname);
+	stream->output_file = fopen(output_filename, "wb");
+	free(output_filename);
+
+	stream->staging_directory = malloc(strlen(output_directory) + strlen(stream->hostname) + 32);
+	sprintf(stream->staging_directory, "%s/.unified-stream-%s", output_directory, stream->hostname);
+	if (stream->output_file == NULL || (mkdir(stream->staging_directory, 0755) != 0 && errno != EEXIST)) {
+		printf("Failed to create the unified output stream in %s\n", output_directory);
+		if (stream->output_file != NULL) {
+			fclose(stream->output_file);
+		}
+		free(stream->staging_directory);
+		free(stream);
+		return NULL;
+	}
+	setvbuf(stream->output_file, NULL, _IOFBF, STREAM_BUFFER_SIZE);
+
+	return stream;
+}
+
+void unified_stream_attach(unified_stream_t *stream, monitor_state_t *state) {
+	stream->num_sections = (uint32_t)state->trace_file_count;
+	stream->sections = calloc(stream->num_sections, sizeof(stream_section_t));
+
+	uint32_t module_id = 0;
+	for (trace_file_t *trace_file = state->trace_files; trace_file != NULL; trace_file = trace_file->next) {
+		stream_section_t *section = &stream->sections[module_id];
+
+		// Recover the module name from the output file name, without the hostname
+		char fd_path[64], output_path[PATH_MAX];
+		snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fileno(trace_file->output_file));
+		ssize_t path_len = readlink(fd_path, output_path, sizeof(output_path) - 1);
+		output_path[path_len > 0 ? path_len : 0] = '\0';
+		const char *name = strrchr(output_path, '/');
+		section->name = strdup(name != NULL ? name + 1 : trace_file->source_file_name);
+		size_t name_len = strlen(section->name), hostname_len = strlen(stream->hostname);
+		if (name_len > hostname_len + 1 && section->name[name_len - hostname_len - 1] == '-' &&
+				strcmp(section->name + name_len - hostname_len, stream->hostname) == 0) {
+			section->name[name_len - hostname_len - 1] = '\0';
+		}
+
+		// Store the records written during initialization in the module's declaration
+		fclose(trace_file->output_file);
+		FILE *staged_file = fopen(output_path, "rb");
+		if (staged_file != NULL) {
+			char block[4096];
+			size_t block_size;
+			while ((block_size = fread(block, 1, sizeof(block), staged_file)) > 0) {
+				section_cookie_write(section, block, block_size);
+			}
+			fclose(staged_file);
+		}
+		unlink(output_path);
+		write_module(stream, module_id, section->buffer, section->size);
+		section->size = 0;
+
+		// Redirect the module's output into its section, unbuffered as the
+		// module buffers its records itself
+		trace_file->output_file = fopencookie(section, "wb", section_cookie_functions);
+		setvbuf(trace_file->output_file, NULL, _IONBF, 0);
+		trace_file->timestamp_base = &stream->tick_time;
+		module_id++;
+	}
+	rmdir(stream->staging_directory);
+}
+
+void unified_stream_begin_tick(unified_stream_t *stream, nanosec_t tick_time) {
+	stream->tick_time = tick_time;
+}
+
+void unified_stream_free(unified_stream_t *stream) {
+	// Records written during the cleanup of modules
+	unified_stream_end_tick(stream);
+	fclose(stream->output_file);
+
+	for (uint32_t module_id = 0; module_id < stream->num_sections; module_id++) {
+		free(stream->sections[module_id].name);
+		free(stream->sections[module_id].buffer);
+	}
+	free(stream->sections);
+	free(stream->tick_buffer);
+	free(stream->staging_directory);
+	free(stream);
+}
@@ -0,0 +1,67 @@
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "monitor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Unified output stream
+ *
+ * Instead of one file per module, the records of all modules are written to
+ * a single file per host. Every tick starts with a header holding the tick's
+ * timestamp as a delta from the previous tick, followed by one length-prefixed
+ * section per module that wrote records during the tick. Within a section,
+ * each record's timestamp is a var_i64 offset from the tick's timestamp, so a
+ * tick costs one write and a few bytes of timestamps regardless of the number
+ * of modules, and a reader can skip the sections of modules it ignores.
+ *
+ * Modules are initialized with their output in a staging directory, and the
+ * records written during initialization are stored in the module's
+ * declaration at the start of the stream, in the module's own file format.
+ */
+typedef struct {
+	char *name;
+	// Records written by the module during the current tick
+	char *buffer;
+	size_t size;
+	size_t capacity;
+} stream_section_t;
+
+typedef struct {
+	FILE *output_file;
+	char hostname[256];
+	char *staging_directory;
+	stream_section_t *sections;
+	uint32_t num_sections;
+	// Timestamp of the current and the previous tick
+	nanosec_t tick_time;
+	nanosec_t previous_tick_time;
+	// Encoded tick, written with a single fwrite
+	char *tick_buffer;
+	size_t tick_capacity;
+} unified_stream_t;
+
+/**
+ * Create a unified stream and the staging directory its modules must be
+ * initialized in (i.e., their output_directory), followed by a call to
+ * unified_stream_attach to move their output into the stream
+ */
+unified_stream_t *init_unified_stream(const char *output_directory);
+void unified_stream_attach(unified_stream_t *stream, monitor_state_t *state);
+
+/**
+ * Set the timestamp of a tick before sampling all modules, and write the
+ * tick with the records of all modules afterwards
+ */
+void unified_stream_begin_tick(unified_stream_t *stream, nanosec_t tick_time);
+void unified_stream_end_tick(unified_stream_t *stream);
+
+/**
+ * Must be called after the cleanup of all modules of the stream
+ */
+void unified_stream_free(unified_stream_t *stream);
+
+#endif
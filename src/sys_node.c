@@ -0,0 +1,301 @@
+
+#include "columns.h"
+#include "parse.h"
+#include "sysfs.h"
+#include "varint.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+/**
+ * Module data
+ */
+typedef enum {
+	// Gauges, in kB
+	MEM_USED = 0,
+	MEM_FREE,
+	FILE_PAGES,
+	ANON_PAGES,
+	// Counters, in pages
+	NUMA_HIT,
+	NUMA_MISS,
+	NUMA_FOREIGN,
+	SYS_NODE_FIELDS
+} sys_node_field;
+#define FIRST_COUNTER_FIELD NUMA_HIT
+
+typedef struct {
+	uint32_t num_nodes;
+	uint32_t *node_ids;
+	uint64_t *mem_totals;
+	// Per-node meminfo and numastat files, kept open between ticks
+	proc_file_t *meminfo_files;
+	proc_file_t *numastat_files;
+	// Per-node metrics, one column per field
+	metric_columns_t previous_metrics;
+	metric_columns_t current_metrics;
+} sys_node_data;
+
+static void cleanup_data_buffers(sys_node_data *data) {
+	for (uint32_t node = 0; node < data->num_nodes; node++) {
+		proc_file_close(&data->meminfo_files[node]);
+		proc_file_close(&data->numastat_files[node]);
+	}
+	free(data->node_ids);
+	free(data->mem_totals);
+	free(data->meminfo_files);
+	free(data->numastat_files);
+	metric_columns_free(&data->previous_metrics);
+	metric_columns_free(&data->current_metrics);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	NODE_LIST = 0,
+	METRICS = 1
+} sys_node_msgtype;
+
+static void write_node_list(trace_file_t *trace_file, nanosec_t timestamp, sys_node_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("sys-node: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("sys-node: Writing message type: %u\n", NODE_LIST & 0xFF);
+	*buffer_ptr = (char)NODE_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("sys-node: Writing num nodes: %u\n", data->num_nodes);
+	write_var_uint32_t(data->num_nodes, &buffer_ptr);
+
+	for (uint32_t node = 0; node < data->num_nodes; node++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE + VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		DEBUG_PRINT("sys-node: Writing node %u with %llu kB memory\n", data->node_ids[node], data->mem_totals[node]);
+		write_var_uint32_t(data->node_ids[node], &buffer_ptr);
+		write_var_uint64_t(data->mem_totals[node], &buffer_ptr);
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, sys_node_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("sys-node: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("sys-node: Writing message type: %u\n", METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("sys-node: Writing num nodes: %u\n", data->num_nodes);
+	write_var_uint32_t(data->num_nodes, &buffer_ptr);
+
+	for (uint32_t node = 0; node < data->num_nodes; node++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < SYS_NODE_FIELDS * VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		DEBUG_PRINT("sys-node: Writing metrics of node %u\n", data->node_ids[node]);
+		// Gauges may decrease, so their deltas are signed
+		for (uint32_t field = 0; field < FIRST_COUNTER_FIELD; field++) {
+			write_var_int64_t((int64_t)metric_column(deltas, field)[node], &buffer_ptr);
+		}
+		for (uint32_t field = FIRST_COUNTER_FIELD; field < SYS_NODE_FIELDS; field++) {
+			write_var_uint64_t(metric_column(deltas, field)[node], &buffer_ptr);
+		}
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * Node meminfo and numastat parsing logic
+ */
+static bool read_node_meminfo(proc_file_t *file, uint32_t node, metric_columns_t *metrics, uint64_t *mem_total) {
+	if (!proc_file_read(file)) {
+		return false;
+	}
+
+	// Format: "Node <id> <field>: <value> kB"
+	const char *ptr = file->buffer;
+	while (*ptr != '\0') {
+		skip_token(&ptr);
+		skip_token(&ptr);
+		skip_spaces(&ptr);
+		switch (*ptr) {
+		case 'A':
+			if (CONSUME_PREFIX(&ptr, "AnonPages:")) {
+				metric_column(metrics, ANON_PAGES)[node] = parse_uint64(&ptr);
+			}
+			break;
+		case 'F':
+			if (CONSUME_PREFIX(&ptr, "FilePages:")) {
+				metric_column(metrics, FILE_PAGES)[node] = parse_uint64(&ptr);
+			}
+			break;
+		case 'M':
+			if (CONSUME_PREFIX(&ptr, "MemTotal:")) {
+				*mem_total = parse_uint64(&ptr);
+			} else if (CONSUME_PREFIX(&ptr, "MemFree:")) {
+				metric_column(metrics, MEM_FREE)[node] = parse_uint64(&ptr);
+			} else if (CONSUME_PREFIX(&ptr, "MemUsed:")) {
+				metric_column(metrics, MEM_USED)[node] = parse_uint64(&ptr);
+			}
+			break;
+		default:
+			break;
+		}
+		skip_line(&ptr);
+	}
+	return true;
+}
+
+static bool read_node_numastat(proc_file_t *file, uint32_t node, metric_columns_t *metrics) {
+	if (!proc_file_read(file)) {
+		return false;
+	}
+
+	// Format: "<field> <value>"
+	const char *ptr = file->buffer;
+	while (*ptr != '\0') {
+		if (CONSUME_PREFIX(&ptr, "numa_hit ")) {
+			metric_column(metrics, NUMA_HIT)[node] = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "numa_miss ")) {
+			metric_column(metrics, NUMA_MISS)[node] = parse_uint64(&ptr);
+		} else if (CONSUME_PREFIX(&ptr, "numa_foreign ")) {
+			metric_column(metrics, NUMA_FOREIGN)[node] = parse_uint64(&ptr);
+		}
+		skip_line(&ptr);
+	}
+	return true;
+}
+
+static void parse_sys_node(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	sys_node_data *data = (sys_node_data *)trace_file->data;
+
+	bool totals_changed = false;
+	for (uint32_t node = 0; node < data->num_nodes; node++) {
+		uint64_t mem_total = data->mem_totals[node];
+		read_node_meminfo(&data->meminfo_files[node], node, &data->current_metrics, &mem_total);
+		read_node_numastat(&data->numastat_files[node], node, &data->current_metrics);
+		if (mem_total != data->mem_totals[node]) {
+			data->mem_totals[node] = mem_total;
+			totals_changed = true;
+		}
+	}
+
+	// If the memory of any node changed (e.g., memory hotplug), resend the node list
+	if (totals_changed) {
+		write_node_list(trace_file, sample_time, data);
+	}
+
+	// Let previous = current - previous and write the deltas to the output file
+	metric_columns_delta(&data->previous_metrics, &data->current_metrics);
+	write_metrics(trace_file, sample_time, data, &data->previous_metrics);
+
+	// Swap the metric buffers
+	metric_columns_t tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char sys_node_directory[] = "/sys/devices/system/node";
+
+static void enumerate_nodes(sys_node_data *data) {
+	// Online nodes are listed as comma-separated IDs and ranges, e.g., "0-1,3"
+	proc_file_t online_file;
+	char path[sizeof(sys_node_directory) + 64];
+	snprintf(path, sizeof(path), "%s/online", sys_node_directory);
+	if (proc_file_open(&online_file, path) && proc_file_read(&online_file)) {
+		const char *ptr = online_file.buffer;
+		while (is_digit(*ptr)) {
+			uint32_t first = (uint32_t)parse_uint64(&ptr);
+			uint32_t last = first;
+			if (*ptr == '-') {
+				ptr++;
+				last = (uint32_t)parse_uint64(&ptr);
+			}
+			for (uint32_t node_id = first; node_id <= last; node_id++) {
+				data->node_ids = realloc(data->node_ids, (data->num_nodes + 1) * sizeof(uint32_t));
+				data->node_ids[data->num_nodes++] = node_id;
+			}
+			if (*ptr == ',') {
+				ptr++;
+			}
+		}
+	} else {
+		printf("Failed to read %s, no NUMA metrics will be recorded\n", path);
+	}
+	proc_file_close(&online_file);
+
+	// Open the meminfo and numastat files of all nodes
+	data->mem_totals = calloc(data->num_nodes, sizeof(uint64_t));
+	data->meminfo_files = calloc(data->num_nodes, sizeof(proc_file_t));
+	data->numastat_files = calloc(data->num_nodes, sizeof(proc_file_t));
+	for (uint32_t node = 0; node < data->num_nodes; node++) {
+		snprintf(path, sizeof(path), "%s/node%u/meminfo", sys_node_directory, data->node_ids[node]);
+		proc_file_open(&data->meminfo_files[node], path);
+		snprintf(path, sizeof(path), "%s/node%u/numastat", sys_node_directory, data->node_ids[node]);
+		proc_file_open(&data->numastat_files[node], path);
+	}
+
+	metric_columns_resize(&data->previous_metrics, data->num_nodes);
+	metric_columns_resize(&data->current_metrics, data->num_nodes);
+}
+
+static void cleanup_sys_node(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((sys_node_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_sys_node_parser(const char *output_directory, const char *hostname, uint32_t max_entities) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/sys-node-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/sys-node-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_sys_node;
+	trace_file->cleanup_callback = cleanup_sys_node;
+	trace_file->source_file_name = sys_node_directory;
+	trace_file->has_list_records = true;
+	trace_file->data = calloc(1, sizeof(sys_node_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	sys_node_data *data = (sys_node_data *)trace_file->data;
+	metric_columns_init(&data->previous_metrics, SYS_NODE_FIELDS, max_entities);
+	metric_columns_init(&data->current_metrics, SYS_NODE_FIELDS, max_entities);
+	enumerate_nodes(data);
+
+	// Read the memory totals and write the node list
+	nanosec_t sample_time = get_time();
+	for (uint32_t node = 0; node < data->num_nodes; node++) {
+		read_node_meminfo(&data->meminfo_files[node], node, &data->current_metrics, &data->mem_totals[node]);
+	}
+	write_node_list(trace_file, sample_time, data);
+
+	return trace_file;
+}
@@ -0,0 +1,424 @@
+
+#include "columns.h"
+#include "sysfs.h"
+#include "varint.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+/**
+ * Module data
+ */
+typedef enum {
+	CUR_FREQ_KHZ = 0,
+	APERF,
+	MPERF,
+	CORE_THROTTLE_COUNT,
+	PACKAGE_THROTTLE_COUNT,
+	SYS_POWER_CPU_FIELDS
+} sys_power_cpu_field;
+
+// Sources available for at least one CPU, written as a bitmask in the power list
+typedef enum {
+	SOURCE_CPUFREQ = 1 << 0,
+	SOURCE_MSR = 1 << 1,
+	SOURCE_THERMAL_THROTTLE = 1 << 2
+} sys_power_source;
+
+#define MSR_IA32_MPERF 0xE7
+#define MSR_IA32_APERF 0xE8
+
+typedef struct {
+	uint32_t num_cpus;
+	uint32_t *cpu_ids;
+	uint8_t sources;
+	// Per-CPU file descriptors, -1 if unavailable
+	int *cur_freq_fds;
+	int *msr_fds;
+	int *core_throttle_fds;
+	int *package_throttle_fds;
+	metric_columns_t previous_cpus;
+	metric_columns_t current_cpus;
+	// RAPL zones (packages and their subzones)
+	uint32_t num_zones;
+	char **zone_ids;
+	char **zone_names;
+	int *energy_fds;
+	uint64_t *max_energy_ranges;
+	uint64_t *previous_energy;
+	uint64_t *current_energy;
+} sys_power_data;
+
+static void close_fds(int *fds, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (fds[i] >= 0) {
+			close(fds[i]);
+		}
+	}
+	free(fds);
+}
+
+static void cleanup_data_buffers(sys_power_data *data) {
+	close_fds(data->cur_freq_fds, data->num_cpus);
+	close_fds(data->msr_fds, data->num_cpus);
+	close_fds(data->core_throttle_fds, data->num_cpus);
+	close_fds(data->package_throttle_fds, data->num_cpus);
+	free(data->cpu_ids);
+	metric_columns_free(&data->previous_cpus);
+	metric_columns_free(&data->current_cpus);
+	for (uint32_t zone = 0; zone < data->num_zones; zone++) {
+		free(data->zone_ids[zone]);
+		free(data->zone_names[zone]);
+	}
+	free(data->zone_ids);
+	free(data->zone_names);
+	close_fds(data->energy_fds, data->num_zones);
+	free(data->max_energy_ranges);
+	free(data->previous_energy);
+	free(data->current_energy);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	POWER_LIST = 0,
+	METRICS = 1
+} sys_power_msgtype;
+
+static void write_string(trace_file_t *trace_file, const char *string, char **buffer_ptr) {
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+	size_t string_len = strlen(string);
+	if ((size_t)(end_of_buffer - *buffer_ptr) < string_len + 1) {
+		fwrite(trace_file->write_buffer, (size_t)(*buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+		*buffer_ptr = trace_file->write_buffer;
+	}
+	memcpy(*buffer_ptr, string, string_len + 1);
+	*buffer_ptr += string_len + 1;
+}
+
+static void write_power_list(trace_file_t *trace_file, nanosec_t timestamp, sys_power_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("sys-power: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("sys-power: Writing message type: %u\n", POWER_LIST & 0xFF);
+	*buffer_ptr = (char)POWER_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("sys-power: Writing sources: %u\n", data->sources);
+	*buffer_ptr = (char)data->sources;
+	buffer_ptr++;
+
+	DEBUG_PRINT("sys-power: Writing num cpus: %u\n", data->num_cpus);
+	write_var_uint32_t(data->num_cpus, &buffer_ptr);
+	for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		write_var_uint32_t(data->cpu_ids[cpu], &buffer_ptr);
+	}
+
+	DEBUG_PRINT("sys-power: Writing num zones: %u\n", data->num_zones);
+	if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE) {
+		fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+		buffer_ptr = trace_file->write_buffer;
+	}
+	write_var_uint32_t(data->num_zones, &buffer_ptr);
+	for (uint32_t zone = 0; zone < data->num_zones; zone++) {
+		DEBUG_PRINT("sys-power: Writing zone: %s (%s)\n", data->zone_ids[zone], data->zone_names[zone]);
+		write_string(trace_file, data->zone_ids[zone], &buffer_ptr);
+		write_string(trace_file, data->zone_names[zone], &buffer_ptr);
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, sys_power_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("sys-power: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("sys-power: Writing message type: %u\n", METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("sys-power: Writing num cpus: %u\n", data->num_cpus);
+	write_var_uint32_t(data->num_cpus, &buffer_ptr);
+	const uint64_t *cur_freq = metric_column(&data->current_cpus, CUR_FREQ_KHZ);
+	for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < SYS_POWER_CPU_FIELDS * VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		// The frequency is a gauge and written as is, all other fields are counters
+		write_var_uint64_t(cur_freq[cpu], &buffer_ptr);
+		for (uint32_t field = APERF; field < SYS_POWER_CPU_FIELDS; field++) {
+			write_var_uint64_t(metric_column(&data->current_cpus, field)[cpu] -
+					metric_column(&data->previous_cpus, field)[cpu], &buffer_ptr);
+		}
+	}
+
+	DEBUG_PRINT("sys-power: Writing num zones: %u\n", data->num_zones);
+	if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE) {
+		fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+		buffer_ptr = trace_file->write_buffer;
+	}
+	write_var_uint32_t(data->num_zones, &buffer_ptr);
+	for (uint32_t zone = 0; zone < data->num_zones; zone++) {
+		if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT64_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		// Energy counters range from 0 to max_energy_range_uj (inclusive) and then wrap around. If
+		// the range is unknown (or wrong), the energy of a wrapped interval is written as 0.
+		uint64_t previous = data->previous_energy[zone];
+		uint64_t current = data->current_energy[zone];
+		uint64_t max_range = data->max_energy_ranges[zone];
+		uint64_t delta = current >= previous ? current - previous :
+				max_range >= previous ? current + max_range + 1 - previous : 0;
+		DEBUG_PRINT("sys-power: Writing energy of %s: %llu uJ\n", data->zone_ids[zone], delta);
+		write_var_uint64_t(delta, &buffer_ptr);
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * sysfs and MSR reading logic
+ */
+static bool read_sysfs_value(int fd, uint64_t *value) {
+	// Values are small decimal numbers, so a single pread suffices
+	char buffer[32];
+	if (fd < 0) {
+		return false;
+	}
+	ssize_t bytes_read = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	if (bytes_read <= 0) {
+		return false;
+	}
+	buffer[bytes_read] = '\0';
+	*value = strtoull(buffer, NULL, 10);
+	return true;
+}
+
+static bool read_msr(int fd, uint32_t msr, uint64_t *value) {
+	return fd >= 0 && pread(fd, value, sizeof(*value), msr) == sizeof(*value);
+}
+
+static void parse_sys_power(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	sys_power_data *data = (sys_power_data *)trace_file->data;
+
+	// Values that cannot be read (e.g., of offline CPUs) keep their previous values
+	memcpy(data->current_cpus.values, data->previous_cpus.values,
+			(size_t)SYS_POWER_CPU_FIELDS * data->current_cpus.capacity * sizeof(uint64_t));
+	uint64_t *cur_freq = metric_column(&data->current_cpus, CUR_FREQ_KHZ);
+	uint64_t *aperf = metric_column(&data->current_cpus, APERF);
+	uint64_t *mperf = metric_column(&data->current_cpus, MPERF);
+	uint64_t *core_throttle = metric_column(&data->current_cpus, CORE_THROTTLE_COUNT);
+	uint64_t *package_throttle = metric_column(&data->current_cpus, PACKAGE_THROTTLE_COUNT);
+	for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+		read_sysfs_value(data->cur_freq_fds[cpu], &cur_freq[cpu]);
+		read_msr(data->msr_fds[cpu], MSR_IA32_APERF, &aperf[cpu]);
+		read_msr(data->msr_fds[cpu], MSR_IA32_MPERF, &mperf[cpu]);
+		read_sysfs_value(data->core_throttle_fds[cpu], &core_throttle[cpu]);
+		read_sysfs_value(data->package_throttle_fds[cpu], &package_throttle[cpu]);
+	}
+
+	for (uint32_t zone = 0; zone < data->num_zones; zone++) {
+		data->current_energy[zone] = data->previous_energy[zone];
+		read_sysfs_value(data->energy_fds[zone], &data->current_energy[zone]);
+	}
+
+	write_metrics(trace_file, sample_time, data);
+
+	// Swap the metric buffers
+	metric_columns_t tmp = data->previous_cpus;
+	data->previous_cpus = data->current_cpus;
+	data->current_cpus = tmp;
+	uint64_t *tmp_energy = data->previous_energy;
+	data->previous_energy = data->current_energy;
+	data->current_energy = tmp_energy;
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char sys_cpu_directory[] = "/sys/devices/system/cpu";
+static const char sys_powercap_directory[] = "/sys/class/powercap";
+
+static int open_cpu_file(uint32_t cpu_id, const char *file_name) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/cpu%u/%s", sys_cpu_directory, cpu_id, file_name);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Number of per-CPU files that may be kept open, half of the open file limit
+// so that other modules and the output files have room
+static uint64_t file_budget() {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+		return UINT64_MAX;
+	}
+	return (uint64_t)limit.rlim_cur / 2;
+}
+
+static void enumerate_cpus(sys_power_data *data, bool enable_msr) {
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	data->num_cpus = num_cpus > 0 ? (uint32_t)num_cpus : 0;
+	data->cpu_ids = malloc(data->num_cpus * sizeof(uint32_t));
+	data->cur_freq_fds = malloc(data->num_cpus * sizeof(int));
+	data->msr_fds = malloc(data->num_cpus * sizeof(int));
+	data->core_throttle_fds = malloc(data->num_cpus * sizeof(int));
+	data->package_throttle_fds = malloc(data->num_cpus * sizeof(int));
+
+	// Every CPU needs up to four open files, so the throttle counters (and then
+	// the MSRs) are left out rather than exceeding the open file limit
+	uint64_t budget = file_budget();
+	uint64_t files_per_cpu = 1 + (enable_msr ? 1 : 0);
+	bool enable_throttle = (uint64_t)data->num_cpus * (files_per_cpu + 2) <= budget;
+	if (!enable_throttle) {
+		printf("Not enough open files for the throttle counters of %u CPUs, no throttle metrics will be recorded\n",
+				data->num_cpus);
+	}
+	if (enable_msr && (uint64_t)data->num_cpus * files_per_cpu > budget) {
+		printf("Not enough open files for the MSRs of %u CPUs, no APERF/MPERF metrics will be recorded\n",
+				data->num_cpus);
+		enable_msr = false;
+	}
+
+	for (uint32_t cpu = 0; cpu < data->num_cpus; cpu++) {
+		data->cpu_ids[cpu] = cpu;
+		data->cur_freq_fds[cpu] = open_cpu_file(cpu, "cpufreq/scaling_cur_freq");
+		data->core_throttle_fds[cpu] = enable_throttle ? open_cpu_file(cpu, "thermal_throttle/core_throttle_count") : -1;
+		data->package_throttle_fds[cpu] = enable_throttle ? open_cpu_file(cpu, "thermal_throttle/package_throttle_count") : -1;
+
+		// Reading MSRs requires the msr kernel module and CAP_SYS_RAWIO. Every read
+		// interrupts the CPU that it is read from, so MSRs are only read on request.
+		data->msr_fds[cpu] = -1;
+		if (enable_msr) {
+			char msr_path[64];
+			snprintf(msr_path, sizeof(msr_path), "/dev/cpu/%u/msr", cpu);
+			data->msr_fds[cpu] = open(msr_path, O_RDONLY | O_CLOEXEC);
+			uint64_t value;
+			if (data->msr_fds[cpu] >= 0 && !read_msr(data->msr_fds[cpu], MSR_IA32_APERF, &value)) {
+				close(data->msr_fds[cpu]);
+				data->msr_fds[cpu] = -1;
+			}
+		}
+
+		data->sources |= (data->cur_freq_fds[cpu] >= 0 ? SOURCE_CPUFREQ : 0) |
+			(data->msr_fds[cpu] >= 0 ? SOURCE_MSR : 0) |
+			(data->core_throttle_fds[cpu] >= 0 ? SOURCE_THERMAL_THROTTLE : 0);
+	}
+
+	metric_columns_resize(&data->previous_cpus, data->num_cpus);
+	metric_columns_resize(&data->current_cpus, data->num_cpus);
+}
+
+static int compare_strings(const void *a, const void *b) {
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void enumerate_zones(sys_power_data *data) {
+	// The powercap class directory lists all RAPL zones and subzones, e.g., "intel-rapl:0" and "intel-rapl:0:1"
+	DIR *directory = opendir(sys_powercap_directory);
+	if (directory == NULL) {
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL) {
+		if (strncmp(entry->d_name, "intel-rapl:", strlen("intel-rapl:")) != 0) {
+			continue;
+		}
+		data->zone_ids = realloc(data->zone_ids, (data->num_zones + 1) * sizeof(char *));
+		data->zone_ids[data->num_zones++] = strdup(entry->d_name);
+	}
+	closedir(directory);
+	qsort(data->zone_ids, data->num_zones, sizeof(char *), compare_strings);
+
+	data->zone_names = malloc(data->num_zones * sizeof(char *));
+	data->energy_fds = malloc(data->num_zones * sizeof(int));
+	data->max_energy_ranges = malloc(data->num_zones * sizeof(uint64_t));
+	data->previous_energy = calloc(data->num_zones, sizeof(uint64_t));
+	data->current_energy = calloc(data->num_zones, sizeof(uint64_t));
+	for (uint32_t zone = 0; zone < data->num_zones; zone++) {
+		char path[256];
+		snprintf(path, sizeof(path), "%s/%s/name", sys_powercap_directory, data->zone_ids[zone]);
+		char name[64] = "";
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			ssize_t bytes_read = read(fd, name, sizeof(name) - 1);
+			name[bytes_read > 0 ? bytes_read : 0] = '\0';
+			name[strcspn(name, "\n")] = '\0';
+			close(fd);
+		}
+		data->zone_names[zone] = strdup(name);
+
+		snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", sys_powercap_directory, data->zone_ids[zone]);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		data->max_energy_ranges[zone] = 0;
+		read_sysfs_value(fd, &data->max_energy_ranges[zone]);
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		// Reading energy_uj requires root on recent kernels
+		snprintf(path, sizeof(path), "%s/%s/energy_uj", sys_powercap_directory, data->zone_ids[zone]);
+		data->energy_fds[zone] = open(path, O_RDONLY | O_CLOEXEC);
+		if (data->energy_fds[zone] < 0) {
+			printf("Failed to open %s, no energy metrics will be recorded for this zone\n", path);
+		}
+	}
+}
+
+static void cleanup_sys_power(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((sys_power_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_sys_power_parser(const char *output_directory, const char *hostname, bool enable_msr, uint32_t max_entities) {
+	char *output_filename = malloc(strlen(output_directory) + strlen("/sys-power-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/sys-power-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_sys_power;
+	trace_file->cleanup_callback = cleanup_sys_power;
+	trace_file->source_file_name = sys_cpu_directory;
+	trace_file->has_list_records = true;
+	trace_file->data = calloc(1, sizeof(sys_power_data));
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	sys_power_data *data = (sys_power_data *)trace_file->data;
+	metric_columns_init(&data->previous_cpus, SYS_POWER_CPU_FIELDS, max_entities);
+	metric_columns_init(&data->current_cpus, SYS_POWER_CPU_FIELDS, max_entities);
+	enumerate_cpus(data, enable_msr);
+	enumerate_zones(data);
+
+	write_power_list(trace_file, get_time(), data);
+
+	return trace_file;
+}
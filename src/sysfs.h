@@ -0,0 +1,27 @@
+
+#ifndef __SYSFS_H__
+#define __SYSFS_H__
+
+#include "monitor.h"
+
+/**
+ * Files: /sys/devices/system/node/nodeN/meminfo, /sys/devices/system/node/nodeN/numastat
+ *
+ * The set of nodes is read from /sys/devices/system/node/online once at startup,
+ * so nodes brought online later are not recorded. Buffers are allocated for at
+ * least max_entities nodes.
+ */
+trace_file_t *init_sys_node_parser(const char *output_directory, const char *hostname, uint32_t max_entities);
+
+/**
+ * Files: /sys/devices/system/cpu/cpuN/{cpufreq,thermal_throttle}, /dev/cpu/N/msr, /sys/class/powercap/intel-rapl:*
+ *
+ * The MSRs (APERF/MPERF) are only read if enable_msr, as each read interrupts
+ * the CPU that it is read from.
+ *
+ * All possible CPUs are enumerated once at startup, offline CPUs keep their
+ * last values. Buffers are allocated for at least max_entities CPUs.
+ */
+trace_file_t *init_sys_power_parser(const char *output_directory, const char *hostname, bool enable_msr, uint32_t max_entities);
+
+#endif
@@ -0,0 +1,334 @@
+// recvmmsg is a GNU extension
+#define _GNU_SOURCE
+
+#include "taskstats.h"
+
+#include <errno.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+/**
+ * Message construction helpers
+ */
+#define MESSAGE_BUFFER_SIZE 256
+#define RECEIVE_BATCH_SIZE 64
+// Large enough for an exit notification with both per-pid and per-tgid statistics
+#define RECEIVE_MESSAGE_SIZE 2048
+#define SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+// Upper bound for waiting on the replies to a query
+#define QUERY_TIMEOUT_MS 1000
+
+#define GENL_DATA(header) ((char *)NLMSG_DATA(header) + GENL_HDRLEN)
+#define NLA_DATA(attribute) ((char *)(attribute) + NLA_HDRLEN)
+
+typedef struct {
+	struct nlmsghdr header;
+	struct genlmsghdr genl_header;
+	char attributes[MESSAGE_BUFFER_SIZE];
+} genl_request_t;
+
+static void init_request(genl_request_t *request, uint16_t family_id, uint8_t command, uint32_t sequence_number) {
+	memset(request, 0, sizeof(*request));
+	request->header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	request->header.nlmsg_type = family_id;
+	request->header.nlmsg_flags = NLM_F_REQUEST;
+	request->header.nlmsg_seq = sequence_number;
+	request->genl_header.cmd = command;
+	request->genl_header.version = 1;
+}
+
+static void add_attribute(genl_request_t *request, uint16_t type, const void *value, uint16_t length) {
+	struct nlattr *attribute = (struct nlattr *)((char *)request + NLMSG_ALIGN(request->header.nlmsg_len));
+	attribute->nla_type = type;
+	attribute->nla_len = NLA_HDRLEN + length;
+	memcpy(NLA_DATA(attribute), value, length);
+	request->header.nlmsg_len = NLMSG_ALIGN(request->header.nlmsg_len) + NLA_ALIGN(attribute->nla_len);
+}
+
+static bool send_request(taskstats_socket_t *socket, genl_request_t *request) {
+	struct sockaddr_nl kernel_address = { .nl_family = AF_NETLINK };
+	return sendto(socket->socket_fd, request, request->header.nlmsg_len, 0,
+			(struct sockaddr *)&kernel_address, sizeof(kernel_address)) >= 0;
+}
+
+
+/**
+ * Socket management
+ */
+static bool resolve_family(taskstats_socket_t *socket) {
+	genl_request_t request;
+	init_request(&request, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, ++socket->sequence_number);
+	add_attribute(&request, CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+	if (!send_request(socket, &request)) {
+		return false;
+	}
+
+	char *buffer = socket->receive_buffers;
+	ssize_t received = recv(socket->socket_fd, buffer, RECEIVE_MESSAGE_SIZE, 0);
+	struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+	if (received < 0 || !NLMSG_OK(header, (size_t)received) || header->nlmsg_type == NLMSG_ERROR) {
+		return false;
+	}
+
+	int remaining = (int)(header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+	for (struct nlattr *attribute = (struct nlattr *)GENL_DATA(header); remaining >= NLA_HDRLEN &&
+			attribute->nla_len >= NLA_HDRLEN && attribute->nla_len <= remaining;
+			remaining -= NLA_ALIGN(attribute->nla_len),
+			attribute = (struct nlattr *)((char *)attribute + NLA_ALIGN(attribute->nla_len))) {
+		if (attribute->nla_type == CTRL_ATTR_FAMILY_ID) {
+			memcpy(&socket->family_id, NLA_DATA(attribute), sizeof(uint16_t));
+			return true;
+		}
+	}
+	return false;
+}
+
+bool taskstats_open(taskstats_socket_t *taskstats_socket) {
+	memset(taskstats_socket, 0, sizeof(*taskstats_socket));
+	taskstats_socket->socket_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (taskstats_socket->socket_fd < 0) {
+		printf("Failed to create generic netlink socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Increase the socket buffer to reduce the odds of dropping messages between ticks
+	int socket_buffer_size = SOCKET_BUFFER_SIZE;
+	if (setsockopt(taskstats_socket->socket_fd, SOL_SOCKET, SO_RCVBUFFORCE, &socket_buffer_size, sizeof(socket_buffer_size)) < 0) {
+		setsockopt(taskstats_socket->socket_fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(socket_buffer_size));
+	}
+
+	struct timeval timeout = { .tv_sec = QUERY_TIMEOUT_MS / 1000, .tv_usec = (QUERY_TIMEOUT_MS % 1000) * 1000 };
+	setsockopt(taskstats_socket->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	struct sockaddr_nl address = { .nl_family = AF_NETLINK };
+	taskstats_socket->receive_buffers = malloc(RECEIVE_BATCH_SIZE * RECEIVE_MESSAGE_SIZE);
+	if (bind(taskstats_socket->socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+			!resolve_family(taskstats_socket)) {
+		printf("Failed to resolve the taskstats generic netlink family: %s\n", strerror(errno));
+		taskstats_close(taskstats_socket);
+		return false;
+	}
+	return true;
+}
+
+void taskstats_close(taskstats_socket_t *socket) {
+	if (socket->socket_fd >= 0) {
+		close(socket->socket_fd);
+		socket->socket_fd = -1;
+	}
+	free(socket->receive_buffers);
+	socket->receive_buffers = NULL;
+}
+
+bool taskstats_register_exit(taskstats_socket_t *socket) {
+	// Register for all possible CPUs, so that hotplugged CPUs are covered as well
+	char cpumask[256] = "";
+	FILE *possible_file = fopen("/sys/devices/system/cpu/possible", "r");
+	if (possible_file != NULL) {
+		if (fgets(cpumask, sizeof(cpumask), possible_file) != NULL) {
+			cpumask[strcspn(cpumask, "\n")] = '\0';
+		}
+		fclose(possible_file);
+	}
+	if (*cpumask == '\0') {
+		snprintf(cpumask, sizeof(cpumask), "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+	}
+
+	genl_request_t request;
+	init_request(&request, socket->family_id, TASKSTATS_CMD_GET, ++socket->sequence_number);
+	add_attribute(&request, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpumask, (uint16_t)(strlen(cpumask) + 1));
+	return send_request(socket, &request);
+}
+
+
+/**
+ * Message parsing logic
+ */
+static void handle_aggregate(struct nlattr *aggregate, taskstats_handler_t handler, void *context) {
+	bool is_tgid = aggregate->nla_type == TASKSTATS_TYPE_AGGR_TGID;
+	uint32_t id = 0;
+	struct taskstats stats;
+	bool has_stats = false;
+
+	int remaining = aggregate->nla_len - NLA_HDRLEN;
+	for (struct nlattr *attribute = (struct nlattr *)NLA_DATA(aggregate); remaining >= NLA_HDRLEN &&
+			attribute->nla_len >= NLA_HDRLEN && attribute->nla_len <= remaining;
+			remaining -= NLA_ALIGN(attribute->nla_len),
+			attribute = (struct nlattr *)((char *)attribute + NLA_ALIGN(attribute->nla_len))) {
+		if (attribute->nla_type == TASKSTATS_TYPE_PID || attribute->nla_type == TASKSTATS_TYPE_TGID) {
+			memcpy(&id, NLA_DATA(attribute), sizeof(uint32_t));
+		} else if (attribute->nla_type == TASKSTATS_TYPE_STATS) {
+			// Copy what the kernel provides, as its struct may differ in size
+			size_t length = attribute->nla_len - NLA_HDRLEN;
+			memset(&stats, 0, sizeof(stats));
+			memcpy(&stats, NLA_DATA(attribute), length < sizeof(stats) ? length : sizeof(stats));
+			has_stats = true;
+		}
+	}
+	if (has_stats) {
+		handler(context, id, is_tgid, &stats);
+	}
+}
+
+static void handle_message(struct nlmsghdr *header, taskstats_handler_t handler, void *context) {
+	int remaining = (int)(header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+	for (struct nlattr *attribute = (struct nlattr *)GENL_DATA(header); remaining >= NLA_HDRLEN &&
+			attribute->nla_len >= NLA_HDRLEN && attribute->nla_len <= remaining;
+			remaining -= NLA_ALIGN(attribute->nla_len),
+			attribute = (struct nlattr *)((char *)attribute + NLA_ALIGN(attribute->nla_len))) {
+		if (attribute->nla_type == TASKSTATS_TYPE_AGGR_PID || attribute->nla_type == TASKSTATS_TYPE_AGGR_TGID) {
+			handle_aggregate(attribute, handler, context);
+		}
+	}
+}
+
+static void init_receive_batch(taskstats_socket_t *socket, struct mmsghdr *messages, struct iovec *vectors) {
+	for (int i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+		vectors[i].iov_base = socket->receive_buffers + i * RECEIVE_MESSAGE_SIZE;
+		vectors[i].iov_len = RECEIVE_MESSAGE_SIZE;
+		memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+bool taskstats_receive(taskstats_socket_t *socket, taskstats_handler_t handler, void *context) {
+	struct mmsghdr messages[RECEIVE_BATCH_SIZE];
+	struct iovec vectors[RECEIVE_BATCH_SIZE];
+	init_receive_batch(socket, messages, vectors);
+
+	bool complete = true;
+	for (;;) {
+		int received = recvmmsg(socket->socket_fd, messages, RECEIVE_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == ENOBUFS) {
+				complete = false;
+				continue;
+			}
+			// EAGAIN: no more pending messages
+			return complete;
+		}
+
+		for (int i = 0; i < received; i++) {
+			int remaining = (int)messages[i].msg_len;
+			for (struct nlmsghdr *header = (struct nlmsghdr *)vectors[i].iov_base; NLMSG_OK(header, remaining);
+					header = NLMSG_NEXT(header, remaining)) {
+				if (header->nlmsg_type == socket->family_id) {
+					handle_message(header, handler, context);
+				}
+			}
+		}
+		if (received < RECEIVE_BATCH_SIZE) {
+			return complete;
+		}
+	}
+}
+
+
+/**
+ * Batched query logic
+ */
+// One TASKSTATS_CMD_GET request with a single u32 attribute
+#define QUERY_MESSAGE_SIZE NLMSG_ALIGN(NLMSG_LENGTH(GENL_HDRLEN) + NLA_HDRLEN + NLA_ALIGN(sizeof(uint32_t)))
+
+typedef struct {
+	taskstats_query_handler_t handler;
+	void *context;
+	uint32_t task_index;
+} query_context_t;
+
+static void handle_query_reply(void *context, uint32_t id, bool is_tgid, const struct taskstats *stats) {
+	(void)id;
+	(void)is_tgid;
+	query_context_t *query = (query_context_t *)context;
+	query->handler(query->context, query->task_index, stats);
+}
+
+static bool query_batch(taskstats_socket_t *socket, const taskstats_task_t *tasks, uint32_t first_task,
+		uint32_t num_tasks, taskstats_query_handler_t handler, void *context) {
+	// Concatenate the requests, the kernel processes all messages of a datagram in order
+	char requests[RECEIVE_BATCH_SIZE * QUERY_MESSAGE_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	memset(requests, 0, num_tasks * QUERY_MESSAGE_SIZE);
+	uint32_t first_sequence_number = socket->sequence_number + 1;
+	for (uint32_t i = 0; i < num_tasks; i++) {
+		struct nlmsghdr *header = (struct nlmsghdr *)(requests + i * QUERY_MESSAGE_SIZE);
+		header->nlmsg_len = QUERY_MESSAGE_SIZE;
+		header->nlmsg_type = socket->family_id;
+		header->nlmsg_flags = NLM_F_REQUEST;
+		header->nlmsg_seq = first_sequence_number + i;
+		struct genlmsghdr *genl_header = NLMSG_DATA(header);
+		genl_header->cmd = TASKSTATS_CMD_GET;
+		genl_header->version = 1;
+		struct nlattr *attribute = (struct nlattr *)GENL_DATA(header);
+		attribute->nla_type = tasks[first_task + i].is_tgid ? TASKSTATS_CMD_ATTR_TGID : TASKSTATS_CMD_ATTR_PID;
+		attribute->nla_len = NLA_HDRLEN + sizeof(uint32_t);
+		memcpy(NLA_DATA(attribute), &tasks[first_task + i].id, sizeof(uint32_t));
+	}
+	socket->sequence_number += num_tasks;
+
+	struct sockaddr_nl kernel_address = { .nl_family = AF_NETLINK };
+	if (sendto(socket->socket_fd, requests, num_tasks * QUERY_MESSAGE_SIZE, 0,
+			(struct sockaddr *)&kernel_address, sizeof(kernel_address)) < 0) {
+		return false;
+	}
+
+	// Every request is answered with either statistics or an error
+	struct mmsghdr messages[RECEIVE_BATCH_SIZE];
+	struct iovec vectors[RECEIVE_BATCH_SIZE];
+	init_receive_batch(socket, messages, vectors);
+	uint32_t num_replies = 0;
+	while (num_replies < num_tasks) {
+		int received = recvmmsg(socket->socket_fd, messages, RECEIVE_BATCH_SIZE, MSG_WAITFORONE, NULL);
+		if (received < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Timed out or replies were lost
+			return false;
+		}
+
+		for (int i = 0; i < received; i++) {
+			int remaining = (int)messages[i].msg_len;
+			for (struct nlmsghdr *header = (struct nlmsghdr *)vectors[i].iov_base; NLMSG_OK(header, remaining);
+					header = NLMSG_NEXT(header, remaining)) {
+				// Ignore replies left over from an earlier, failed query
+				uint32_t task_index = header->nlmsg_seq - first_sequence_number;
+				if (task_index >= num_tasks) {
+					continue;
+				}
+				num_replies++;
+				if (header->nlmsg_type == NLMSG_ERROR) {
+					handler(context, first_task + task_index, NULL);
+				} else if (header->nlmsg_type == socket->family_id) {
+					query_context_t query = { .handler = handler, .context = context, .task_index = first_task + task_index };
+					handle_message(header, handle_query_reply, &query);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool taskstats_query(taskstats_socket_t *socket, const taskstats_task_t *tasks, uint32_t num_tasks,
+		taskstats_query_handler_t handler, void *context) {
+	for (uint32_t first_task = 0; first_task < num_tasks; first_task += RECEIVE_BATCH_SIZE) {
+		uint32_t batch_size = num_tasks - first_task;
+		if (batch_size > RECEIVE_BATCH_SIZE) {
+			batch_size = RECEIVE_BATCH_SIZE;
+		}
+		if (!query_batch(socket, tasks, first_task, batch_size, handler, context)) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,64 @@
+
+#ifndef __TASKSTATS_H__
+#define __TASKSTATS_H__
+
+#include <linux/taskstats.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Generic netlink client for the kernel's taskstats interface
+ *
+ * A taskstats socket resolves the TASKSTATS genetlink family once and then
+ * either receives the statistics of every exiting task (after registering
+ * for exit notifications) or answers requests for the statistics of given
+ * pids and tgids. Received messages are read in batches with recvmmsg, so
+ * draining many messages costs few system calls.
+ *
+ * The kernel's struct taskstats may be older or newer than the one in the
+ * headers; fields it does not provide are passed to handlers as zero.
+ */
+typedef struct {
+	int socket_fd;
+	uint16_t family_id;
+	uint32_t sequence_number;
+	// Buffers for batched receives
+	char *receive_buffers;
+} taskstats_socket_t;
+
+// Called with the pid (or tgid if is_tgid) and statistics of each task in a message
+typedef void (*taskstats_handler_t)(void *context, uint32_t id, bool is_tgid, const struct taskstats *stats);
+
+typedef struct {
+	uint32_t id;
+	bool is_tgid;
+} taskstats_task_t;
+
+// Called with the index of a queried task and its statistics, or NULL if the task does not exist
+typedef void (*taskstats_query_handler_t)(void *context, uint32_t task_index, const struct taskstats *stats);
+
+bool taskstats_open(taskstats_socket_t *socket);
+void taskstats_close(taskstats_socket_t *socket);
+
+/**
+ * Receive the statistics of all exiting tasks on all possible CPUs
+ */
+bool taskstats_register_exit(taskstats_socket_t *socket);
+
+/**
+ * Query the statistics of the given pids and tgids, returns false on error
+ *
+ * Requests are sent in batches of many netlink messages per sendto and the
+ * replies are received with recvmmsg, so each batch costs two system calls.
+ * Must not be used on a socket that is registered for exit notifications.
+ */
+bool taskstats_query(taskstats_socket_t *socket, const taskstats_task_t *tasks, uint32_t num_tasks,
+		taskstats_query_handler_t handler, void *context);
+
+/**
+ * Receive and handle all pending messages without blocking, returns false
+ * if messages were lost because the socket buffer overflowed
+ */
+bool taskstats_receive(taskstats_socket_t *socket, taskstats_handler_t handler, void *context);
+
+#endif
@@ -0,0 +1,603 @@
+
+#include "bitpack.h"
+#include "columns.h"
+#include "netlink.h"
+#include "parse.h"
+#include "taskstats.h"
+#include "varint.h"
+
+#include <errno.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+
+/**
+ * Module data
+ */
+typedef enum {
+	CPU_COUNT = 0,
+	CPU_DELAY_NS,
+	CPU_RUN_NS,
+	BLKIO_COUNT,
+	BLKIO_DELAY_NS,
+	SWAPIN_COUNT,
+	SWAPIN_DELAY_NS,
+	FREEPAGES_COUNT,
+	FREEPAGES_DELAY_NS,
+	TASKSTATS_DELAY_FIELDS
+} taskstats_delay_field;
+
+typedef enum {
+	TARGET_PID = 0,
+	TARGET_TGID,
+	TARGET_CGROUP
+} delay_target_kind;
+
+typedef struct {
+	delay_target_kind kind;
+	uint32_t id;
+	// Specification as given on the command line
+	char *spec;
+	// List of tgids in the cgroup
+	proc_file_t procs_file;
+} delay_target;
+
+typedef struct {
+	bool found;
+	uint64_t values[TASKSTATS_DELAY_FIELDS];
+	char command[TS_COMM_LEN];
+} task_sample;
+
+// A recorded task and its index in the task list, sorted by task to find tasks across task lists
+typedef struct {
+	uint64_t key;
+	uint32_t task_id;
+} task_key;
+
+typedef struct {
+	metric_encoding_t encoding;
+	taskstats_socket_t query_socket;
+	// Registered for exit notifications, so that the kernel keeps the delays of exited threads in the tgid totals
+	taskstats_socket_t exit_socket;
+	bool has_exit_socket;
+	delay_target *targets;
+	uint32_t num_targets;
+	// Tasks of all targets in this tick, their target, and their statistics
+	taskstats_task_t *candidates;
+	uint32_t *candidate_targets;
+	task_sample *samples;
+	uint32_t num_candidates;
+	uint32_t candidates_capacity;
+	// Recorded tasks, i.e., candidates that existed when the task list was last written
+	taskstats_task_t *tasks;
+	uint32_t *task_targets;
+	char (*task_commands)[TS_COMM_LEN];
+	task_key *task_keys;
+	uint32_t num_tasks;
+	uint32_t tasks_capacity;
+	// Per-task counters, one column per field
+	metric_columns_t previous_metrics;
+	metric_columns_t current_metrics;
+} taskstats_delay_data;
+
+static void add_candidate(taskstats_delay_data *data, uint32_t id, bool is_tgid, uint32_t target) {
+	if (data->num_candidates == data->candidates_capacity) {
+		data->candidates_capacity = data->candidates_capacity == 0 ? 64 : 2 * data->candidates_capacity;
+		data->candidates = realloc(data->candidates, sizeof(taskstats_task_t) * data->candidates_capacity);
+		data->candidate_targets = realloc(data->candidate_targets, sizeof(uint32_t) * data->candidates_capacity);
+		data->samples = realloc(data->samples, sizeof(task_sample) * data->candidates_capacity);
+	}
+	data->candidates[data->num_candidates] = (taskstats_task_t){ .id = id, .is_tgid = is_tgid };
+	data->candidate_targets[data->num_candidates] = target;
+	data->num_candidates++;
+}
+
+static void resize_data_buffers(taskstats_delay_data *data, uint32_t num_tasks) {
+	if (num_tasks > data->tasks_capacity) {
+		data->tasks_capacity = num_tasks;
+		data->tasks = realloc(data->tasks, sizeof(taskstats_task_t) * data->tasks_capacity);
+		data->task_targets = realloc(data->task_targets, sizeof(uint32_t) * data->tasks_capacity);
+		data->task_commands = realloc(data->task_commands, TS_COMM_LEN * data->tasks_capacity);
+		data->task_keys = realloc(data->task_keys, sizeof(task_key) * data->tasks_capacity);
+	}
+	data->num_tasks = num_tasks;
+}
+
+static void cleanup_data_buffers(taskstats_delay_data *data) {
+	taskstats_close(&data->query_socket);
+	if (data->has_exit_socket) {
+		taskstats_close(&data->exit_socket);
+	}
+	for (uint32_t target = 0; target < data->num_targets; target++) {
+		free(data->targets[target].spec);
+		if (data->targets[target].kind == TARGET_CGROUP) {
+			proc_file_close(&data->targets[target].procs_file);
+		}
+	}
+	free(data->targets);
+	free(data->candidates);
+	free(data->candidate_targets);
+	free(data->samples);
+	free(data->tasks);
+	free(data->task_targets);
+	free(data->task_commands);
+	free(data->task_keys);
+	metric_columns_free(&data->previous_metrics);
+	metric_columns_free(&data->current_metrics);
+}
+
+
+/**
+ * Message writing logic
+ */
+typedef enum {
+	TASK_LIST = 0,
+	METRICS = 1,
+	METRICS_PACKED = 2
+} taskstats_delay_msgtype;
+
+#define TASK_MAX_SIZE (1 + 2 * VAR_UINT32_MAX_SIZE + TS_COMM_LEN)
+
+static void read_command(uint32_t tgid, char *command) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%u/comm", tgid);
+	FILE *comm_file = fopen(path, "r");
+	if (comm_file == NULL) {
+		return;
+	}
+	if (fgets(command, TS_COMM_LEN, comm_file) != NULL) {
+		command[strcspn(command, "\n")] = '\0';
+	}
+	fclose(comm_file);
+}
+
+static void write_task_list(trace_file_t *trace_file, nanosec_t timestamp, taskstats_delay_data *data) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("taskstats-delay: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("taskstats-delay: Writing message type: %u\n", TASK_LIST & 0xFF);
+	*buffer_ptr = (char)TASK_LIST;
+	buffer_ptr++;
+
+	DEBUG_PRINT("taskstats-delay: Writing num targets: %u\n", data->num_targets);
+	write_var_uint32_t(data->num_targets, &buffer_ptr);
+
+	for (uint32_t target = 0; target < data->num_targets; target++) {
+		const char *spec = data->targets[target].spec;
+		size_t spec_len = strlen(spec);
+		DEBUG_PRINT("taskstats-delay: Writing target: %s\n", spec);
+		if ((size_t)(end_of_buffer - buffer_ptr) < spec_len + 1) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+		memcpy(buffer_ptr, spec, spec_len + 1);
+		buffer_ptr += spec_len + 1;
+	}
+
+	if ((size_t)(end_of_buffer - buffer_ptr) < VAR_UINT32_MAX_SIZE) {
+		fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+		buffer_ptr = trace_file->write_buffer;
+	}
+	DEBUG_PRINT("taskstats-delay: Writing num tasks: %u\n", data->num_tasks);
+	write_var_uint32_t(data->num_tasks, &buffer_ptr);
+
+	// Candidates that exist are the recorded tasks, in the same order
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		if (!data->samples[candidate].found) {
+			continue;
+		}
+		if ((size_t)(end_of_buffer - buffer_ptr) < TASK_MAX_SIZE) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+		}
+
+		// The kernel only reports the command of threads, not of thread groups, so that
+		// of thread groups was carried over from the previous task list or is read here
+		char *command = data->samples[candidate].command;
+		if (*command == '\0') {
+			read_command(data->candidates[candidate].id, command);
+		}
+		DEBUG_PRINT("taskstats-delay: Writing task %u (%s)\n", data->candidates[candidate].id, command);
+		*buffer_ptr = (char)(data->candidates[candidate].is_tgid ? TARGET_TGID : TARGET_PID);
+		buffer_ptr++;
+		write_var_uint32_t(data->candidates[candidate].id, &buffer_ptr);
+		write_var_uint32_t(data->candidate_targets[candidate], &buffer_ptr);
+		size_t command_len = strnlen(command, TS_COMM_LEN - 1);
+		memcpy(buffer_ptr, command, command_len);
+		buffer_ptr += command_len;
+		*buffer_ptr = '\0';
+		buffer_ptr++;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_metrics(trace_file_t *trace_file, nanosec_t timestamp, taskstats_delay_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("taskstats-delay: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("taskstats-delay: Writing message type: %u\n", METRICS & 0xFF);
+	*buffer_ptr = (char)METRICS;
+	buffer_ptr++;
+
+	DEBUG_PRINT("taskstats-delay: Writing num tasks: %u\n", data->num_tasks);
+	write_var_uint32_t(data->num_tasks, &buffer_ptr);
+
+	// Encode as many tasks at once as fit in the remaining buffer space
+	uint32_t task_id = 0;
+	while (task_id < data->num_tasks) {
+		uint32_t batch_size = (size_t)(end_of_buffer - buffer_ptr) /
+			(TASKSTATS_DELAY_FIELDS * VAR_UINT64_MAX_SIZE);
+		if (batch_size == 0) {
+			fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+			buffer_ptr = trace_file->write_buffer;
+			continue;
+		}
+		if (batch_size > data->num_tasks - task_id) {
+			batch_size = data->num_tasks - task_id;
+		}
+
+		DEBUG_PRINT("taskstats-delay: Writing tasks %u-%u\n", task_id, task_id + batch_size - 1);
+		write_var_uint64_columns(deltas, task_id, batch_size, &buffer_ptr);
+		task_id += batch_size;
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+static void write_packed_metrics(trace_file_t *trace_file, nanosec_t timestamp, taskstats_delay_data *data, metric_columns_t *deltas) {
+	char *buffer_ptr = trace_file->write_buffer;
+	char *end_of_buffer = trace_file->write_buffer + sizeof(trace_file->write_buffer);
+
+	DEBUG_PRINT("taskstats-delay: Writing timestamp: %llu\n", timestamp);
+	write_timestamp(trace_file, timestamp, &buffer_ptr);
+
+	DEBUG_PRINT("taskstats-delay: Writing message type: %u\n", METRICS_PACKED & 0xFF);
+	*buffer_ptr = (char)METRICS_PACKED;
+	buffer_ptr++;
+
+	DEBUG_PRINT("taskstats-delay: Writing num tasks: %u\n", data->num_tasks);
+	write_var_uint32_t(data->num_tasks, &buffer_ptr);
+
+	// Pack each field of (up to PACKED_GROUP_MAX_VALUES) tasks as one group
+	for (uint32_t field = 0; field < TASKSTATS_DELAY_FIELDS; field++) {
+		const uint64_t *column = metric_column(deltas, field);
+		for (uint32_t task_id = 0; task_id < data->num_tasks; task_id += PACKED_GROUP_MAX_VALUES) {
+			uint32_t group_size = data->num_tasks - task_id;
+			if (group_size > PACKED_GROUP_MAX_VALUES) {
+				group_size = PACKED_GROUP_MAX_VALUES;
+			}
+			if ((size_t)(end_of_buffer - buffer_ptr) < PACKED_GROUP_MAX_SIZE(group_size)) {
+				fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+				buffer_ptr = trace_file->write_buffer;
+			}
+
+			DEBUG_PRINT("taskstats-delay: Writing field %u of tasks %u-%u\n", field, task_id, task_id + group_size - 1);
+			write_packed_uint64_group(column + task_id, group_size, &buffer_ptr);
+		}
+	}
+
+	fwrite(trace_file->write_buffer, (size_t)(buffer_ptr - trace_file->write_buffer), 1, trace_file->output_file);
+}
+
+
+/**
+ * Taskstats query logic
+ */
+static void collect_candidates(taskstats_delay_data *data) {
+	data->num_candidates = 0;
+	for (uint32_t target = 0; target < data->num_targets; target++) {
+		delay_target *delay_target = &data->targets[target];
+		if (delay_target->kind != TARGET_CGROUP) {
+			add_candidate(data, delay_target->id, delay_target->kind == TARGET_TGID, target);
+			continue;
+		}
+
+		// cgroup.procs lists one tgid per line
+		if (!proc_file_read(&delay_target->procs_file)) {
+			continue;
+		}
+		const char *ptr = delay_target->procs_file.buffer;
+		while (*ptr != '\0') {
+			uint32_t tgid = (uint32_t)parse_uint64(&ptr);
+			if (tgid != 0) {
+				add_candidate(data, tgid, true, target);
+			}
+			skip_line(&ptr);
+		}
+	}
+}
+
+static void store_sample(void *context, uint32_t task_index, const struct taskstats *stats) {
+	taskstats_delay_data *data = (taskstats_delay_data *)context;
+	task_sample *sample = &data->samples[task_index];
+	if (stats == NULL) {
+		// The task has exited
+		return;
+	}
+
+	sample->found = true;
+	sample->values[CPU_COUNT] = stats->cpu_count;
+	sample->values[CPU_DELAY_NS] = stats->cpu_delay_total;
+	sample->values[CPU_RUN_NS] = stats->cpu_run_real_total;
+	sample->values[BLKIO_COUNT] = stats->blkio_count;
+	sample->values[BLKIO_DELAY_NS] = stats->blkio_delay_total;
+	sample->values[SWAPIN_COUNT] = stats->swapin_count;
+	sample->values[SWAPIN_DELAY_NS] = stats->swapin_delay_total;
+	sample->values[FREEPAGES_COUNT] = stats->freepages_count;
+	sample->values[FREEPAGES_DELAY_NS] = stats->freepages_delay_total;
+	memcpy(sample->command, stats->ac_comm, TS_COMM_LEN);
+	sample->command[TS_COMM_LEN - 1] = '\0';
+}
+
+static void ignore_exit_stats(void *context, uint32_t id, bool is_tgid, const struct taskstats *stats) {
+	(void)context;
+	(void)id;
+	(void)is_tgid;
+	(void)stats;
+}
+
+static bool tasks_changed(taskstats_delay_data *data) {
+	uint32_t task_id = 0;
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		if (!data->samples[candidate].found) {
+			continue;
+		}
+		if (task_id >= data->num_tasks || data->tasks[task_id].id != data->candidates[candidate].id ||
+				data->tasks[task_id].is_tgid != data->candidates[candidate].is_tgid ||
+				data->task_targets[task_id] != data->candidate_targets[candidate]) {
+			return true;
+		}
+		task_id++;
+	}
+	return task_id != data->num_tasks;
+}
+
+static inline uint64_t get_task_key(const taskstats_task_t *task) {
+	return (uint64_t)task->id << 1 | (task->is_tgid ? 1 : 0);
+}
+
+static int compare_task_keys(const void *a, const void *b) {
+	uint64_t key_a = ((const task_key *)a)->key;
+	uint64_t key_b = ((const task_key *)b)->key;
+	return key_a < key_b ? -1 : key_a > key_b;
+}
+
+static void enumerate_tasks(trace_file_t *trace_file, nanosec_t sample_time) {
+	taskstats_delay_data *data = (taskstats_delay_data *)trace_file->data;
+
+	uint32_t num_tasks = 0;
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		num_tasks += data->samples[candidate].found;
+	}
+
+	// Sort the previously recorded tasks, so that tasks that remain recorded keep
+	// their previous counters and commands
+	uint32_t num_previous_tasks = data->num_tasks;
+	for (uint32_t task_id = 0; task_id < num_previous_tasks; task_id++) {
+		data->task_keys[task_id] = (task_key){ .key = get_task_key(&data->tasks[task_id]), .task_id = task_id };
+	}
+	qsort(data->task_keys, num_previous_tasks, sizeof(task_key), compare_task_keys);
+
+	// The current metrics are overwritten in this tick, so they hold the previous
+	// counters of the new task list until the buffers are swapped
+	metric_columns_resize(&data->current_metrics, num_tasks);
+	uint32_t task_id = 0;
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		if (!data->samples[candidate].found) {
+			continue;
+		}
+		task_key key = { .key = get_task_key(&data->candidates[candidate]) };
+		const task_key *previous = bsearch(&key, data->task_keys, num_previous_tasks, sizeof(task_key), compare_task_keys);
+		if (previous != NULL) {
+			// New tasks start from zero, so their first deltas are absolute values
+			for (uint32_t field = 0; field < TASKSTATS_DELAY_FIELDS; field++) {
+				metric_column(&data->current_metrics, field)[task_id] =
+					metric_column(&data->previous_metrics, field)[previous->task_id];
+			}
+			if (data->samples[candidate].command[0] == '\0') {
+				memcpy(data->samples[candidate].command, data->task_commands[previous->task_id], TS_COMM_LEN);
+			}
+		}
+		task_id++;
+	}
+	metric_columns_t tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+	metric_columns_resize(&data->current_metrics, num_tasks);
+
+	// Reallocate data structures for the enumerated tasks
+	resize_data_buffers(data, num_tasks);
+	task_id = 0;
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		if (data->samples[candidate].found) {
+			data->tasks[task_id] = data->candidates[candidate];
+			data->task_targets[task_id] = data->candidate_targets[candidate];
+			task_id++;
+		}
+	}
+
+	// Write the task list to the output file, which reads the commands of new thread groups
+	write_task_list(trace_file, sample_time, data);
+	task_id = 0;
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		if (data->samples[candidate].found) {
+			memcpy(data->task_commands[task_id], data->samples[candidate].command, TS_COMM_LEN);
+			task_id++;
+		}
+	}
+}
+
+static void parse_taskstats_delay(trace_file_t *trace_file) {
+	nanosec_t sample_time = get_time();
+
+	taskstats_delay_data *data = (taskstats_delay_data *)trace_file->data;
+	if (data->has_exit_socket) {
+		taskstats_receive(&data->exit_socket, ignore_exit_stats, NULL);
+	}
+
+	// Query the statistics of all tasks of all targets
+	collect_candidates(data);
+	memset(data->samples, 0, sizeof(task_sample) * data->num_candidates);
+	if (!taskstats_query(&data->query_socket, data->candidates, data->num_candidates, store_sample, data)) {
+		DEBUG_PRINT("taskstats-delay: Failed to query task statistics: %s\n", strerror(errno));
+		return;
+	}
+	if (tasks_changed(data)) {
+		// Tasks were started or have exited, so re-enumerate all tasks
+		enumerate_tasks(trace_file, sample_time);
+	}
+
+	uint32_t task_id = 0;
+	for (uint32_t candidate = 0; candidate < data->num_candidates; candidate++) {
+		if (!data->samples[candidate].found) {
+			continue;
+		}
+		for (uint32_t field = 0; field < TASKSTATS_DELAY_FIELDS; field++) {
+			metric_column(&data->current_metrics, field)[task_id] = data->samples[candidate].values[field];
+		}
+		task_id++;
+	}
+
+	// Let previous = current - previous and write the deltas to the output file
+	metric_columns_delta(&data->previous_metrics, &data->current_metrics);
+	if (data->encoding == ENCODING_PACKED) {
+		write_packed_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	} else {
+		write_metrics(trace_file, sample_time, data, &data->previous_metrics);
+	}
+
+	// Swap the metric buffers
+	metric_columns_t tmp = data->previous_metrics;
+	data->previous_metrics = data->current_metrics;
+	data->current_metrics = tmp;
+}
+
+
+/**
+ * Parse module initialization and cleanup
+ */
+static const char taskstats_delay_source_name[] = "taskstats";
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static bool parse_target(const char *spec, size_t spec_len, delay_target *target) {
+	target->spec = strndup(spec, spec_len);
+	const char *ptr = target->spec;
+	if (CONSUME_PREFIX(&ptr, "cgroup:")) {
+		target->kind = TARGET_CGROUP;
+		// Relative paths are relative to the cgroup root
+		char path[4096];
+		snprintf(path, sizeof(path), "%s%s/cgroup.procs", *ptr == '/' ? "" : CGROUP_ROOT "/", ptr);
+		if (!proc_file_open(&target->procs_file, path)) {
+			printf("Failed to open %s: %s\n", path, strerror(errno));
+			proc_file_close(&target->procs_file);
+			return false;
+		}
+		return true;
+	}
+
+	if (CONSUME_PREFIX(&ptr, "pid:")) {
+		target->kind = TARGET_PID;
+	} else {
+		// Processes are the default, with or without the tgid: prefix
+		CONSUME_PREFIX(&ptr, "tgid:");
+		target->kind = TARGET_TGID;
+	}
+	target->id = (uint32_t)parse_uint64(&ptr);
+	if (target->id == 0 || *ptr != '\0') {
+		printf("Invalid delay accounting target: %s\n", target->spec);
+		return false;
+	}
+	return true;
+}
+
+static void check_delay_accounting(void) {
+	// Delays are only accounted if enabled at boot (delayacct) or at runtime (since Linux 5.14)
+	FILE *sysctl_file = fopen("/proc/sys/kernel/task_delayacct", "r");
+	if (sysctl_file == NULL) {
+		return;
+	}
+	int enabled = 1;
+	if (fscanf(sysctl_file, "%d", &enabled) == 1 && enabled == 0) {
+		printf("Delay accounting is disabled, delays will be zero (enable with sysctl kernel.task_delayacct=1)\n");
+	}
+	fclose(sysctl_file);
+}
+
+static void cleanup_taskstats_delay(trace_file_t *trace_file) {
+	fclose(trace_file->output_file);
+	cleanup_data_buffers((taskstats_delay_data *)trace_file->data);
+	free(trace_file->data);
+	free(trace_file);
+}
+
+trace_file_t *init_taskstats_delay_parser(const char *output_directory, const char *hostname, metric_encoding_t encoding,
+		const char *targets, uint32_t max_entities) {
+	taskstats_delay_data *data = calloc(1, sizeof(taskstats_delay_data));
+	if (!taskstats_open(&data->query_socket)) {
+		free(data);
+		return NULL;
+	}
+	data->encoding = encoding;
+
+	// Parse the comma-separated list of targets
+	bool has_tgid_targets = false;
+	for (const char *spec = targets; *spec != '\0';) {
+		size_t spec_len = strcspn(spec, ",");
+		if (spec_len > 0) {
+			data->targets = realloc(data->targets, sizeof(delay_target) * (data->num_targets + 1));
+			delay_target *target = &data->targets[data->num_targets];
+			memset(target, 0, sizeof(*target));
+			data->num_targets++;
+			if (!parse_target(spec, spec_len, target)) {
+				cleanup_data_buffers(data);
+				free(data);
+				return NULL;
+			}
+			has_tgid_targets |= target->kind != TARGET_PID;
+		}
+		spec += spec_len;
+		if (*spec == ',') {
+			spec++;
+		}
+	}
+
+	// Without an exit listener, the totals of a tgid drop when one of its threads exits
+	if (has_tgid_targets && taskstats_open(&data->exit_socket)) {
+		data->has_exit_socket = taskstats_register_exit(&data->exit_socket);
+		if (!data->has_exit_socket) {
+			taskstats_close(&data->exit_socket);
+		}
+	}
+	check_delay_accounting();
+
+	metric_columns_init(&data->previous_metrics, TASKSTATS_DELAY_FIELDS, max_entities);
+	metric_columns_init(&data->current_metrics, TASKSTATS_DELAY_FIELDS, max_entities);
+
+	char *output_filename = malloc(strlen(output_directory) + strlen("/taskstats-delay-") + strlen(hostname) + 1);
+	*output_filename = '\0';
+	strcat(output_filename, output_directory);
+	strcat(output_filename, "/taskstats-delay-");
+	strcat(output_filename, hostname);
+
+	trace_file_t *trace_file = calloc(1, sizeof(trace_file_t));
+	trace_file->parse_callback = parse_taskstats_delay;
+	trace_file->cleanup_callback = cleanup_taskstats_delay;
+	trace_file->source_file_name = taskstats_delay_source_name;
+	trace_file->has_list_records = true;
+	trace_file->data = data;
+	trace_file->output_file = fopen(output_filename, "wb");
+
+	free(output_filename);
+
+	return trace_file;
+}
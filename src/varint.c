@@ -0,0 +1,90 @@
+
+#include "varint.h"
+
+#include <string.h>
+#ifdef VARINT_HAVE_BMI2
+#include <immintrin.h>
+#endif
+
+// Fallback for CPUs without a fast pdep. Branch-reduced variants that spread
+// the 7-bit groups with shifts and masks were over twice as slow as this loop
+// on bin/varint-bench. The buffer pointer is kept in a local, as every byte
+// store could otherwise alias *buffer and force it to be reloaded.
+void write_var_uint64_array_scalar(const uint64_t *values, size_t count, char **buffer) {
+	char *ptr = *buffer;
+	for (size_t i = 0; i < count; i++) {
+		write_var_uint64_t(values[i], &ptr);
+	}
+	*buffer = ptr;
+}
+
+#ifdef VARINT_HAVE_BMI2
+
+/**
+ * Computes the encoded length of a value up front, deposits its low 56 bits
+ * into the low 7 bits of 8 bytes with pdep, sets the continuation bits for all
+ * but the last byte, and stores the result as a single 64-bit word. Values of
+ * 2^56 and above need one or two more bytes, which are rare for deltas and
+ * handled separately. Single-byte values, by far the most common case for
+ * per-tick deltas, skip all of this.
+ */
+static inline unsigned int var_uint64_length(uint64_t value) {
+	unsigned int bits = 64 - __builtin_clzll(value | 1);
+	return (bits + 6) / 7;
+}
+
+static inline char *store_var_uint64_word(uint64_t value, uint64_t spread, char *ptr) {
+	unsigned int length = var_uint64_length(value);
+	if (__builtin_expect(length <= 8, 1)) {
+		uint64_t word = spread | (0x0080808080808080ULL >> (8 * (8 - length)));
+		memcpy(ptr, &word, sizeof(word));
+	} else {
+		uint64_t word = spread | 0x8080808080808080ULL;
+		memcpy(ptr, &word, sizeof(word));
+		uint64_t high = value >> 56;
+		ptr[8] = (char)((high & 0x7F) | (high >= 0x80 ? 0x80 : 0));
+		ptr[9] = (char)(high >> 7);
+	}
+	return ptr + length;
+}
+
+__attribute__((target("bmi2")))
+void write_var_uint64_array_bmi2(const uint64_t *values, size_t count, char **buffer) {
+	char *ptr = *buffer;
+	for (size_t i = 0; i < count; i++) {
+		if (values[i] < 0x80) {
+			*ptr++ = (char)values[i];
+			continue;
+		}
+		// pdep deposits consecutive 7-bit groups into the low 7 bits of each byte
+		ptr = store_var_uint64_word(values[i], _pdep_u64(values[i], 0x7F7F7F7F7F7F7F7FULL), ptr);
+	}
+	*buffer = ptr;
+}
+
+#endif
+
+/**
+ * Runtime dispatch
+ */
+static void (*write_var_uint64_array_impl)(const uint64_t *, size_t, char **) = write_var_uint64_array_scalar;
+
+// Selected once when the program or library is loaded, before any thread can encode
+__attribute__((constructor))
+static void write_var_uint64_array_select() {
+#ifdef VARINT_HAVE_BMI2
+	// Required before __builtin_cpu_supports in constructors
+	__builtin_cpu_init();
+	// pdep is microcoded (and much slower than the inline encoder) on AMD CPUs before Zen 3
+	if (__builtin_cpu_supports("bmi2") &&
+			!__builtin_cpu_is("amdfam15h") &&
+			!__builtin_cpu_is("znver1") &&
+			!__builtin_cpu_is("znver2")) {
+		write_var_uint64_array_impl = write_var_uint64_array_bmi2;
+	}
+#endif
+}
+
+void write_var_uint64_array(const uint64_t *values, size_t count, char **buffer) {
+	write_var_uint64_array_impl(values, count, buffer);
+}
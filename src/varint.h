@@ -2,8 +2,12 @@
 #ifndef __VARINT_H__
 #define __VARINT_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define VAR_UINT32_MAX_SIZE 5
+#define VAR_UINT64_MAX_SIZE 10
+
 static inline void write_var_uint32_t(uint32_t value, char **buffer) {
 	char *next_ptr = *buffer;
 	while (value >= 0x80ULL) {
@@ -39,4 +43,20 @@ static inline void write_var_int64_t(int64_t value, char **buffer) {
 		write_var_uint64_t(((uint64_t)-value) << 1 | 1, buffer);
 }
 
+/**
+ * Batch encoding of arrays of unsigned 64-bit values, producing output that is
+ * bit-identical to repeated calls to write_var_uint64_t. The buffer must have
+ * room for count * VAR_UINT64_MAX_SIZE bytes, as encoders may store whole
+ * 64-bit words past the end of the encoded data (but within that bound).
+ *
+ * write_var_uint64_array selects the fastest implementation supported by the
+ * CPU on first use.
+ */
+void write_var_uint64_array(const uint64_t *values, size_t count, char **buffer);
+void write_var_uint64_array_scalar(const uint64_t *values, size_t count, char **buffer);
+#if defined(__x86_64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define VARINT_HAVE_BMI2 1
+void write_var_uint64_array_bmi2(const uint64_t *values, size_t count, char **buffer);
+#endif
+
 #endif
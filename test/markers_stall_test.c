@@ -0,0 +1,124 @@
+/**
+ * Test for writers that stall between claiming and publishing a marker slot
+ *
+ * Stops a writer thread after it claimed a slot (stage 0) or while it fills
+ * the slot (stage 1), until the monitor skips the slot. Then checks that the
+ * ring keeps accepting markers over the following laps and that the late
+ * writer neither publishes its marker nor overwrites a marker of the next lap.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void stall_writer(int stage);
+#define RESMON_MARKERS_STALL_POINT(stage) stall_writer(stage)
+
+#include "resmon_markers.h"
+#include "../src/markers.h"
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			printf("FAIL (stage %d): %s, line %d\n", stall_stage, #condition, __LINE__); \
+			return false; \
+		} \
+	} while (0)
+
+static int stall_stage;
+static int stalled;
+static int released;
+static __thread bool is_stalled_writer = false;
+
+static void stall_writer(int stage) {
+	if (!is_stalled_writer || stage != stall_stage) {
+		return;
+	}
+	__atomic_store_n(&stalled, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE)) {
+		usleep(1000);
+	}
+}
+
+static void *write_late_marker(void *markers) {
+	is_stalled_writer = true;
+	return resmon_marker((resmon_markers_t *)markers, 1, RESMON_MARKER_INSTANT, "late") ? markers : NULL;
+}
+
+static bool run_stage(const char *output_directory, int stage) {
+	stall_stage = stage;
+	stalled = 0;
+	released = 0;
+
+	char shm_name[64];
+	snprintf(shm_name, sizeof(shm_name), "/resmon-markers-test-%d", (int)getpid());
+	trace_file_t *trace_file = init_markers_parser(output_directory, "test", shm_name);
+	resmon_markers_t *markers = resmon_markers_open(shm_name);
+	CHECK(markers != NULL);
+	uint64_t capacity = markers->capacity;
+
+	pthread_t writer;
+	pthread_create(&writer, NULL, write_late_marker, markers);
+	while (!__atomic_load_n(&stalled, __ATOMIC_ACQUIRE)) {
+		usleep(1000);
+	}
+
+	// The monitor skips the slot once it stayed unpublished for a second
+	trace_file->parse_callback(trace_file);
+	usleep(1100000);
+	trace_file->parse_callback(trace_file);
+	CHECK(markers->read_position == 1);
+
+	// Fill the rest of the lap and claim the stalled slot's position one lap ahead
+	for (uint64_t marker = 1; marker < capacity; marker++) {
+		CHECK(resmon_marker(markers, 2, RESMON_MARKER_INSTANT, "current"));
+	}
+	trace_file->parse_callback(trace_file);
+	CHECK(markers->read_position == capacity);
+	CHECK(resmon_marker(markers, 3, RESMON_MARKER_INSTANT, "next"));
+	uint64_t next_position = markers->write_position - 1;
+
+	__atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+	void *late_result;
+	pthread_join(writer, &late_result);
+	CHECK(late_result == NULL);
+	CHECK(strcmp(markers->slots[next_position % capacity].label, "next") == 0);
+	CHECK(markers->slots[next_position % capacity].phase_id == 3);
+
+	trace_file->parse_callback(trace_file);
+	CHECK(markers->read_position == markers->write_position);
+
+	// The ring keeps working over the following laps
+	for (int lap = 0; lap < 4; lap++) {
+		for (uint64_t marker = 0; marker < capacity / 2; marker++) {
+			CHECK(resmon_marker(markers, 4, RESMON_MARKER_INSTANT, "after"));
+		}
+		trace_file->parse_callback(trace_file);
+		CHECK(markers->read_position == markers->write_position);
+	}
+	CHECK(markers->dropped == 0);
+
+	resmon_markers_close(markers);
+	trace_file->cleanup_callback(trace_file);
+	return true;
+}
+
+int main() {
+	char output_directory[] = "/tmp/resmon-markers-test-XXXXXX";
+	if (mkdtemp(output_directory) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	bool passed = run_stage(output_directory, 0) && run_stage(output_directory, 1);
+
+	char output_filename[sizeof(output_directory) + 16];
+	snprintf(output_filename, sizeof(output_filename), "%s/markers-test", output_directory);
+	unlink(output_filename);
+	rmdir(output_directory);
+
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	return passed ? 0 : 1;
+}